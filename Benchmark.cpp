@@ -0,0 +1,841 @@
+/*!
+* @file Benchmark.cpp
+* @brief Google Benchmark suite of dictionary hot paths and of individual optimizations
+* @details Hot path benchmarks are named HotPath/<operation><key type,value type> and parameterized by key count,
+* duplicate ratio in percent and thread count. Key counts range from 1e3 up to LWW_BENCHMARK_MAX_KEYS (environment,
+* default 1e6, up to 1e8). For machine-readable results tracked between releases, run with
+* --benchmark_out=<file> --benchmark_out_format=json --benchmark_filter=HotPath
+* Building with -DLWW_ENABLE_STATS measures the same suite with instrumentation, to compare its overhead.
+*/
+
+#include "LWWElementDict.h"
+#include "ShardedLWWElementDict.h"
+#include "LWWSerialization.h"
+#include "LWWMappedSnapshot.h"
+#include "DurableLWWElementDict.h"
+#include "PersistentLWWElementDict.h"
+#include "LWWSharedValue.h"
+#include "LWWHybridLogicalClock.h"
+#include "LWWTimestampSource.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+
+static constexpr int keysPerThread = 1 << 16;
+
+
+static thread_local std::uint64_t allocationCount = 0; //!< Global heap allocations of the calling thread
+
+
+[[gnu::noinline]] void * operator new(std::size_t size) {
+    ++allocationCount;
+    if(void * memory = std::malloc(size != 0 ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+
+[[gnu::noinline]] void operator delete(void * memory) noexcept {
+    std::free(memory);
+}
+
+
+[[gnu::noinline]] void operator delete(void * memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+
+static std::unique_ptr<LWWElementDict<int, int, int>> sharedDict;
+static std::unique_ptr<ShardedLWWElementDict<int, int, int>> sharedShardedDict;
+static std::unique_ptr<DurableLWWElementDict<int, int, int>> sharedDurableDict;
+
+
+static void BM_SingleLockAddElement(benchmark::State & state) {
+    if(state.thread_index() == 0) {
+        sharedDict = std::make_unique<LWWElementDict<int, int, int>>();
+    }
+
+    const int keyOffset = static_cast<int>(state.thread_index()) * keysPerThread;
+    int i = 0;
+
+    for(auto _ : state) {
+        sharedDict->addElement(keyOffset + (i % keysPerThread), i, i);
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SingleLockAddElement)->ThreadRange(1, 32)->UseRealTime();
+
+
+static void BM_ShardedAddElement(benchmark::State & state) {
+    if(state.thread_index() == 0) {
+        sharedShardedDict = std::make_unique<ShardedLWWElementDict<int, int, int>>(64);
+    }
+
+    const int keyOffset = static_cast<int>(state.thread_index()) * keysPerThread;
+    int i = 0;
+
+    for(auto _ : state) {
+        sharedShardedDict->addElement(keyOffset + (i % keysPerThread), i, i);
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ShardedAddElement)->ThreadRange(1, 32)->UseRealTime();
+
+
+template <template <typename, typename, typename> class Storage>
+static std::unique_ptr<ShardedLWWElementDict<int, int, int, Storage>> sharedStorageDict;
+
+
+template <template <typename, typename, typename> class Storage>
+static void BM_StorageAllocations(benchmark::State & state) {
+    if(state.thread_index() == 0) {
+        sharedStorageDict<Storage> = std::make_unique<ShardedLWWElementDict<int, int, int, Storage>>(64);
+    }
+
+    const int keyOffset = static_cast<int>(state.thread_index()) * keysPerThread;
+    const std::uint64_t allocationsBefore = allocationCount;
+    int i = 0;
+
+    for(auto _ : state) {
+        // Every fourth element starts a history, the others extend one.
+        sharedStorageDict<Storage>->addElement(keyOffset + (i / 4) % keysPerThread, i, i);
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["allocs_per_item"] = benchmark::Counter(
+        static_cast<double>(allocationCount - allocationsBefore) / static_cast<double>(state.iterations()),
+        benchmark::Counter::kAvgThreads
+    );
+}
+BENCHMARK_TEMPLATE(BM_StorageAllocations, TreeStorage)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_StorageAllocations, PooledTreeStorage)->ThreadRange(1, 16)->UseRealTime();
+
+
+static void BM_ReadHeavyMixed(benchmark::State & state) {
+    if(state.thread_index() == 0) {
+        sharedDict = std::make_unique<LWWElementDict<int, int, int>>();
+        for(int k = 0; k < keysPerThread; ++k) {
+            sharedDict->addElement(k, k, 0);
+        }
+    }
+
+    int i = static_cast<int>(state.thread_index()) * 7919;
+
+    for(auto _ : state) {
+        // 95% reads, 5% writes.
+        if(i % 20 == 0) {
+            sharedDict->addElement(i % keysPerThread, i, i);
+        } else {
+            benchmark::DoNotOptimize(sharedDict->getValueByKey(i % keysPerThread));
+        }
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ReadHeavyMixed)->ThreadRange(1, 32)->UseRealTime();
+
+
+static LWWHybridLogicalClock sharedClock(1);
+
+
+static void BM_HybridClockAddElement(benchmark::State & state) {
+    static std::unique_ptr<ShardedLWWElementDict<int, int, LWWHybridTimestamp>> dict;
+    if(state.thread_index() == 0) {
+        dict = std::make_unique<ShardedLWWElementDict<int, int, LWWHybridTimestamp>>(64);
+    }
+
+    const int keyOffset = static_cast<int>(state.thread_index()) * keysPerThread;
+    int i = 0;
+
+    for(auto _ : state) {
+        dict->addElement(keyOffset + (i % keysPerThread), i, sharedClock.now());
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HybridClockAddElement)->ThreadRange(1, 32)->UseRealTime();
+
+
+static void BM_StampSystemClock(benchmark::State & state) {
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(std::chrono::system_clock::now());
+    }
+}
+BENCHMARK(BM_StampSystemClock)->ThreadRange(1, 8);
+
+
+static void BM_StampTimestampSource(benchmark::State & state) {
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(LWWTimestampSource<std::chrono::system_clock::time_point>().next());
+    }
+}
+BENCHMARK(BM_StampTimestampSource)->ThreadRange(1, 8);
+
+
+static std::vector<LWWElementDict<int, int, int>::Op> makeOperations(const int & count) {
+    std::vector<LWWElementDict<int, int, int>::Op> operations;
+    operations.reserve(count);
+
+    for(int i = 0; i < count; ++i) {
+        operations.push_back({ LWWElementDict<int, int, int>::Op::Type::add, (i * 7919) % (1 << 20), i, i });
+    }
+
+    return operations;
+}
+
+
+static void BM_AddElementLoop(benchmark::State & state) {
+    const auto operations = makeOperations(static_cast<int>(state.range(0)));
+
+    for(auto _ : state) {
+        LWWElementDict<int, int, int> dict;
+        for(const auto & operation : operations) {
+            dict.addElement(operation.key, operation.value, operation.timestamp);
+        }
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_AddElementLoop)->RangeMultiplier(10)->Range(1000, 100000);
+
+
+static void BM_ApplyBatch(benchmark::State & state) {
+    const auto operations = makeOperations(static_cast<int>(state.range(0)));
+
+    for(auto _ : state) {
+        LWWElementDict<int, int, int> dict;
+        dict.applyBatch(operations.begin(), operations.end());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ApplyBatch)->RangeMultiplier(10)->Range(1000, 100000);
+
+
+template <typename V, bool moveFlag>
+static void BM_AddLargeValue(benchmark::State & state) {
+    const std::size_t valueSize = static_cast<std::size_t>(state.range(0));
+    LWWElementDict<std::string, V, int> dict;
+    int i = 0;
+
+    for(auto _ : state) {
+        std::string k = "key:" + std::to_string(i % keysPerThread);
+        V v(std::string(valueSize, 'v'));
+        if constexpr(moveFlag) {
+            dict.addElement(std::move(k), std::move(v), i);
+        } else {
+            dict.addElement(k, v, i);
+        }
+        ++i;
+    }
+
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_AddLargeValue, std::string, false)->RangeMultiplier(16)->Range(16, 1 << 16);
+BENCHMARK_TEMPLATE(BM_AddLargeValue, std::string, true)->RangeMultiplier(16)->Range(16, 1 << 16);
+BENCHMARK_TEMPLATE(BM_AddLargeValue, LWWSharedValue<std::string>, true)->RangeMultiplier(16)->Range(16, 1 << 16);
+
+
+template <template <typename, typename, typename> class Storage>
+static void BM_MergeWith(benchmark::State & state) {
+    const int keyCount = static_cast<int>(state.range(0));
+
+    LWWElementDict<int, int, int, Storage> replica1;
+    LWWElementDict<int, int, int, Storage> replica2;
+    for(int k = 0; k < keyCount; ++k) {
+        // Half of the keys are shared, every shared key carries a conflicting element.
+        replica1.addElement(k, k, 1);
+        replica2.addElement(k + keyCount / 2, k, 2);
+    }
+
+    for(auto _ : state) {
+        state.PauseTiming();
+        auto target = std::make_unique<LWWElementDict<int, int, int, Storage>>(replica1);
+        state.ResumeTiming();
+
+        target->mergeWith(replica2);
+        benchmark::ClobberMemory();
+
+        state.PauseTiming();
+        target.reset();
+        state.ResumeTiming();
+    }
+
+    state.SetComplexityN(state.range(0));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BM_MergeWith, TreeStorage)->RangeMultiplier(4)->Range(1 << 12, 1 << 22)->Complexity();
+BENCHMARK_TEMPLATE(BM_MergeWith, FlatStorage)->RangeMultiplier(4)->Range(1 << 12, 1 << 22)->Complexity();
+
+
+static void BM_DurableAddElement(benchmark::State & state) {
+    const std::string path = (std::filesystem::temp_directory_path() / "lww_benchmark_wal.log").string();
+    if(state.thread_index() == 0) {
+        std::remove(path.c_str());
+        sharedDurableDict = std::make_unique<DurableLWWElementDict<int, int, int>>(path);
+    }
+
+    const int keyOffset = static_cast<int>(state.thread_index()) * keysPerThread;
+    int i = 0;
+
+    for(auto _ : state) {
+        sharedDurableDict->addElement(keyOffset + (i % keysPerThread), i, i);
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    if(state.thread_index() == 0) {
+        state.counters["syncs"] = static_cast<double>(sharedDurableDict->getSyncCount());
+    }
+}
+BENCHMARK(BM_DurableAddElement)->ThreadRange(1, 16)->UseRealTime();
+
+
+template <template <typename, typename, typename> class Storage>
+static void BM_ParallelMergeWith(benchmark::State & state) {
+    constexpr int keyCount = 1 << 20;
+    LWWThreadPool pool(static_cast<std::size_t>(state.range(0)));
+
+    LWWElementDict<int, int, int, Storage> replica1;
+    LWWElementDict<int, int, int, Storage> replica2;
+    for(int k = 0; k < keyCount; ++k) {
+        replica1.addElement(k, k, 1);
+        replica2.addElement(k + keyCount / 2, k, 2);
+    }
+
+    for(auto _ : state) {
+        state.PauseTiming();
+        auto target = std::make_unique<LWWElementDict<int, int, int, Storage>>(replica1);
+        state.ResumeTiming();
+
+        target->mergeWith(replica2, pool);
+        benchmark::ClobberMemory();
+
+        state.PauseTiming();
+        target.reset();
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * keyCount);
+}
+BENCHMARK_TEMPLATE(BM_ParallelMergeWith, TreeStorage)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ParallelMergeWith, FlatStorage)->RangeMultiplier(2)->Range(1, 16)->UseRealTime();
+
+
+template <template <typename, typename, typename> class Storage>
+static LWWElementDict<int, int, int, Storage> makeSnapshotSource(const int & keyCount) {
+    LWWElementDict<int, int, int, Storage> dict;
+    for(int k = 0; k < keyCount; ++k) {
+        dict.addElement(k, k, 1);
+        dict.addElement(k, k + 1, 2);
+        if(k % 4 == 0) {
+            dict.removeElement(k, k, 3);
+        }
+    }
+    return dict;
+}
+
+
+template <template <typename, typename, typename> class Storage>
+static void BM_Serialize(benchmark::State & state) {
+    const auto dict = makeSnapshotSource<Storage>(static_cast<int>(state.range(0)));
+    std::size_t size = 0;
+
+    for(auto _ : state) {
+        const auto bytes = LWWSerialization::serialize(dict);
+        size = bytes.size();
+        benchmark::DoNotOptimize(bytes.data());
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(size));
+}
+BENCHMARK_TEMPLATE(BM_Serialize, TreeStorage)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(BM_Serialize, FlatStorage)->RangeMultiplier(10)->Range(1000, 1000000);
+
+
+template <template <typename, typename, typename> class Storage>
+static void BM_Deserialize(benchmark::State & state) {
+    const auto bytes = LWWSerialization::serialize(makeSnapshotSource<Storage>(static_cast<int>(state.range(0))));
+
+    for(auto _ : state) {
+        auto dict = LWWSerialization::deserialize<LWWElementDict<int, int, int, Storage>>(bytes);
+        benchmark::DoNotOptimize(dict.get());
+
+        state.PauseTiming();
+        dict.reset();
+        state.ResumeTiming();
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(bytes.size()));
+}
+BENCHMARK_TEMPLATE(BM_Deserialize, TreeStorage)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(BM_Deserialize, FlatStorage)->RangeMultiplier(10)->Range(1000, 1000000);
+
+
+static void BM_MappedSnapshotColdStart(benchmark::State & state) {
+    const int keyCount = static_cast<int>(state.range(0));
+    const std::string path = (std::filesystem::temp_directory_path() / "lww_benchmark_snapshot.bin").string();
+    LWWMappedSnapshot<int, int, int>::write(makeSnapshotSource<TreeStorage>(keyCount), path);
+
+    int k = 0;
+    for(auto _ : state) {
+        // Opening and answering a first query, the work a restarted process does before serving reads.
+        const LWWMappedSnapshot<int, int, int> snapshot(path);
+        benchmark::DoNotOptimize(snapshot.getValueByKey(k));
+        k = (k + 7919) % keyCount;
+    }
+
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_MappedSnapshotColdStart)->RangeMultiplier(10)->Range(1000, 1000000);
+
+
+template <typename Dict>
+static void BM_SnapshotPerRequest(benchmark::State & state) {
+    const int keyCount = static_cast<int>(state.range(0));
+    Dict dict;
+    for(int k = 0; k < keyCount; ++k) {
+        dict.addElement(k, k, 1);
+    }
+
+    int k = 0;
+    for(auto _ : state) {
+        // Isolating a request: snapshot, read from the snapshot, write to the live dictionary.
+        Dict snapshot(dict);
+        benchmark::DoNotOptimize(snapshot.getValueByKey(k));
+        dict.addElement(k, k, 2);
+        k = (k + 7919) % keyCount;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_SnapshotPerRequest, LWWElementDict<int, int, int>)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(BM_SnapshotPerRequest, PersistentLWWElementDict<int, int, int>)->RangeMultiplier(10)->Range(1000, 1000000);
+
+
+// Range scan of 1000 keys, in place versus copying current data.
+template <bool copyFlag>
+static void BM_RangeScan(benchmark::State & state) {
+    const int keyCount = static_cast<int>(state.range(0));
+    LWWElementDict<int, int, int> dict;
+    for(int k = 0; k < keyCount; ++k) {
+        dict.addElement(k, k, 1);
+    }
+
+    int lower = 0;
+    for(auto _ : state) {
+        std::int64_t sum = 0;
+        if constexpr(copyFlag) {
+            const auto current = dict.getCurrentData();
+            for(auto iter = current.lower_bound(lower); iter != current.end() && iter->first < lower + 1000; ++iter) {
+                sum += iter->second.first;
+            }
+        } else {
+            for(const auto & [k, element] : dict.range(lower, lower + 1000)) {
+                sum += element.first;
+            }
+        }
+        benchmark::DoNotOptimize(sum);
+        lower = (lower + 7919) % keyCount;
+    }
+
+    state.SetItemsProcessed(state.iterations() * 1000);
+}
+BENCHMARK_TEMPLATE(BM_RangeScan, false)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK_TEMPLATE(BM_RangeScan, true)->RangeMultiplier(10)->Range(10000, 1000000);
+
+
+// Lookup of 256 keys, one by one versus batched. Keys are spread over the whole dictionary, or drawn from a window of
+// 1024 neighbouring keys when clustered.
+template <bool batchFlag, bool clusteredFlag>
+static void BM_MultiGet(benchmark::State & state) {
+    const int keyCount = static_cast<int>(state.range(0));
+    LWWElementDict<int, int, int> dict;
+    for(int k = 0; k < keyCount; ++k) {
+        dict.addElement(k, k, 1);
+    }
+
+    std::vector<int> keys(256);
+    unsigned seed = 1;
+    for(auto _ : state) {
+        state.PauseTiming();
+        seed = seed * 1103515245 + 12345;
+        const unsigned window = clusteredFlag ? 1024 : static_cast<unsigned>(keyCount);
+        const unsigned base = clusteredFlag ? seed % static_cast<unsigned>(keyCount - 1024) : 0;
+        for(auto & k : keys) {
+            seed = seed * 1103515245 + 12345;
+            k = static_cast<int>(base + seed % window);
+        }
+        state.ResumeTiming();
+
+        if constexpr(batchFlag) {
+            benchmark::DoNotOptimize(dict.getValuesByKeys(keys));
+        } else {
+            for(const int k : keys) {
+                benchmark::DoNotOptimize(dict.getValueByKey(k));
+            }
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * 256);
+}
+BENCHMARK_TEMPLATE(BM_MultiGet, false, false)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK_TEMPLATE(BM_MultiGet, true, false)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK_TEMPLATE(BM_MultiGet, false, true)->RangeMultiplier(10)->Range(10000, 1000000);
+BENCHMARK_TEMPLATE(BM_MultiGet, true, true)->RangeMultiplier(10)->Range(10000, 1000000);
+
+
+// Write path cost of change events, by number of subscribers drained between writes.
+static void BM_AddElementSubscribed(benchmark::State & state) {
+    LWWElementDict<int, int, int> dict;
+    std::vector<std::shared_ptr<LWWElementDict<int, int, int>::ChangeRing>> rings;
+    for(std::int64_t subscriber = 0; subscriber < state.range(0); ++subscriber) {
+        rings.push_back(dict.subscribe(1 << 16));
+    }
+
+    int t = 0;
+    for(auto _ : state) {
+        dict.addElement(t % 1024, t, t);
+        ++t;
+
+        if((t & 0xFFF) == 0) {
+            state.PauseTiming();
+            for(const auto & ring : rings) {
+                ring->drain([](LWWElementDict<int, int, int>::Change && change) {
+                    benchmark::DoNotOptimize(change);
+                });
+            }
+            state.ResumeTiming();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AddElementSubscribed)->Arg(0)->Arg(1)->Arg(4);
+
+
+// Synchronizing two replicas diverged by 16 writes each, exchanging differing digest ranges versus full state. Digest
+// depth is the second argument, deeper trees narrow the exchanged ranges.
+template <bool digestFlag>
+static void BM_AntiEntropy(benchmark::State & state) {
+    const int keyCount = static_cast<int>(state.range(0));
+    LWWElementDict<int, int, int> first;
+    LWWElementDict<int, int, int> second;
+    for(int k = 0; k < keyCount; ++k) {
+        first.addElement(k, k, 1);
+        second.addElement(k, k, 1);
+    }
+    first.digest();
+    second.digest();
+
+    int t = 2;
+    for(auto _ : state) {
+        state.PauseTiming();
+        for(int i = 0; i < 16; ++i) {
+            first.addElement((t * 7919 + i) % keyCount, t, t);
+            second.addElement((t * 104729 + i) % keyCount, -t, t);
+        }
+        ++t;
+        state.ResumeTiming();
+
+        if constexpr(digestFlag) {
+            const auto depth = static_cast<unsigned>(state.range(1));
+            const auto ranges = first.digest(depth).diff(second.digest(depth));
+            const auto firstDelta = first.extractRanges(ranges);
+            const auto secondDelta = second.extractRanges(ranges);
+            first.mergeWith(*secondDelta);
+            second.mergeWith(*firstDelta);
+        } else {
+            first.mergeWith(second);
+            second.mergeWith(first);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * 32);
+}
+BENCHMARK_TEMPLATE(BM_AntiEntropy, true)->ArgsProduct({ { 10000, 100000, 1000000 }, { 10, LWWMerkleTree::maxDepth } });
+BENCHMARK_TEMPLATE(BM_AntiEntropy, false)->RangeMultiplier(10)->Range(10000, 1000000);
+
+
+/*!
+* Distinct key or value number \p i of benchmarked type.
+* @param [in] i Item number
+* @return item
+*/
+template <typename X>
+static X makeItem(const std::int64_t & i);
+
+
+template <>
+int makeItem<int>(const std::int64_t & i) {
+    return static_cast<int>(i);
+}
+
+
+template <>
+std::string makeItem<std::string>(const std::int64_t & i) {
+    // Longer than the small string buffer, like typical identifiers.
+    std::string item = "lww-benchmark-item-0000000000";
+    for(std::int64_t rest = i, position = static_cast<std::int64_t>(item.size()) - 1; rest != 0; rest /= 10, --position) {
+        item[static_cast<std::size_t>(position)] = static_cast<char>('0' + rest % 10);
+    }
+    return item;
+}
+
+
+static std::shared_ptr<void> hotState; //!< Dictionary prepared for the current hot path configuration
+static std::string hotStateId; //!< Configuration \a hotState was prepared for
+
+
+/*!
+* Dictionary of \p keyCount keys holding one element each, shared by consecutive runs of one configuration. Only
+* one dictionary is kept alive, so memory stays bounded by the largest configuration.
+* @param [in] keyCount Number of keys
+* @return prepared dictionary
+*/
+template <typename K, typename V>
+static LWWElementDict<K, V, std::int64_t> & prefilledDict(const std::int64_t & keyCount) {
+    using Dict = LWWElementDict<K, V, std::int64_t>;
+    const std::string id = typeid(Dict).name() + std::to_string(keyCount);
+
+    if(hotStateId != id) {
+        hotState.reset();
+        auto dict = std::make_shared<Dict>();
+        for(std::int64_t k = 0; k < keyCount; ++k) {
+            dict->addElement(makeItem<K>(k), makeItem<V>(k), 1);
+        }
+        hotState = dict;
+        hotStateId = id;
+    }
+
+    return *static_cast<Dict *>(hotState.get());
+}
+
+
+template <typename K, typename V>
+static LWWElementDict<K, V, std::int64_t> * hotDict = nullptr; //!< Dictionary shared by threads of a hot path run
+
+
+static std::atomic<std::int64_t> hotTime { 2 }; //!< Timestamps of hot path writes, later than prefilled elements
+
+
+/*!
+* Prefilled elements accessed by one thread of a hot path run, spread over all keys so that consecutive accesses miss
+* caches and mutations spread over many histories.
+* @param [in] state Benchmark state of the calling thread
+* @param [in] missPercent Percentage of keys replaced by keys missing in the prefilled dictionary
+* @return keys and their prefilled values
+*/
+template <typename K, typename V>
+static std::vector<std::pair<K, V>> sampleElements(const benchmark::State & state, const std::int64_t & missPercent) {
+    static constexpr std::int64_t sampleCount = 1 << 16;
+    const std::int64_t keyCount = state.range(0);
+
+    std::vector<std::pair<K, V>> elements;
+    for(std::int64_t i = 0; i < sampleCount; ++i) {
+        const std::int64_t k = ((i + sampleCount * state.thread_index()) * 7919) % keyCount;
+        elements.emplace_back(makeItem<K>(i % 100 < missPercent ? keyCount + k : k), makeItem<V>(k));
+    }
+    return elements;
+}
+
+
+template <typename K, typename V>
+static void BM_HotAddElement(benchmark::State & state) {
+    if(state.thread_index() == 0) {
+        hotDict<K, V> = &prefilledDict<K, V>(state.range(0));
+    }
+
+    const std::int64_t duplicatePercent = state.range(1);
+    const auto elements = sampleElements<K, V>(state, 0);
+    std::size_t i = 0;
+
+    for(auto _ : state) {
+        // Duplicates re-add the prefilled element of the key, which leaves every container unchanged.
+        const auto & [k, v] = elements[i % elements.size()];
+        if(static_cast<std::int64_t>(i % 100) < duplicatePercent) {
+            hotDict<K, V>->addElement(k, v, 1);
+        } else {
+            hotDict<K, V>->addElement(k, v, hotTime.fetch_add(1, std::memory_order_relaxed));
+        }
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+template <typename K, typename V>
+static void BM_HotRemoveElement(benchmark::State & state) {
+    if(state.thread_index() == 0) {
+        hotDict<K, V> = &prefilledDict<K, V>(state.range(0));
+    }
+
+    const auto elements = sampleElements<K, V>(state, 0);
+    std::size_t i = 0;
+
+    for(auto _ : state) {
+        const auto & [k, v] = elements[i % elements.size()];
+        hotDict<K, V>->removeElement(k, v, hotTime.fetch_add(1, std::memory_order_relaxed));
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+template <typename K, typename V>
+static void BM_HotUpdateValue(benchmark::State & state) {
+    if(state.thread_index() == 0) {
+        hotDict<K, V> = &prefilledDict<K, V>(state.range(0));
+    }
+
+    const auto elements = sampleElements<K, V>(state, 0);
+    std::size_t i = 0;
+
+    for(auto _ : state) {
+        const auto & [k, v] = elements[i % elements.size()];
+        hotDict<K, V>->updateValue(k, v, hotTime.fetch_add(1, std::memory_order_relaxed));
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+template <typename K, typename V>
+static void BM_HotGetValueByKey(benchmark::State & state) {
+    if(state.thread_index() == 0) {
+        hotDict<K, V> = &prefilledDict<K, V>(state.range(0));
+    }
+
+    // Lookups of missing keys are the duplicate ratio's counterpart for reads.
+    const auto elements = sampleElements<K, V>(state, state.range(1));
+    std::size_t i = 0;
+
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(hotDict<K, V>->getValueByKey(elements[i % elements.size()].first));
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+template <typename K, typename V>
+static void BM_HotMergeWith(benchmark::State & state) {
+    using Dict = LWWElementDict<K, V, std::int64_t>;
+    const std::int64_t keyCount = state.range(0);
+    const std::int64_t duplicatePercent = state.range(1);
+
+    // Source shares duplicatePercent of its elements with the target, the rest are newer elements of its keys.
+    const Dict & target = prefilledDict<K, V>(keyCount);
+    Dict source;
+    for(std::int64_t k = 0; k < keyCount; ++k) {
+        if(k % 100 < duplicatePercent) {
+            source.addElement(makeItem<K>(k), makeItem<V>(k), 1);
+        } else {
+            source.addElement(makeItem<K>(k), makeItem<V>(k + 1), 2);
+        }
+    }
+
+    for(auto _ : state) {
+        state.PauseTiming();
+        auto merged = std::make_unique<Dict>(target);
+        // Writing to both histories takes the copy-on-write copies outside of the measurement.
+        merged->addElement(makeItem<K>(keyCount), makeItem<V>(0), 0);
+        merged->removeElement(makeItem<K>(keyCount), makeItem<V>(0), 0);
+        state.ResumeTiming();
+
+        merged->mergeWith(source);
+        benchmark::ClobberMemory();
+
+        state.PauseTiming();
+        merged.reset();
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * keyCount);
+}
+
+
+/*!
+* Registering hot path benchmarks of key type \p K and value type \p V .
+* @param [in] typeName Types as shown in benchmark names
+* @param [in] keyCounts Benchmarked key counts
+*/
+template <typename K, typename V>
+static void registerHotPath(const std::string & typeName, const std::vector<std::int64_t> & keyCounts) {
+    const int maxThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    const auto registerOperation = [&](const std::string & operation, void (*function)(benchmark::State &),
+                                       const std::vector<std::int64_t> & ratios, const bool & threadFlag) {
+        auto * benchmark = benchmark::RegisterBenchmark(("HotPath/" + operation + "<" + typeName + ">").c_str(), function);
+        benchmark->ArgNames({ "keys", operation == "getValueByKey" ? "miss" : "dup" });
+        for(const auto & keyCount : keyCounts) {
+            for(const auto & ratio : ratios) {
+                benchmark->Args({ keyCount, ratio });
+            }
+        }
+        if(threadFlag) {
+            benchmark->ThreadRange(1, maxThreads)->UseRealTime();
+        }
+    };
+
+    registerOperation("addElement", BM_HotAddElement<K, V>, { 0, 50, 90 }, true);
+    registerOperation("removeElement", BM_HotRemoveElement<K, V>, { 0 }, false);
+    registerOperation("updateValue", BM_HotUpdateValue<K, V>, { 0 }, false);
+    registerOperation("getValueByKey", BM_HotGetValueByKey<K, V>, { 0, 50 }, true);
+    registerOperation("mergeWith", BM_HotMergeWith<K, V>, { 0, 50, 90 }, false);
+}
+
+
+int main(int argc, char ** argv) {
+    const char * maxKeysVariable = std::getenv("LWW_BENCHMARK_MAX_KEYS");
+    const std::int64_t maxKeys = maxKeysVariable ? std::atoll(maxKeysVariable) : 1000000;
+
+    std::vector<std::int64_t> keyCounts;
+    for(std::int64_t keyCount = 1000; keyCount <= std::min<std::int64_t>(maxKeys, 100000000); keyCount *= 10) {
+        keyCounts.push_back(keyCount);
+    }
+
+    registerHotPath<int, int>("int,int", keyCounts);
+    registerHotPath<int, std::string>("int,string", keyCounts);
+    registerHotPath<std::string, int>("string,int", keyCounts);
+    registerHotPath<std::string, std::string>("string,string", keyCounts);
+
+    benchmark::AddCustomContext("lww_max_keys", std::to_string(maxKeys));
+#ifdef LWW_ENABLE_STATS
+    benchmark::AddCustomContext("lww_stats", "enabled");
+#else
+    benchmark::AddCustomContext("lww_stats", "disabled");
+#endif
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
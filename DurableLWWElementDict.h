@@ -0,0 +1,856 @@
+/*!
+* @file DurableLWWElementDict.h
+* @brief Contains CRDT LWW Element Dictionary persisting local mutations in a write-ahead log
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef DURABLELWWELEMENTDICT_H
+#define DURABLELWWELEMENTDICT_H
+
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "LWWElementDict.h"
+#include "LWWSerialization.h"
+#include "LWWWriteAheadLog.h"
+
+
+/*!
+* @struct LWWDurabilityOptions
+* @brief Checkpointing parameters of \a DurableLWWElementDict
+*/
+struct LWWDurabilityOptions {
+    std::uint64_t segmentBytes = 64ull << 20; //!< Active log size at which a background checkpoint is taken
+    std::size_t maxCheckpoints = 8; //!< Checkpoint chain length at which the chain is compacted into one checkpoint
+    bool backgroundFlag = true; //!< Checkpointing by a background thread, otherwise only by explicit \a checkpoint
+};
+
+
+
+/*!
+* @class DurableLWWElementDict
+* @brief CRDT LWW Element Dictionary whose add and remove requests survive crashes
+* @details Every local add or remove request and every compaction is encoded with \a LWWCodec and committed to a
+* write-ahead log before it is applied, so a request that returned is on stable storage. Concurrent writers share log syncs by group commit.
+*
+* The directory holds log segments \a wal-N.log and checkpoints \a checkpoint-N.lww . A checkpoint closes the active
+* segment N, writes the delta of keys changed since the previous checkpoint as \a checkpoint-N.lww and deletes
+* segments up to N. Compaction drops keys along with their removals, which no delta can carry, so the first checkpoint
+* after a compaction writes the whole state as \a checkpoint-N.full.lww instead, superseding every older checkpoint.
+* When the chain grows past \a LWWDurabilityOptions::maxCheckpoints it is merged into a single full checkpoint.
+* Checkpoints carry the compaction watermark. Restarting merges the newest full checkpoint and the deltas following
+* it, discards what the latest watermark discarded and replays the remaining segments, so restart time depends on state size and on changes
+* since the last checkpoint, not on uptime. Order of loading does not matter, because merging elements is commutative
+* and idempotent.
+*
+* State received by merging with other replicas is only persisted by checkpoints, between checkpoints it is recovered
+* from those replicas.
+* @tparam K key
+* @tparam V value
+* @tparam T timestamp
+* @tparam Storage history storage policy
+*/
+template <typename K,
+          typename V,
+          typename T,
+          template <typename, typename, typename> class Storage = TreeStorage>
+class DurableLWWElementDict : public LWWElementDict<K, V, T, Storage> {
+public:
+    using Dict = LWWElementDict<K, V, T, Storage>; //!< Base dictionary type
+    using Op = typename Dict::Op; //!< Batched operation
+
+    using Dict::addElement; // Automatically stamped overloads, logged through the overrides
+    using Dict::removeElement;
+
+
+private:
+    std::filesystem::path directory; //!< Directory of log segments and checkpoints
+    LWWDurabilityOptions options; //!< Checkpointing parameters
+
+    std::shared_mutex logMtx; //!< Shared by writers from logging until applying, exclusive while rotating segments
+    std::unique_ptr<LWWWriteAheadLog> log; //!< Active log segment
+    std::uint64_t segment = 1; //!< Number of active log segment
+    std::uint64_t closedSyncCount = 0; //!< Syncs of log segments closed since construction
+    std::size_t recoveredCount = 0; //!< Number of requests replayed on construction
+
+    std::mutex checkpointMtx; //!< Serializes checkpoints
+    std::uint64_t checkpointVersion = 0; //!< Local version the latest checkpoint is complete for
+    std::optional<T> checkpointStableTime; //!< Watermark of the latest checkpoint
+
+    std::mutex backgroundMtx; //!< Guards background checkpointing state
+    std::condition_variable backgroundWake; //!< Wakes the background thread
+    bool requestedFlag = false; //!< A background checkpoint is requested
+    bool stopFlag = false; //!< The background thread is to exit
+    std::exception_ptr backgroundError; //!< Failure of the latest background checkpoint
+    std::thread background; //!< Background checkpointing thread
+
+
+public:
+    /*!
+    * Constructor, loading checkpoints and replaying log segments in \p directory , which is created if missing.
+    * @param [in] directory Directory of log segments and checkpoints
+    * @param [in] options Checkpointing parameters
+    * @throw std::system_error if files cannot be created or read, or an undecodable record of the last segment is
+    * followed by intact ones
+    * @throw LWWFormatError if a checkpoint or an intact record of an older segment cannot be decoded as K, V and T
+    */
+    explicit DurableLWWElementDict(const std::string & directory, const LWWDurabilityOptions & options = {});
+
+
+    /*!
+    * Destructor, stopping background checkpointing
+    */
+    ~DurableLWWElementDict() override;
+
+
+    /*!
+    * Logging and inserting new element into \a addedData map
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    * @throw std::system_error if the request cannot be logged, the element is not inserted then
+    */
+    void addElement(const K & k, const V & v, const T & t) override;
+
+
+    /*!
+    * Logging and inserting new element into \a addedData map, moving \p k and \p v into the containers
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    * @throw std::system_error if the request cannot be logged, the element is not inserted then
+    */
+    void addElement(K && k, V && v, const T & t) override;
+
+
+    /*!
+    * Logging and inserting new element into \a removedData map
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    * @throw std::system_error if the request cannot be logged, the element is not inserted then
+    */
+    void removeElement(const K & k, const V & v, const T & t) override;
+
+
+    /*!
+    * Logging and inserting new element into \a removedData map, moving \p v into the history
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    * @throw std::system_error if the request cannot be logged, the element is not inserted then
+    */
+    void removeElement(K && k, V && v, const T & t) override;
+
+
+    /*!
+    * Logging a batch of requests with a single commit and applying it under a single lock.
+    * @param [in] first Beginning of \a Op range, traversed twice
+    * @param [in] last End of \a Op range
+    * @throw std::system_error if the batch cannot be logged, no element is inserted then
+    */
+    template <typename ForwardIt>
+    void applyBatch(ForwardIt first, ForwardIt last);
+
+
+    /*!
+    * Logging the watermark and discarding history below it, see \a LWWElementDict::compact .
+    * @param [in] stableTime Watermark
+    * @throw std::system_error if the watermark cannot be logged, nothing is discarded then
+    */
+    void compact(const T & stableTime) override;
+
+
+    /*!
+    * Writing a checkpoint of keys changed since the previous one and deleting log segments it covers. Compacts the
+    * checkpoint chain if it grew too long. Writers are blocked only while the active segment is rotated.
+    * @throw std::system_error if files cannot be written, or the failure of the latest background checkpoint
+    */
+    void checkpoint();
+
+
+    std::size_t getRecoveredCount() const;
+    std::size_t getCheckpointCount() const;
+
+
+    /*!
+    * Number of log syncs issued since construction, over every log segment.
+    * @return sync count
+    */
+    std::uint64_t getSyncCount();
+
+
+private:
+    /*!
+    * Committing \p records to the active segment and applying \p apply , both under shared \a logMtx .
+    * @param [in] records Framed records
+    * @param [in] apply Callable applying the logged requests
+    */
+    template <typename F>
+    void commitAndApply(const std::vector<char> & records, F && apply);
+
+
+    /*!
+    * Merging every checkpoint of the chain into one full checkpoint, written under the newest checkpoint's number.
+    */
+    void compactCheckpoints();
+
+
+    /*!
+    * Merging the checkpoint chain into \p dict and discarding what the latest of its watermarks discarded, since
+    * merging does not carry watermarks.
+    * @param [in,out] dict Target dictionary
+    */
+    void loadCheckpoints(Dict & dict) const;
+
+
+    /*!
+    * Checkpoints to load, the newest full checkpoint followed by the delta checkpoints written after it.
+    * @return checkpoint files in order of writing
+    */
+    std::vector<std::filesystem::path> listCheckpoints() const;
+
+
+    /*!
+    * Deleting checkpoints superseded by full checkpoint \p number .
+    * @param [in] number Number of the full checkpoint
+    */
+    void removeSupersededCheckpoints(const std::uint64_t & number) const;
+
+
+    /*!
+    * Background thread body, checkpointing whenever requested.
+    */
+    void runBackground();
+
+
+    /*!
+    * Numbers of files named \p prefix N \p suffix within \a directory , ascending.
+    * @param [in] prefix File name prefix
+    * @param [in] suffix File name suffix
+    * @return file numbers
+    */
+    std::vector<std::uint64_t> listFiles(const std::string & prefix, const std::string & suffix) const;
+
+
+    std::filesystem::path segmentPath(const std::uint64_t & number) const;
+    std::filesystem::path checkpointPath(const std::uint64_t & number, const bool & fullFlag = false) const;
+
+
+    /*!
+    * Opening log segment \p number as the active one.
+    * @param [in] number Segment number
+    */
+    void openSegment(const std::uint64_t & number);
+
+
+    /*!
+    * Reading checkpoint \p path into a dictionary.
+    * @param [in] path Checkpoint file
+    * @return checkpointed state
+    */
+    static std::unique_ptr<Dict> readCheckpoint(const std::filesystem::path & path);
+
+
+    /*!
+    * Replacing \p path by \p bytes atomically and durably: writing a temporary file, syncing and renaming it.
+    * @param [in] path Target file
+    * @param [in] bytes File content
+    */
+    void writeFileDurably(const std::filesystem::path & path, const std::vector<char> & bytes) const;
+
+
+    /*!
+    * Syncing \a directory , making created, renamed and deleted entries durable.
+    */
+    void syncDirectory() const;
+
+
+    /*!
+    * Encoding a request as log record payload.
+    * @param [in,out] records Framed records the encoded request is appended to
+    * @param [in] type Kind of request
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    static void encode(std::vector<char> & records, const typename Op::Type & type, const K & k, const V & v, const T & t);
+
+
+    /*!
+    * Encoding a compaction as log record payload.
+    * @param [in,out] records Framed records the encoded compaction is appended to
+    * @param [in] stableTime Watermark
+    */
+    static void encodeCompaction(std::vector<char> & records, const T & stableTime);
+
+
+    /*!
+    * Applying a logged request without logging it again.
+    * @param [in] payload Record payload
+    * @param [in] size Payload size
+    * @throw LWWFormatError if the payload cannot be decoded
+    */
+    void replay(const char * payload, const std::size_t & size);
+};
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+DurableLWWElementDict<K, V, T, Storage>::DurableLWWElementDict(
+    const std::string & directory,
+    const LWWDurabilityOptions & options
+):
+    directory(directory),
+    options(options)
+{
+    std::filesystem::create_directories(this->directory);
+
+    this->loadCheckpoints(*this);
+    this->checkpointVersion = this->getVersion();
+    this->checkpointStableTime = this->getStableTime();
+
+    const auto segments = this->listFiles("wal-", ".log");
+    for(const auto & number : segments) {
+        this->openSegment(number);
+        const bool lastFlag = number == segments.back();
+        this->recoveredCount += this->log->recover([this, lastFlag](const char * payload, const std::size_t & size) {
+            try {
+                this->replay(payload, size);
+            } catch(const LWWFormatError &) {
+                // An undecodable record ending the last segment can only be left by a crash, it is cut off as torn tail.
+                if(!lastFlag) {
+                    throw;
+                }
+                return false;
+            }
+            return true;
+        });
+    }
+
+    if(segments.empty()) {
+        const auto deltas = this->listFiles("checkpoint-", ".lww");
+        const auto fulls = this->listFiles("checkpoint-", ".full.lww");
+        this->openSegment(std::max(deltas.empty() ? 0 : deltas.back(), fulls.empty() ? 0 : fulls.back()) + 1);
+        this->log->recover([](const char *, const std::size_t &) {});
+        this->syncDirectory();
+    }
+
+    if(this->options.backgroundFlag) {
+        this->background = std::thread(&DurableLWWElementDict::runBackground, this);
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+DurableLWWElementDict<K, V, T, Storage>::~DurableLWWElementDict() {
+    if(this->background.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->backgroundMtx);
+            this->stopFlag = true;
+        }
+        this->backgroundWake.notify_one();
+        this->background.join();
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::addElement(const K & k, const V & v, const T & t) {
+    std::vector<char> records;
+    encode(records, Op::Type::add, k, v, t);
+
+    this->commitAndApply(records, [&]() {
+        Dict::addElement(k, v, t);
+    });
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::addElement(K && k, V && v, const T & t) {
+    std::vector<char> records;
+    encode(records, Op::Type::add, k, v, t);
+
+    this->commitAndApply(records, [&]() {
+        Dict::addElement(std::move(k), std::move(v), t);
+    });
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::removeElement(const K & k, const V & v, const T & t) {
+    std::vector<char> records;
+    encode(records, Op::Type::remove, k, v, t);
+
+    this->commitAndApply(records, [&]() {
+        Dict::removeElement(k, v, t);
+    });
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::removeElement(K && k, V && v, const T & t) {
+    std::vector<char> records;
+    encode(records, Op::Type::remove, k, v, t);
+
+    this->commitAndApply(records, [&]() {
+        Dict::removeElement(std::move(k), std::move(v), t);
+    });
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+template <typename ForwardIt>
+void DurableLWWElementDict<K, V, T, Storage>::applyBatch(ForwardIt first, ForwardIt last) {
+    std::vector<char> records;
+    for(ForwardIt operationIter = first; operationIter != last; ++operationIter) {
+        encode(records, operationIter->type, operationIter->key, operationIter->value, operationIter->timestamp);
+    }
+
+    this->commitAndApply(records, [&]() {
+        Dict::applyBatch(first, last);
+    });
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::compact(const T & stableTime) {
+    std::vector<char> records;
+    encodeCompaction(records, stableTime);
+
+    this->commitAndApply(records, [&]() {
+        Dict::compact(stableTime);
+    });
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::checkpoint() {
+    {
+        std::lock_guard<std::mutex> lock(this->backgroundMtx);
+        if(this->backgroundError) {
+            std::rethrow_exception(std::exchange(this->backgroundError, nullptr));
+        }
+    }
+
+    std::lock_guard<std::mutex> checkpointLock(this->checkpointMtx);
+
+    // Every request logged to the closed segment has been applied once exclusive access is granted.
+    std::uint64_t closedSegment;
+    {
+        std::unique_lock<std::shared_mutex> lock(this->logMtx);
+        closedSegment = this->segment;
+        this->closedSyncCount += this->log->getSyncCount();
+        this->openSegment(closedSegment + 1);
+        this->log->recover([](const char *, const std::size_t &) {});
+    }
+    this->syncDirectory();
+
+    std::uint64_t untilVersion = 0;
+    auto delta = this->extractDelta(this->checkpointVersion, untilVersion);
+
+    // Keys compacted since the previous checkpoint left no removal for the delta to carry, so the whole state is written.
+    const auto & stableTime = delta->getStableTime();
+    const bool fullFlag = stableTime && (!this->checkpointStableTime || *this->checkpointStableTime < *stableTime);
+    if(fullFlag) {
+        delta = this->extractDelta(0, untilVersion);
+    }
+    this->writeFileDurably(this->checkpointPath(closedSegment, fullFlag), LWWSerialization::serialize(*delta));
+
+    for(const auto & number : this->listFiles("wal-", ".log")) {
+        if(number <= closedSegment) {
+            std::filesystem::remove(this->segmentPath(number));
+        }
+    }
+    if(fullFlag) {
+        this->removeSupersededCheckpoints(closedSegment);
+    }
+    this->syncDirectory();
+    this->checkpointVersion = untilVersion;
+    this->checkpointStableTime = delta->getStableTime();
+
+    if(this->getCheckpointCount() > this->options.maxCheckpoints) {
+        this->compactCheckpoints();
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::size_t DurableLWWElementDict<K, V, T, Storage>::getRecoveredCount() const {
+    return this->recoveredCount;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::size_t DurableLWWElementDict<K, V, T, Storage>::getCheckpointCount() const {
+    return this->listCheckpoints().size();
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::uint64_t DurableLWWElementDict<K, V, T, Storage>::getSyncCount() {
+    std::shared_lock<std::shared_mutex> lock(this->logMtx);
+    return this->closedSyncCount + this->log->getSyncCount();
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+template <typename F>
+void DurableLWWElementDict<K, V, T, Storage>::commitAndApply(const std::vector<char> & records, F && apply) {
+    bool rotationFlag;
+    {
+        std::shared_lock<std::shared_mutex> lock(this->logMtx);
+        this->log->commit(records);
+        apply();
+        rotationFlag = this->log->getSize() >= this->options.segmentBytes;
+    }
+
+    if(rotationFlag && this->options.backgroundFlag) {
+        {
+            std::lock_guard<std::mutex> lock(this->backgroundMtx);
+            this->requestedFlag = true;
+        }
+        this->backgroundWake.notify_one();
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::compactCheckpoints() {
+    const auto deltas = this->listFiles("checkpoint-", ".lww");
+    const auto fulls = this->listFiles("checkpoint-", ".full.lww");
+    const std::uint64_t number = std::max(deltas.empty() ? 0 : deltas.back(), fulls.empty() ? 0 : fulls.back());
+
+    Dict merged;
+    this->loadCheckpoints(merged);
+
+    // Loading ignores checkpoints superseded by a full one, so a crash before they are deleted leaves them unused.
+    this->writeFileDurably(this->checkpointPath(number, true), LWWSerialization::serialize(merged));
+    this->removeSupersededCheckpoints(number);
+    this->syncDirectory();
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::loadCheckpoints(Dict & dict) const {
+    std::optional<T> stableTime;
+
+    for(const auto & path : this->listCheckpoints()) {
+        const auto checkpoint = readCheckpoint(path);
+        dict.Dict::mergeWith(*checkpoint);
+
+        const auto & checkpointTime = checkpoint->getStableTime();
+        if(checkpointTime && (!stableTime || *stableTime < *checkpointTime)) {
+            stableTime = checkpointTime;
+        }
+    }
+
+    if(stableTime) {
+        dict.Dict::compact(*stableTime);
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::vector<std::filesystem::path> DurableLWWElementDict<K, V, T, Storage>::listCheckpoints() const {
+    const auto fulls = this->listFiles("checkpoint-", ".full.lww");
+    std::vector<std::filesystem::path> paths;
+    if(!fulls.empty()) {
+        paths.push_back(this->checkpointPath(fulls.back(), true));
+    }
+
+    for(const auto & number : this->listFiles("checkpoint-", ".lww")) {
+        if(fulls.empty() || fulls.back() < number) {
+            paths.push_back(this->checkpointPath(number));
+        }
+    }
+    return paths;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::removeSupersededCheckpoints(const std::uint64_t & number) const {
+    for(const auto & delta : this->listFiles("checkpoint-", ".lww")) {
+        if(delta <= number) {
+            std::filesystem::remove(this->checkpointPath(delta));
+        }
+    }
+    for(const auto & full : this->listFiles("checkpoint-", ".full.lww")) {
+        if(full < number) {
+            std::filesystem::remove(this->checkpointPath(full, true));
+        }
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::runBackground() {
+    std::unique_lock<std::mutex> lock(this->backgroundMtx);
+
+    while(true) {
+        this->backgroundWake.wait(lock, [this]() {
+            return this->stopFlag || this->requestedFlag;
+        });
+        if(this->stopFlag) {
+            return;
+        }
+        this->requestedFlag = false;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try {
+            this->checkpoint();
+        } catch(...) {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        if(error) {
+            this->backgroundError = error;
+        }
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::vector<std::uint64_t> DurableLWWElementDict<K, V, T, Storage>::listFiles(
+    const std::string & prefix,
+    const std::string & suffix
+) const {
+    std::vector<std::uint64_t> numbers;
+
+    for(const auto & entry : std::filesystem::directory_iterator(this->directory)) {
+        const std::string name = entry.path().filename().string();
+        if(name.size() <= prefix.size() + suffix.size()
+           || name.compare(0, prefix.size(), prefix) != 0
+           || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            continue;
+        }
+
+        const std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        if(std::all_of(digits.begin(), digits.end(), [](const char & c) { return c >= '0' && c <= '9'; })) {
+            numbers.push_back(std::stoull(digits));
+        }
+    }
+
+    std::sort(numbers.begin(), numbers.end());
+    return numbers;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::filesystem::path DurableLWWElementDict<K, V, T, Storage>::segmentPath(const std::uint64_t & number) const {
+    return this->directory / ("wal-" + std::to_string(number) + ".log");
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::filesystem::path DurableLWWElementDict<K, V, T, Storage>::checkpointPath(
+    const std::uint64_t & number,
+    const bool & fullFlag
+) const {
+    return this->directory / ("checkpoint-" + std::to_string(number) + (fullFlag ? ".full.lww" : ".lww"));
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::openSegment(const std::uint64_t & number) {
+    this->log = std::make_unique<LWWWriteAheadLog>(this->segmentPath(number).string());
+    this->segment = number;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::unique_ptr<typename DurableLWWElementDict<K, V, T, Storage>::Dict>
+DurableLWWElementDict<K, V, T, Storage>::readCheckpoint(const std::filesystem::path & path) {
+    std::vector<char> bytes(static_cast<std::size_t>(std::filesystem::file_size(path)));
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW checkpoint: cannot open " + path.string());
+    }
+    for(std::size_t offset = 0; offset < bytes.size();) {
+        const ssize_t count = ::read(fd, bytes.data() + offset, bytes.size() - offset);
+        if(count < 0 && errno == EINTR) {
+            continue;
+        }
+        if(count <= 0) {
+            const int error = count < 0 ? errno : EIO;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "LWW checkpoint: cannot read " + path.string());
+        }
+        offset += static_cast<std::size_t>(count);
+    }
+    ::close(fd);
+
+    return LWWSerialization::deserialize<Dict>(bytes);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::writeFileDurably(
+    const std::filesystem::path & path,
+    const std::vector<char> & bytes
+) const {
+    const std::filesystem::path temporaryPath = path.string() + ".tmp";
+
+    const int fd = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW checkpoint: cannot create " + temporaryPath.string());
+    }
+
+    for(std::size_t offset = 0; offset < bytes.size();) {
+        const ssize_t count = ::write(fd, bytes.data() + offset, bytes.size() - offset);
+        if(count < 0 && errno == EINTR) {
+            continue;
+        }
+        if(count < 0) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "LWW checkpoint: cannot write " + temporaryPath.string());
+        }
+        offset += static_cast<std::size_t>(count);
+    }
+
+    if(::fdatasync(fd) != 0) {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "LWW checkpoint: cannot sync " + temporaryPath.string());
+    }
+    ::close(fd);
+
+    std::filesystem::rename(temporaryPath, path);
+    this->syncDirectory();
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::syncDirectory() const {
+    const int fd = ::open(this->directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW log: cannot open " + this->directory.string());
+    }
+
+    const int result = ::fsync(fd);
+    const int error = errno;
+    ::close(fd);
+    if(result != 0) {
+        throw std::system_error(error, std::generic_category(), "LWW log: cannot sync " + this->directory.string());
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::encode(
+    std::vector<char> & records,
+    const typename Op::Type & type,
+    const K & k,
+    const V & v,
+    const T & t
+) {
+    std::vector<char> payload;
+    LWWWriter writer(payload);
+
+    const std::uint8_t typeCode = type == Op::Type::add ? 0 : 1;
+    writer.write(&typeCode, sizeof(typeCode));
+    LWWCodec<K>::encode(writer, k);
+    LWWCodec<V>::encode(writer, v);
+    LWWCodec<T>::encode(writer, t);
+
+    LWWWriteAheadLog::frame(records, payload);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::encodeCompaction(std::vector<char> & records, const T & stableTime) {
+    std::vector<char> payload;
+    LWWWriter writer(payload);
+
+    const std::uint8_t typeCode = 2;
+    writer.write(&typeCode, sizeof(typeCode));
+    LWWCodec<T>::encode(writer, stableTime);
+
+    LWWWriteAheadLog::frame(records, payload);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void DurableLWWElementDict<K, V, T, Storage>::replay(const char * payload, const std::size_t & size) {
+    LWWReader reader(payload, size);
+
+    std::uint8_t typeCode;
+    reader.read(&typeCode, sizeof(typeCode));
+
+    if(typeCode == 2) {
+        const T stableTime = LWWCodec<T>::decode(reader);
+        if(reader.remaining() != 0) {
+            throw LWWFormatError("LWW log: malformed record");
+        }
+        Dict::compact(stableTime);
+        return;
+    }
+
+    K k = LWWCodec<K>::decode(reader);
+    V v = LWWCodec<V>::decode(reader);
+    const T t = LWWCodec<T>::decode(reader);
+
+    if(typeCode > 1 || reader.remaining() != 0) {
+        throw LWWFormatError("LWW log: malformed record");
+    }
+
+    if(typeCode == 0) {
+        Dict::addElement(std::move(k), std::move(v), t);
+    } else {
+        Dict::removeElement(std::move(k), std::move(v), t);
+    }
+}
+
+
+
+#endif // DURABLELWWELEMENTDICT_H
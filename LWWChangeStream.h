@@ -0,0 +1,235 @@
+/*!
+* @file LWWChangeStream.h
+* @brief Contains change events of current elements and the ring buffers delivering them to subscribers
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LWWCHANGESTREAM_H
+#define LWWCHANGESTREAM_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+/*!
+* @struct LWWChange
+* @brief Change of a key's current element, visible through \a getValueByKey
+* @tparam K key
+* @tparam V value
+* @tparam T timestamp
+*/
+template <typename K,
+          typename V,
+          typename T>
+struct LWWChange {
+    /*!
+    * @enum Type
+    * @brief Kind of change
+    */
+    enum class Type {
+        inserted, //!< Key had no current element
+        replaced, //!< Key's current element was replaced by a later one
+        removed //!< Key's current element was removed
+    };
+
+    Type type; //!< Kind of change
+    K key; //!< key
+    std::optional<V> value; //!< New current value, empty for removal
+    T timestamp; //!< Timestamp of the add or removal causing the change
+};
+
+
+
+/*!
+* @class LWWChangeRing
+* @brief Bounded single-producer single-consumer ring buffer of change events
+* @details The dictionary pushes under its mutex, so it is the single producer, and one consumer drains events in
+* batches. Neither side locks or waits. A push into a full ring drops the event and raises the overflow flag instead of
+* blocking the writer: the consumer has then missed changes and has to resynchronize, e.g. by invalidating its whole
+* cache, after clearing the flag with \a resetOverflow .
+* @tparam E event
+*/
+template <typename E>
+class LWWChangeRing {
+private:
+    /*!
+    * @struct Index
+    * @brief Position of one side occupying its own cache line
+    */
+    struct alignas(64) Index {
+        std::atomic<std::size_t> value { 0 }; //!< Number of events pushed or popped so far
+    };
+
+    std::vector<std::optional<E>> slots; //!< Events, indexed by position modulo capacity
+    std::size_t mask; //!< Capacity minus one
+    Index head; //!< Consumer position
+    Index tail; //!< Producer position
+    std::atomic<bool> overflowFlag { false }; //!< Whether an event has been dropped since the last reset
+    std::atomic<std::uint64_t> droppedCount { 0 }; //!< Events dropped since construction
+
+
+public:
+    /*!
+    * Constructor
+    * @param [in] capacity Number of buffered events, rounded up to a power of two
+    */
+    explicit LWWChangeRing(const std::size_t & capacity);
+
+
+    LWWChangeRing(const LWWChangeRing &) = delete;
+    LWWChangeRing & operator=(const LWWChangeRing &) = delete;
+
+
+    /*!
+    * Pushing \p event , producer only.
+    * @param [in] event Event
+    * @return false if the ring is full and the event has been dropped
+    */
+    template <typename Event>
+    bool push(Event && event);
+
+
+    /*!
+    * Popping up to \p maxCount events in order, consumer only.
+    * @param [in] consumer Callable accepting an event rvalue
+    * @param [in] maxCount Largest number of events popped
+    * @return number of popped events
+    */
+    template <typename F>
+    std::size_t drain(F && consumer, const std::size_t & maxCount = std::numeric_limits<std::size_t>::max());
+
+
+    /*!
+    * Appending up to \p maxCount events to \p events in order, consumer only.
+    * @param [out] events Popped events
+    * @param [in] maxCount Largest number of events popped
+    * @return number of popped events
+    */
+    std::size_t drain(std::vector<E> & events, const std::size_t & maxCount = std::numeric_limits<std::size_t>::max());
+
+
+    /*!
+    * Clearing the overflow flag, consumer only.
+    * @return true if events have been dropped since the previous reset
+    */
+    bool resetOverflow();
+
+
+    bool hasOverflowed() const;
+    std::uint64_t getDroppedCount() const;
+    std::size_t getCapacity() const;
+    std::size_t size() const;
+};
+
+
+
+template <typename E>
+LWWChangeRing<E>::LWWChangeRing(
+    const std::size_t & capacity
+) {
+    if(capacity == 0) {
+        throw std::invalid_argument("LWW change ring: capacity must be positive");
+    }
+
+    std::size_t rounded = 1;
+    while(rounded < capacity) {
+        rounded <<= 1;
+    }
+    this->slots.resize(rounded);
+    this->mask = rounded - 1;
+}
+
+
+
+template <typename E>
+template <typename Event>
+bool LWWChangeRing<E>::push(Event && event) {
+    const std::size_t tail = this->tail.value.load(std::memory_order_relaxed);
+
+    if(tail - this->head.value.load(std::memory_order_acquire) > this->mask) {
+        this->droppedCount.fetch_add(1, std::memory_order_relaxed);
+        this->overflowFlag.store(true, std::memory_order_release);
+        return false;
+    }
+
+    this->slots[tail & this->mask].emplace(std::forward<Event>(event));
+    this->tail.value.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+
+
+template <typename E>
+template <typename F>
+std::size_t LWWChangeRing<E>::drain(F && consumer, const std::size_t & maxCount) {
+    const std::size_t head = this->head.value.load(std::memory_order_relaxed);
+    const std::size_t count = std::min(this->tail.value.load(std::memory_order_acquire) - head, maxCount);
+
+    for(std::size_t position = head; position != head + count; ++position) {
+        auto & slot = this->slots[position & this->mask];
+        consumer(std::move(*slot));
+        slot.reset();
+    }
+
+    // Slots are handed back to the producer only once every popped event has been moved out.
+    this->head.value.store(head + count, std::memory_order_release);
+    return count;
+}
+
+
+
+template <typename E>
+std::size_t LWWChangeRing<E>::drain(std::vector<E> & events, const std::size_t & maxCount) {
+    return this->drain([&events](E && event) {
+        events.push_back(std::move(event));
+    }, maxCount);
+}
+
+
+
+template <typename E>
+bool LWWChangeRing<E>::resetOverflow() {
+    return this->overflowFlag.exchange(false, std::memory_order_acquire);
+}
+
+
+
+template <typename E>
+bool LWWChangeRing<E>::hasOverflowed() const {
+    return this->overflowFlag.load(std::memory_order_acquire);
+}
+
+
+
+template <typename E>
+std::uint64_t LWWChangeRing<E>::getDroppedCount() const {
+    return this->droppedCount.load(std::memory_order_relaxed);
+}
+
+
+
+template <typename E>
+std::size_t LWWChangeRing<E>::getCapacity() const {
+    return this->mask + 1;
+}
+
+
+
+template <typename E>
+std::size_t LWWChangeRing<E>::size() const {
+    // Head never passes tail, so reading it first keeps the difference from underflowing.
+    const std::size_t head = this->head.value.load(std::memory_order_acquire);
+    return this->tail.value.load(std::memory_order_acquire) - head;
+}
+
+
+
+#endif // LWWCHANGESTREAM_H
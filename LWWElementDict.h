@@ -8,30 +8,177 @@
 #define LWWELEMENTDICT_H
 
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <map>
 #include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+#include "LeftRight.h"
+#include "LWWChangeStream.h"
+#include "LWWMerkleTree.h"
+#include "LWWStats.h"
+#include "LWWStorage.h"
+#include "LWWThreadPool.h"
+#include "LWWTimestampSource.h"
+
+
+struct LWWSerialization;
+
+template <typename K, typename V, typename T>
+class LWWMappedSnapshot;
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+class ShardedLWWElementDict;
+
+
+
+/*!
+* @struct LWWOperation
+* @brief Add or remove request for a single element
+* @tparam K key
+* @tparam V value
+* @tparam T timestamp
+*/
+template <typename K,
+          typename V,
+          typename T>
+struct LWWOperation {
+    /*!
+    * @enum Type
+    * @brief Kind of request
+    */
+    enum class Type {
+        add, //!< Insertion into \a addedData
+        remove //!< Insertion into \a removedData
+    };
+
+    Type type; //!< Kind of request
+    K key; //!< key
+    V value; //!< value
+    T timestamp; //!< timestamp
+};
+
 
 
 /*!
 * @class LWWElementDict
 * @brief CRDT Last-Write-Wins Element Dictionary
-* @details CRDT LWW Element Dictionary allowing multiple insertions of same (key, value) pair.
+* @details CRDT LWW Element Dictionary allowing multiple insertions of same (key, value) pair. The add with the
+* latest timestamp is a key's current element, adds of equal timestamps are won by the greater value and removal wins
+* timestamp ties with adds, so replicas converge regardless of the order elements arrived in.
 * @tparam K key
 * @tparam V value
 * @tparam T timestamp
+* @tparam Storage history storage policy, \a TreeStorage , \a PooledTreeStorage , \a FlatStorage or \a CompactStorage
 */
 template <typename K,
           typename V,
-          typename T>
+          typename T,
+          template <typename, typename, typename> class Storage = TreeStorage>
 class LWWElementDict {
+public:
+    using StorageType = Storage<K, V, T>; //!< Container type of \a addedData and \a removedData
+    using History = typename StorageType::History; //!< Per-key history container
+    using CurrentData = std::map<K, std::pair<V, T>>; //!< Container type of \a currentData
+    using Op = LWWOperation<K, V, T>; //!< Batched operation
+    using Change = LWWChange<K, V, T>; //!< Change of a current element
+    using ChangeRing = LWWChangeRing<Change>; //!< Change stream of one subscriber
+
+    /*!
+    * @struct Snapshot
+    * @brief Histories of a dictionary frozen at one point in time, shared with the dictionary until it writes again
+    */
+    struct Snapshot {
+        std::shared_ptr<const StorageType> addedData; //!< Frozen \a addedData
+        std::shared_ptr<const StorageType> removedData; //!< Frozen \a removedData
+    };
+
+    /*!
+    * @class RangeView
+    * @brief Ordered range of current elements, all read from one consistent state of \a currentData
+    * @details The view references \a currentData instead of copying it and keeps the state it reads unmodified while
+    * it exists: writers of the dictionary wait for its destruction, so views should be short-lived and must not be held
+    * by a thread writing to the same dictionary.
+    */
+    class RangeView {
+    public:
+        using const_iterator = typename CurrentData::const_iterator; //!< Iterator over (key, (value, timestamp))
+        using iterator = const_iterator; //!< Elements are read-only
+
+
+    private:
+        typename LeftRight<CurrentData>::ReadGuard guard; //!< Announced reader of \a currentData
+        const_iterator first; //!< First element of the range
+        const_iterator last; //!< Element following the range
+
+
+    public:
+        /*!
+        * Constructor
+        * @param [in] guard Announced reader of \a currentData
+        * @param [in] first First element of the range
+        * @param [in] last Element following the range
+        */
+        RangeView(typename LeftRight<CurrentData>::ReadGuard && guard, const_iterator first, const_iterator last)
+            : guard(std::move(guard)), first(first), last(last) {}
+
+
+        const_iterator begin() const { return this->first; }
+        const_iterator end() const { return this->last; }
+        bool empty() const { return this->first == this->last; }
+    };
+
+
 private:
-    std::mutex mtx; //!< Mutual exclusion of concurrent thread execution
-    std::unique_lock<std::mutex> mtxLock; //!< Locking mechanism providing secure insertion from multiple threads.
+    mutable LWWMutex mtx; //!< Mutual exclusion of concurrent thread execution
+    LWWStatsRecorder statsRecorder; //!< Operation statistics, empty unless \a LWW_ENABLE_STATS is defined
+
+    std::shared_ptr<StorageType> addedData = std::make_shared<StorageType>(); //!< CRDT added elements, copied on write
+    std::shared_ptr<StorageType> removedData = std::make_shared<StorageType>(); //!< CRDT removed elements, copied on write
+    LeftRight<CurrentData> currentData; //!< CRDT current elements, published to readers without locking
+
+    std::uint64_t version = 0; //!< Local version, incremented on every change of \a addedData or \a removedData
+    std::map<K, std::uint64_t> keyVersions; //!< Version of latest change per key
+    std::map<std::uint64_t, K> changeLog; //!< Keys by version of their latest change
+
+    std::optional<T> stableTime; //!< Watermark all replicas have seen, older elements are ignored
+
+    std::function<T()> timestampSource; //!< Source of automatically stamped operations, \a LWWTimestampSource if empty
+
+    std::vector<std::weak_ptr<ChangeRing>> subscribers; //!< Change streams, dropped once their subscriber releases them
+    std::vector<Change> pendingChanges; //!< Changes of the running modification, published once it completes
+
+    mutable LWWDigestIndex<K> digestIndex; //!< Per-key digests, brought up to date by \a digest on demand
 
-    std::map<K, std::multimap<V, T>> addedData; //!< CRDT added elements
-    std::map<K, std::multimap<V, T>> removedData; //!< CRDT removed elements
-    std::map<K, std::pair<V, T>> currentData; //!< CRDT current elements
+    using ElementRefs = std::vector<std::tuple<const K *, const V *, const T *>>; //!< References to elements
+
+    /*!
+    * @struct KeyUpdate
+    * @brief Net effect of a group of elements on a single key's current element
+    */
+    struct KeyUpdate {
+        const K * k = nullptr; //!< key
+        const V * v = nullptr; //!< Winning added value within group, nullptr if group holds no insertion
+        const T * t = nullptr; //!< Winning added timestamp within group
+        std::optional<T> lastRemovalTime; //!< Latest removal time of key after the group has been applied
+    };
+
+    friend struct LWWSerialization; //!< Loads storages directly instead of replaying elements
+    friend class LWWMappedSnapshot<K, V, T>; //!< Writes snapshot files under \a mtx
+
+    template <typename, typename, typename, template <typename, typename, typename> class, typename>
+    friend class ShardedLWWElementDict; //!< Copies shards with \a copyFrom
 
 
 public:
@@ -63,6 +210,34 @@ public:
     virtual void addElement(const K & k, const V & v, const T & t);
 
 
+    /*!
+    * Insert new element into \a addedData map in less order, moving \p k and \p v into the containers
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    virtual void addElement(K && k, V && v, const T & t);
+
+
+    /*!
+    * Insert new element into \a addedData map in less order, with value constructed from \p args
+    * @param [in] k key
+    * @param [in] t timestamp
+    * @param [in] args Arguments of \a V 's constructor
+    */
+    template <typename... Args>
+    void emplaceElement(K k, const T & t, Args &&... args);
+
+
+    /*!
+    * Insert new element into \a addedData map in less order, stamped by the timestamp source
+    * @param [in] k key
+    * @param [in] v value
+    * @return timestamp of the element
+    */
+    T addElement(const K & k, const V & v);
+
+
     /*!
     * Insert new element into \a removedData map in less order
     * @param [in] k key
@@ -72,6 +247,24 @@ public:
     virtual void removeElement(const K & k, const V & v, const T & t);
 
 
+    /*!
+    * Insert new element into \a removedData map in less order, moving \p v into the history
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    virtual void removeElement(K && k, V && v, const T & t);
+
+
+    /*!
+    * Insert new element into \a removedData map in less order, stamped by the timestamp source
+    * @param [in] k key
+    * @param [in] v value
+    * @return timestamp of the element
+    */
+    T removeElement(const K & k, const V & v);
+
+
     /*!
     * Invoking addElement method
     * @param [in] k key
@@ -82,7 +275,52 @@ public:
 
 
     /*!
-    * Retrieving current value for specified map's key \p k .
+    * Invoking addElement method
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    virtual void updateValue(K && k, V && v, const T & t);
+
+
+    /*!
+    * Invoking addElement method, stamped by the timestamp source
+    * @param [in] k key
+    * @param [in] v value
+    * @return timestamp of the element
+    */
+    T updateValue(const K & k, const V & v);
+
+
+    /*!
+    * Setting the source of automatically stamped operations, a default constructed \a LWWTimestampSource unless set.
+    * Not synchronized with concurrent stamped operations, so set it before sharing the dictionary between threads.
+    * @param [in] source Callable returning timestamps, e.g. \a LWWTimestampSource of the replica's clock
+    */
+    void setTimestampSource(std::function<T()> source);
+
+
+    /*!
+    * Applying a batch of add and remove operations under a single lock. Operations are grouped by key, so every key's
+    * histories and current element are probed once. Result equals applying operations one by one in given order.
+    * @param [in] first Beginning of \a Op range
+    * @param [in] last End of \a Op range
+    */
+    template <typename InputIt>
+    void applyBatch(InputIt first, InputIt last);
+
+
+#ifdef __cpp_lib_span
+    /*!
+    * Applying a batch of add and remove operations under a single lock.
+    * @param [in] operations Operations in order of arrival
+    */
+    void applyBatch(std::span<const Op> operations);
+#endif
+
+
+    /*!
+    * Retrieving current value for specified map's key \p k . Wait-free, never takes \a mtx .
     * @param [in] k key
     * @return container with corresponding value if exists, empty otherwise
     * @retval std::optional<V> value type within std::optional container
@@ -90,13 +328,154 @@ public:
     virtual const std::optional<const V> getValueByKey(const K & k);
 
 
+    /*!
+    * Retrieving current values for a batch of keys, all read from one consistent state of \a currentData . Keys are
+    * probed in ascending order, so a key close to the previous one is reached by stepping forward instead of another
+    * descent from the root. Wait-free, never takes \a mtx .
+    * @param [in] first Beginning of key range, keys in any order and possibly repeated
+    * @param [in] last End of key range
+    * @return values in order of keys, empty where a key has no current value
+    */
+    template <typename InputIt>
+    std::vector<std::optional<V>> getValuesByKeys(InputIt first, InputIt last) const;
+
+
+    /*!
+    * Retrieving current values for a batch of keys, all read from one consistent state of \a currentData .
+    * @param [in] keys keys in any order, possibly repeated
+    * @return values in order of \p keys , empty where a key has no current value
+    */
+    std::vector<std::optional<V>> getValuesByKeys(const std::vector<K> & keys) const;
+
+
+    /*!
+    * Viewing all current elements in key order. Wait-free, never takes \a mtx .
+    * @return view of \a currentData
+    */
+    RangeView scan() const;
+
+
+    /*!
+    * Viewing current elements with keys in range [ \p lower , \p upper ) in key order. Wait-free, never takes \a mtx .
+    * @param [in] lower Smallest included key
+    * @param [in] upper Smallest excluded key
+    * @return view of the range, empty if \p upper is not greater than \p lower
+    */
+    RangeView range(const K & lower, const K & upper) const;
+
+
+    /*!
+    * Viewing current elements whose keys start with \p prefix in key order. Available for \a std::string keys.
+    * Wait-free, never takes \a mtx .
+    * @param [in] prefix Key prefix
+    * @return view of the range
+    */
+    RangeView prefix(const K & prefix) const;
+
+
     /*!
     * Adding elements from \p dict 's maps to maps of this instance while avoiding duplicates and preserving less order.
+    * Merges a \a snapshot of \p dict , so \p dict may be written concurrently and is locked only to take the snapshot.
     * @param [in] dict Source dictionary
     */
     virtual void mergeWith(const LWWElementDict & dict);
 
 
+    /*!
+    * Adding elements of memory-mapped \p snapshot to maps of this instance, then compacting with the snapshot's
+    * watermark, so elements its writer compacted away do not return. Defined in LWWMappedSnapshot.h.
+    * @param [in] snapshot Source snapshot
+    * @throw LWWFormatError if the mapped histories are malformed
+    */
+    void mergeWith(const LWWMappedSnapshot<K, V, T> & snapshot);
+
+
+    /*!
+    * Merging \p dict like \a mergeWith , with key ranges of the source merged concurrently on \p pool .
+    * New keys are inserted first, then histories of disjoint key ranges are merged in parallel and \a currentData is
+    * updated with one modification applying every range's net effects. Small sources are merged sequentially.
+    * @param [in] dict Source dictionary
+    * @param [in] pool Threads merging key ranges
+    */
+    void mergeWith(const LWWElementDict & dict, LWWThreadPool & pool);
+
+
+    /*!
+    * Extracting delta state holding complete histories of keys changed after local version \p sinceVersion .
+    * Merging the delta into a replica that has merged this instance as of \p sinceVersion brings it up to date. The
+    * delta carries this instance's watermark, so it is persisted along with the delta's elements.
+    * @param [in] sinceVersion Local version the receiver is known to have, 0 for full state
+    * @param [out] untilVersion Local version the delta is complete for, to be passed as \p sinceVersion next time
+    * @return delta dictionary
+    */
+    std::unique_ptr<LWWElementDict> extractDelta(const std::uint64_t & sinceVersion, std::uint64_t & untilVersion) const;
+
+
+    /*!
+    * Merging delta state extracted by \a extractDelta .
+    * @param [in] delta Delta dictionary
+    */
+    virtual void applyDelta(const LWWElementDict & delta);
+
+
+    /*!
+    * Discarding history older than \p stableTime , a causally stable timestamp every replica has already seen.
+    * Per key, only the latest add and the latest removal older than the watermark are kept, and keys removed before
+    * the watermark are dropped completely. From then on elements older than the watermark are ignored, so
+    * \a getValueByKey and merging with replicas at or past the watermark give the same results as without compaction.
+    * The watermark never moves backwards.
+    * @param [in] stableTime Watermark
+    */
+    virtual void compact(const T & stableTime);
+
+
+    /*!
+    * Taking a consistent snapshot of histories in constant time. Storages are shared with the snapshot and copied by
+    * the first write that happens while a snapshot is still held.
+    * @return snapshot
+    */
+    Snapshot snapshot() const;
+
+
+    /*!
+    * Digesting added and removed elements into a tree of key range hashes. Replicas holding the same elements have
+    * equal trees, so comparing them with \a LWWMerkleTree::diff finds the key ranges to exchange. Per-key digests are
+    * updated incrementally for keys changed since the previous call, writes do not pay for digests.
+    * @param [in] depth Number of tree levels below the root, at most \a LWWMerkleTree::maxDepth
+    * @return digest tree
+    */
+    LWWMerkleTree digest(const unsigned & depth = 10) const;
+
+
+    /*!
+    * Extracting delta state holding complete histories of keys within \p ranges , typically the ranges where this
+    * instance's digest differs from another replica's. Merging the delta into that replica, and the replica's delta for
+    * the same ranges into this instance, makes both equal at a cost proportional to their divergence.
+    * @param [in] ranges Key ranges found by \a LWWMerkleTree::diff
+    * @return delta dictionary
+    */
+    std::unique_ptr<LWWElementDict> extractRanges(const std::vector<LWWKeyRange> & ranges) const;
+
+
+    /*!
+    * Taking operation counters, latency histograms and lock contention metrics recorded since construction.
+    * Statistics are only recorded if \a LWW_ENABLE_STATS is defined, otherwise they are empty.
+    * @return statistics
+    */
+    LWWStats stats() const;
+
+
+    /*!
+    * Subscribing to changes of current elements. Every insertion, replacement and removal of a current element is
+    * pushed once to the returned ring, in the order changes become visible. A full ring drops events and raises its
+    * overflow flag instead of delaying writers. Releasing the ring ends the subscription. Writes pay for change events
+    * only while subscriptions exist.
+    * @param [in] capacity Number of events the ring buffers until drained
+    * @return change stream, drained by one consumer
+    */
+    std::shared_ptr<ChangeRing> subscribe(const std::size_t & capacity = 4096);
+
+
 private:
     /*!
     * Fetching time from latest removal request for specified key \p k .
@@ -108,244 +487,1235 @@ private:
 
 
     /*!
-    * Register the element as currently contained.
+    * Copying histories, current elements, version counters, watermark and timestamp source of \p dict into this newly
+    * constructed instance, not yet shared with other threads.
+    * @param [in] dict Source dictionary
+    */
+    void copyFrom(const LWWElementDict & dict);
+
+
+    /*!
+    * Issuing timestamp of an automatically stamped operation from the timestamp source.
+    * @return issued timestamp
+    */
+    T nextTimestamp() const;
+
+
+    /*!
+    * Inserting element into \a addedData and \a currentData . Arguments passed as rvalues are copied into one instance
+    * of \a currentData and moved into the other.
     * @param [in] k key
     * @param [in] v value
     * @param [in] t timestamp
     */
-    void addToCurrentData(const K & k, const V & v, const T & t);
+    template <typename KArg, typename VArg>
+    void insertAdded(KArg && k, VArg && v, const T & t);
 
 
     /*!
-    * Unregister the element as currently contained.
+    * Inserting element into \a removedData and updating \a currentData . Arguments passed as rvalues are moved, a new
+    * key into \a removedData once its other uses are done.
     * @param [in] k key
     * @param [in] v value
     * @param [in] t timestamp
     */
-    void removeFromCurrentData(const K & k, const V & v, const T & t);
+    template <typename KArg, typename VArg>
+    void insertRemoved(KArg && k, VArg && v, const T & t);
+
+
+    /*!
+    * Register the element as currently contained.
+    * @param [in,out] current Instance of \a currentData being modified
+    * @param [in] k key, moved from if passed as rvalue and inserted
+    * @param [in] v value, moved from if passed as rvalue and inserted
+    * @param [in] t timestamp
+    * @param [out] changes Recorded change of the current element, nullptr if not recorded
+    */
+    template <typename KArg, typename VArg>
+    void addToCurrentData(CurrentData & current, KArg && k, VArg && v, const T & t, std::vector<Change> * changes);
+
+
+    /*!
+    * Unregister the element as currently contained.
+    * @param [in,out] current Instance of \a currentData being modified
+    * @param [in] k key
+    * @param [in] t timestamp
+    * @param [out] changes Recorded change of the current element, nullptr if not recorded
+    */
+    void removeFromCurrentData(CurrentData & current, const K & k, const T & t, std::vector<Change> * changes);
+
+
+    /*!
+    * Applying net effect of a group of elements on key's current element. Linear over a sequence of updates sorted
+    * by key when \p cursor returned by the previous call is passed in.
+    * @param [in,out] current Instance of \a currentData being modified
+    * @param [in] cursor Position of previously updated key, or any valid iterator of \p current
+    * @param [in] update Net effect
+    * @param [out] changes Recorded change of the current element, nullptr if not recorded
+    * @return position following the updated key's current element
+    */
+    typename CurrentData::iterator updateCurrentData(
+        CurrentData & current,
+        typename CurrentData::iterator cursor,
+        const KeyUpdate & update,
+        std::vector<Change> * changes
+    );
 
 
     /*!
-    * Less-ordered insertion
-    * @param [in,out] multimap Target container
-    * @param [in] pair Data to insert
+    * Summarizing merged elements into one net effect per key. Elements of the same key must be adjacent.
+    * @param [in] added Elements inserted into \a addedData
+    * @param [in] removed Elements inserted into \a removedData
+    * @return net effects in order of first appearance, insertions first
     */
-    void orderedInsert(std::multimap<V, T> & multimap, const std::pair<V, T> & pair);
+    std::vector<KeyUpdate> collectKeyUpdates(const ElementRefs & added, const ElementRefs & removed);
 
 
     /*!
-    * Adding elements from \p dataSrc to \p dataDest while avoiding duplicates and preserving less order. Updates \a currentData.
-    * @param [in] addFlag If true, elements are added to \a currentData , otherwise removed.
+    * Adding elements from \p dataSrc to \p dataDest while avoiding duplicates and preserving less order.
     * @param [in,out] dataDest Merging destination
     * @param [in] dataSrc Merging source
+    * @param [out] inserted Elements of \p dataSrc not previously contained in \p dataDest
     */
     void mergeData(
-        const bool & addFlag,
-        std::map<K, std::multimap<V, T>> & dataDest,
-        const std::map<K, std::multimap<V, T>> & dataSrc
+        StorageType & dataDest,
+        const StorageType & dataSrc,
+        ElementRefs & inserted
+    );
+
+
+    /*!
+    * Merging key ranges of \p dataSrc into \p dataDest concurrently. Caller holds \a mtx .
+    * @param [in,out] dataDest Merging destination
+    * @param [in] dataSrc Merging source
+    * @param [out] inserted Elements of \p dataSrc not previously contained in \p dataDest , one vector per range
+    * @param [in] pool Threads merging key ranges
+    */
+    void parallelMergeData(
+        StorageType & dataDest,
+        const StorageType & dataSrc,
+        std::vector<ElementRefs> & inserted,
+        LWWThreadPool & pool
     );
 
 
+    /*!
+    * Merging histories \p added and \p removed into this instance and updating \a currentData . Caller holds \a mtx .
+    * @param [in] added Source of \a addedData elements
+    * @param [in] removed Source of \a removedData elements
+    */
+    void mergeStorages(const StorageType & added, const StorageType & removed);
+
+
+    /*!
+    * Recording change of key \p k under a new local version. Caller holds \a mtx .
+    * @param [in] k key
+    */
+    void touchKey(const K & k);
+
+
+    /*!
+    * Preparing \p data for modification, copying it first if a snapshot still shares it. Caller holds \a mtx .
+    * @param [in,out] data \a addedData or \a removedData
+    * @return storage exclusively owned by this instance
+    */
+    StorageType & writableData(std::shared_ptr<StorageType> & data);
+
+
+    /*!
+    * Container recording changes of the next modification of \a currentData . Caller holds \a mtx .
+    * @return \a pendingChanges , nullptr if nobody subscribed
+    */
+    std::vector<Change> * changeRecorder();
+
+
+    /*!
+    * Bringing \a digestIndex up to date, from scratch if it has been reset. Caller holds \a mtx .
+    */
+    void refreshDigestIndex() const;
+
+
+    /*!
+    * Pushing recorded changes to every subscriber and dropping released subscriptions. Caller holds \a mtx .
+    */
+    void publishChanges();
+
+
+    /*!
+    * Checking whether elements stamped \p t are ignored due to compaction. Caller holds \a mtx .
+    * @param [in] t timestamp
+    * @return true if \p t is older than the watermark
+    */
+    bool isCompacted(const T & t) const;
+
+
 public:
     const auto & getAddedData() const;
     const auto & getRemovedData() const;
     const auto & getCurrentData() const;
+    const std::uint64_t & getVersion() const;
+    const std::optional<T> & getStableTime() const;
 
 };
 
 
 
-template <typename K, typename V, typename T>
-LWWElementDict<K, V, T>::LWWElementDict(
-):
-    mtxLock(std::unique_lock<std::mutex>(this->mtx, std::defer_lock))
-{
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+LWWElementDict<K, V, T, Storage>::LWWElementDict(
+) {
 }
 
 
 
-template <typename K, typename V, typename T>
-LWWElementDict<K, V, T>::LWWElementDict(
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+LWWElementDict<K, V, T, Storage>::LWWElementDict(
     const LWWElementDict & dict
-):
-    mtxLock(std::unique_lock<std::mutex>(this->mtx, std::defer_lock)),
+) {
+    this->copyFrom(dict);
+}
+
 
-    addedData(dict.getAddedData()),
-    removedData(dict.getRemovedData())
-{
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::addElement(const K & k, const V & v, const T & t)  {
+    this->insertAdded(k, v, t);
 }
 
 
 
-template <typename K, typename V, typename T>
-void LWWElementDict<K, V, T>::addElement(const K & k, const V & v, const T & t)  {
-    this->mtxLock.lock();
-    this->orderedInsert(this->addedData[k], { v, t });
-    this->addToCurrentData(k, v, t);
-    this->mtxLock.unlock();
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::addElement(K && k, V && v, const T & t)  {
+    this->insertAdded(std::move(k), std::move(v), t);
 }
 
 
 
-template <typename K, typename V, typename T>
-void LWWElementDict<K, V, T>::removeElement(const K & k, const V & v, const T & t)  {
-    this->mtxLock.lock();
-    this->orderedInsert(this->removedData[k], { v, t });
-    this->removeFromCurrentData(k, v, t);
-    this->mtxLock.unlock();
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+template <typename... Args>
+void LWWElementDict<K, V, T, Storage>::emplaceElement(K k, const T & t, Args &&... args)  {
+    this->addElement(std::move(k), V(std::forward<Args>(args)...), t);
 }
 
 
 
-template <typename K, typename V, typename T>
-void LWWElementDict<K, V, T>::updateValue(const K & k, const V & v, const T & t) {
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+T LWWElementDict<K, V, T, Storage>::addElement(const K & k, const V & v) {
+    const T t = this->nextTimestamp();
     this->addElement(k, v, t);
+    return t;
 }
 
 
 
-template <typename K, typename V, typename T>
-const std::optional<const V> LWWElementDict<K, V, T>::getValueByKey(const K & k) {
-    if(this->currentData.find(k) != this->currentData.end()) {
-        return { this->currentData[k].first };
-    } else {
-        return {};
-    }
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::removeElement(const K & k, const V & v, const T & t)  {
+    this->insertRemoved(k, v, t);
 }
 
 
 
-template <typename K, typename V, typename T>
-void LWWElementDict<K, V, T>::mergeWith(const LWWElementDict & dict) {
-    this->mtxLock.lock();
-    this->mergeData(true, this->addedData, dict.getAddedData());
-    this->mergeData(false, this->removedData, dict.getRemovedData());
-    this->mtxLock.unlock();
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::removeElement(K && k, V && v, const T & t)  {
+    this->insertRemoved(std::move(k), std::move(v), t);
 }
 
 
 
-template <typename K, typename V, typename T>
-const std::optional<const T> LWWElementDict<K, V, T>::getLastRemovalTime(const K & k) {
-    if(this->removedData.find(k) != this->removedData.end()) {
-        for(const auto & [v, t] : this->removedData[k]) {
-            //
-        }
-    } else {
-        return {};
-    }
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+T LWWElementDict<K, V, T, Storage>::removeElement(const K & k, const V & v) {
+    const T t = this->nextTimestamp();
+    this->removeElement(k, v, t);
+    return t;
 }
 
 
 
-template <typename K, typename V, typename T>
-void LWWElementDict<K, V, T>::addToCurrentData(const K & k, const V & v, const T & t) {
-    const auto timeCont = this->getLastRemovalTime(k);
-    if(timeCont) {
-        // If element's timestamps for insertion and removal are the same, then removal has priority.
-        if(*timeCont < t) {
-            return;
-        }
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::updateValue(const K & k, const V & v, const T & t) {
+    this->addElement(k, v, t);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::updateValue(K && k, V && v, const T & t) {
+    this->addElement(std::move(k), std::move(v), t);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+T LWWElementDict<K, V, T, Storage>::updateValue(const K & k, const V & v) {
+    return this->addElement(k, v);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::setTimestampSource(std::function<T()> source) {
+    this->timestampSource = std::move(source);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+template <typename InputIt>
+void LWWElementDict<K, V, T, Storage>::applyBatch(InputIt first, InputIt last) {
+    std::vector<const Op *> operations;
+    for(; first != last; ++first) {
+        operations.push_back(&*first);
+    }
+
+    // Grouping by key while keeping order of arrival within every key.
+    std::stable_sort(operations.begin(), operations.end(), [](const Op * lhs, const Op * rhs) {
+        return lhs->key < rhs->key;
+    });
+
+    [[maybe_unused]] const auto timer = this->statsRecorder.time(LWWStatsRecorder::Operation::batch);
+    std::lock_guard<LWWMutex> lock(this->mtx);
+
+    std::vector<KeyUpdate> updates;
+    for(auto groupIter = operations.begin(); groupIter != operations.end();) {
+        const K & k = (*groupIter)->key;
+        KeyUpdate update;
+        update.k = &k;
+        History * addedHistory = nullptr;
+        History * removedHistory = nullptr;
+        bool changeFlag = false;
+
+        for(; groupIter != operations.end() && !(k < (*groupIter)->key); ++groupIter) {
+            const Op & operation = **groupIter;
+
+            if(this->isCompacted(operation.timestamp)) {
+                continue;
+            }
+
+            if(operation.type == Op::Type::add) {
+                if(!addedHistory) {
+                    addedHistory = &this->writableData(this->addedData)[k];
+                }
+                const bool insertedFlag = StorageType::orderedInsert(*addedHistory, { operation.value, operation.timestamp });
+                this->statsRecorder.recordInsert(insertedFlag, addedHistory->size());
+                changeFlag |= insertedFlag;
+
+                if(!update.t || lwwSupersedes(operation.value, operation.timestamp, *update.v, *update.t)) {
+                    update.v = &operation.value;
+                    update.t = &operation.timestamp;
+                }
+            } else {
+                if(!removedHistory) {
+                    removedHistory = &this->writableData(this->removedData)[k];
+                }
+                const bool insertedFlag = StorageType::orderedInsert(*removedHistory, { operation.value, operation.timestamp });
+                this->statsRecorder.recordInsert(insertedFlag, removedHistory->size());
+                changeFlag |= insertedFlag;
+            }
+        }
+
+        if(!addedHistory && !removedHistory) {
+            continue;
+        }
+
+        if(changeFlag) {
+            this->touchKey(k);
+        }
+
+        if(removedHistory) {
+            update.lastRemovalTime = StorageType::lastTime(*removedHistory);
+        } else {
+            const auto lastRemovalTime = this->getLastRemovalTime(k);
+            if(lastRemovalTime) {
+                update.lastRemovalTime = *lastRemovalTime;
+            }
+        }
+
+        updates.push_back(std::move(update));
+    }
+
+    if(updates.empty()) {
+        return;
+    }
+
+    std::vector<Change> * changes = this->changeRecorder();
+    this->currentData.modify([&](CurrentData & current) {
+        auto cursor = current.begin();
+        for(const auto & update : updates) {
+            cursor = this->updateCurrentData(current, cursor, update, changes);
+        }
+        // The second instance repeats the same changes.
+        changes = nullptr;
+    });
+    this->publishChanges();
+}
+
+
+
+#ifdef __cpp_lib_span
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::applyBatch(std::span<const Op> operations) {
+    this->applyBatch(operations.begin(), operations.end());
+}
+#endif
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+const std::optional<const V> LWWElementDict<K, V, T, Storage>::getValueByKey(const K & k) {
+    [[maybe_unused]] const auto timer = this->statsRecorder.timeLookup();
+    return this->currentData.read([&k](const CurrentData & current) -> std::optional<const V> {
+        const auto currentIter = current.find(k);
+
+        if(currentIter != current.end()) {
+            return { currentIter->second.first };
+        } else {
+            return {};
+        }
+    });
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+template <typename InputIt>
+std::vector<std::optional<V>> LWWElementDict<K, V, T, Storage>::getValuesByKeys(InputIt first, InputIt last) const {
+    // Probes pair every key with its position in the input. Keys passed in ascending order are not sorted again.
+    std::vector<std::pair<const K *, std::size_t>> probes;
+    for(; first != last; ++first) {
+        probes.emplace_back(&*first, probes.size());
+    }
+
+    const auto keyLess = [](const auto & lhs, const auto & rhs) {
+        return *lhs.first < *rhs.first;
+    };
+    if(!std::is_sorted(probes.begin(), probes.end(), keyLess)) {
+        std::sort(probes.begin(), probes.end(), keyLess);
+    }
+
+    std::vector<std::optional<V>> values(probes.size());
+    this->currentData.read([&probes, &values](const CurrentData & current) {
+        // Cursor is at the first element not less than the previous key, so it never passes the next key's position.
+        // Repeated and adjacent keys are found at or right after it, distant keys by a lookup from the root.
+        auto cursor = current.begin();
+        for(const auto & [k, position] : probes) {
+            if(cursor != current.end() && cursor->first < *k) {
+                ++cursor;
+                if(cursor != current.end() && cursor->first < *k) {
+                    cursor = current.lower_bound(*k);
+                }
+            }
+
+            if(cursor != current.end() && !(*k < cursor->first)) {
+                values[position] = cursor->second.first;
+            }
+        }
+    });
+
+    return values;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::vector<std::optional<V>> LWWElementDict<K, V, T, Storage>::getValuesByKeys(const std::vector<K> & keys) const {
+    return this->getValuesByKeys(keys.begin(), keys.end());
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+typename LWWElementDict<K, V, T, Storage>::RangeView LWWElementDict<K, V, T, Storage>::scan() const {
+    auto guard = this->currentData.guard();
+    const CurrentData & current = guard.get();
+    return RangeView(std::move(guard), current.begin(), current.end());
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+typename LWWElementDict<K, V, T, Storage>::RangeView LWWElementDict<K, V, T, Storage>::range(
+    const K & lower,
+    const K & upper
+) const {
+    auto guard = this->currentData.guard();
+    const CurrentData & current = guard.get();
+
+    if(!(lower < upper)) {
+        return RangeView(std::move(guard), current.end(), current.end());
+    }
+    return RangeView(std::move(guard), current.lower_bound(lower), current.lower_bound(upper));
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+typename LWWElementDict<K, V, T, Storage>::RangeView LWWElementDict<K, V, T, Storage>::prefix(const K & prefix) const {
+    static_assert(std::is_same_v<K, std::string>, "LWWElementDict::prefix requires std::string keys");
+
+    auto guard = this->currentData.guard();
+    const CurrentData & current = guard.get();
+
+    // Keys starting with the prefix end before its successor: the prefix without trailing maximal characters, with
+    // the last remaining character incremented. Characters compare as unsigned.
+    std::string successor = prefix;
+    while(!successor.empty() && static_cast<unsigned char>(successor.back()) == 0xFF) {
+        successor.pop_back();
+    }
+
+    const auto first = current.lower_bound(prefix);
+    if(successor.empty()) {
+        return RangeView(std::move(guard), first, current.end());
+    }
+    successor.back() = static_cast<char>(static_cast<unsigned char>(successor.back()) + 1);
+    return RangeView(std::move(guard), first, current.lower_bound(successor));
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::mergeWith(const LWWElementDict & dict) {
+    [[maybe_unused]] const auto timer = this->statsRecorder.time(LWWStatsRecorder::Operation::merge);
+    const Snapshot source = dict.snapshot();
+
+    std::lock_guard<LWWMutex> lock(this->mtx);
+    this->mergeStorages(*source.addedData, *source.removedData);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::mergeWith(const LWWElementDict & dict, LWWThreadPool & pool) {
+    // Below this size, handing out ranges costs more than merging them.
+    static constexpr std::size_t minParallelKeys = 1 << 14;
+
+    [[maybe_unused]] const auto timer = this->statsRecorder.time(LWWStatsRecorder::Operation::merge);
+    const Snapshot source = dict.snapshot();
+    std::lock_guard<LWWMutex> lock(this->mtx);
+
+    if(pool.getThreadCount() < 2 || source.addedData->size() + source.removedData->size() < minParallelKeys) {
+        this->mergeStorages(*source.addedData, *source.removedData);
+        return;
+    }
+
+    std::vector<ElementRefs> addedRefs;
+    std::vector<ElementRefs> removedRefs;
+    this->parallelMergeData(this->writableData(this->addedData), *source.addedData, addedRefs, pool);
+    this->parallelMergeData(this->writableData(this->removedData), *source.removedData, removedRefs, pool);
+
+    std::size_t insertedCount = 0;
+    for(const auto & refs : addedRefs) {
+        insertedCount += refs.size();
+    }
+    for(const auto & refs : removedRefs) {
+        insertedCount += refs.size();
+    }
+    this->statsRecorder.recordMerge(insertedCount);
+
+    // Net effects are collected per range in parallel, removed ranges following added ones.
+    std::vector<std::vector<KeyUpdate>> updates(addedRefs.size() + removedRefs.size());
+    const ElementRefs noRefs;
+    pool.parallelFor(updates.size(), [&](const std::size_t & index) {
+        updates[index] = index < addedRefs.size()
+            ? this->collectKeyUpdates(addedRefs[index], noRefs)
+            : this->collectKeyUpdates(noRefs, removedRefs[index - addedRefs.size()]);
+    });
+
+    bool changeFlag = false;
+    for(const auto & rangeUpdates : updates) {
+        for(const auto & update : rangeUpdates) {
+            this->touchKey(*update.k);
+            changeFlag = true;
+        }
+    }
+
+    if(!changeFlag) {
+        return;
+    }
+
+    std::vector<Change> * changes = this->changeRecorder();
+    this->currentData.modify([&](CurrentData & current) {
+        for(const auto & rangeUpdates : updates) {
+            auto cursor = current.begin();
+            for(const auto & update : rangeUpdates) {
+                cursor = this->updateCurrentData(current, cursor, update, changes);
+            }
+        }
+        // The second instance repeats the same changes.
+        changes = nullptr;
+    });
+    this->publishChanges();
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::unique_ptr<LWWElementDict<K, V, T, Storage>> LWWElementDict<K, V, T, Storage>::extractDelta(
+    const std::uint64_t & sinceVersion,
+    std::uint64_t & untilVersion
+) const {
+    StorageType added;
+    StorageType removed;
+    std::optional<T> stableTime;
+
+    {
+        std::lock_guard<LWWMutex> lock(this->mtx);
+
+        for(auto logIter = this->changeLog.upper_bound(sinceVersion); logIter != this->changeLog.end(); ++logIter) {
+            const K & k = logIter->second;
+
+            const auto addedIter = this->addedData->find(k);
+            if(addedIter != this->addedData->end()) {
+                added[k] = addedIter->second;
+            }
+
+            const auto removedIter = this->removedData->find(k);
+            if(removedIter != this->removedData->end()) {
+                removed[k] = removedIter->second;
+            }
+        }
+
+        untilVersion = this->version;
+        stableTime = this->stableTime;
+    }
+
+    auto delta = std::make_unique<LWWElementDict>();
+    std::lock_guard<LWWMutex> lock(delta->mtx);
+    delta->mergeStorages(added, removed);
+    delta->stableTime = stableTime;
+
+    return delta;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::applyDelta(const LWWElementDict & delta) {
+    this->mergeWith(delta);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::compact(const T & stableTime) {
+    std::lock_guard<LWWMutex> lock(this->mtx);
+
+    if(this->stableTime && !(*this->stableTime < stableTime)) {
+        return;
+    }
+    this->stableTime = stableTime;
+
+    // Discarded elements leave the digests of their keys, which are rebuilt on the next request.
+    this->digestIndex.reset();
+
+    StorageType & added = this->writableData(this->addedData);
+    StorageType & removed = this->writableData(this->removedData);
+
+    for(auto & [k, history] : added) {
+        StorageType::compactHistory(history, stableTime);
+    }
+    for(auto & [k, history] : removed) {
+        StorageType::compactHistory(history, stableTime);
+    }
+
+    const auto dropKey = [this](const K & k) {
+        const auto versionIter = this->keyVersions.find(k);
+        if(versionIter != this->keyVersions.end()) {
+            this->changeLog.erase(versionIter->second);
+            this->keyVersions.erase(versionIter);
+        }
+    };
+
+    // Keys whose latest removal is stable and not older than their latest add can never become visible again.
+    for(auto removedIter = removed.begin(); removedIter != removed.end();) {
+        const K & k = removedIter->first;
+        const auto lastRemovalTime = StorageType::lastTime(removedIter->second);
+
+        if(!lastRemovalTime || !(*lastRemovalTime < stableTime)) {
+            ++removedIter;
+            continue;
+        }
+
+        const auto addedIter = added.find(k);
+        if(addedIter != added.end()) {
+            const auto lastAddTime = StorageType::lastTime(addedIter->second);
+            if(lastAddTime && *lastRemovalTime < *lastAddTime) {
+                ++removedIter;
+                continue;
+            }
+            added.erase(addedIter);
+        }
+
+        dropKey(k);
+        removedIter = removed.erase(removedIter);
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+typename LWWElementDict<K, V, T, Storage>::Snapshot LWWElementDict<K, V, T, Storage>::snapshot() const {
+    std::lock_guard<LWWMutex> lock(this->mtx);
+    return { this->addedData, this->removedData };
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+LWWMerkleTree LWWElementDict<K, V, T, Storage>::digest(const unsigned & depth) const {
+    std::lock_guard<LWWMutex> lock(this->mtx);
+    this->refreshDigestIndex();
+    return LWWMerkleTree(depth, this->digestIndex.getBucketHashes());
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::unique_ptr<LWWElementDict<K, V, T, Storage>> LWWElementDict<K, V, T, Storage>::extractRanges(
+    const std::vector<LWWKeyRange> & ranges
+) const {
+    StorageType added;
+    StorageType removed;
+
+    {
+        std::lock_guard<LWWMutex> lock(this->mtx);
+        this->refreshDigestIndex();
+
+        // The index orders keys by bucket, visiting them in key order instead keeps lookups and inserts local.
+        std::vector<const K *> keys;
+        for(const auto & range : ranges) {
+            this->digestIndex.forEachKey(range, [&keys](const K & k) {
+                keys.push_back(&k);
+            });
+        }
+        std::sort(keys.begin(), keys.end(), [](const K * lhs, const K * rhs) {
+            return *lhs < *rhs;
+        });
+
+        for(const K * k : keys) {
+            const auto addedIter = this->addedData->find(*k);
+            if(addedIter != this->addedData->end()) {
+                added[*k] = addedIter->second;
+            }
+
+            const auto removedIter = this->removedData->find(*k);
+            if(removedIter != this->removedData->end()) {
+                removed[*k] = removedIter->second;
+            }
+        }
     }
 
-    if(this->currentData.find(k) == this->currentData.end()) {
-        this->currentData[k] = { v, t };
+    auto delta = std::make_unique<LWWElementDict>();
+    std::lock_guard<LWWMutex> lock(delta->mtx);
+    delta->mergeStorages(added, removed);
+
+    return delta;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+LWWStats LWWElementDict<K, V, T, Storage>::stats() const {
+    return this->statsRecorder.snapshot(this->mtx);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::shared_ptr<typename LWWElementDict<K, V, T, Storage>::ChangeRing> LWWElementDict<K, V, T, Storage>::subscribe(
+    const std::size_t & capacity
+) {
+    auto ring = std::make_shared<ChangeRing>(capacity);
+
+    std::lock_guard<LWWMutex> lock(this->mtx);
+    this->subscribers.push_back(ring);
+    return ring;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+const std::optional<const T> LWWElementDict<K, V, T, Storage>::getLastRemovalTime(const K & k) {
+    const auto removedIter = this->removedData->find(k);
+
+    if(removedIter != this->removedData->end()) {
+        return StorageType::lastTime(removedIter->second);
     } else {
-        if(t > this->currentData[k].second) {
-            this->currentData[k] = { v, t };
+        return {};
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::copyFrom(const LWWElementDict & dict) {
+    std::lock_guard<LWWMutex> lock(dict.mtx);
+    this->addedData = dict.addedData;
+    this->removedData = dict.removedData;
+    this->currentData.modify([&dict](CurrentData & current) {
+        current = dict.getCurrentData();
+    });
+    this->version = dict.version;
+    this->keyVersions = dict.keyVersions;
+    this->changeLog = dict.changeLog;
+    this->stableTime = dict.stableTime;
+    this->timestampSource = dict.timestampSource;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+T LWWElementDict<K, V, T, Storage>::nextTimestamp() const {
+    return this->timestampSource ? this->timestampSource() : LWWTimestampSource<T>().next();
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+template <typename KArg, typename VArg>
+void LWWElementDict<K, V, T, Storage>::insertAdded(KArg && k, VArg && v, const T & t) {
+    [[maybe_unused]] const auto timer = this->statsRecorder.time(LWWStatsRecorder::Operation::add);
+    std::lock_guard<LWWMutex> lock(this->mtx);
+    if(this->isCompacted(t)) {
+        return;
+    }
+
+    History & history = this->writableData(this->addedData)[k];
+    const bool insertedFlag = StorageType::orderedInsert(history, { v, t });
+    this->statsRecorder.recordInsert(insertedFlag, history.size());
+    if(insertedFlag) {
+        this->touchKey(k);
+    }
+
+    bool firstFlag = true;
+    std::vector<Change> * changes = this->changeRecorder();
+    this->currentData.modify([&](CurrentData & current) {
+        // The second instance is the last use of the arguments and repeats the same change.
+        if(std::exchange(firstFlag, false)) {
+            this->addToCurrentData(current, k, v, t, changes);
+        } else {
+            this->addToCurrentData(current, std::forward<KArg>(k), std::forward<VArg>(v), t, nullptr);
         }
+    });
+    this->publishChanges();
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+template <typename KArg, typename VArg>
+void LWWElementDict<K, V, T, Storage>::insertRemoved(KArg && k, VArg && v, const T & t) {
+    [[maybe_unused]] const auto timer = this->statsRecorder.time(LWWStatsRecorder::Operation::remove);
+    std::lock_guard<LWWMutex> lock(this->mtx);
+    if(this->isCompacted(t)) {
+        return;
     }
+
+    StorageType & removed = this->writableData(this->removedData);
+    const auto removedIter = removed.find(k);
+    const bool newKeyFlag = removedIter == removed.end();
+
+    // Into an empty history the element is always inserted.
+    const bool insertedFlag = newKeyFlag || StorageType::orderedInsert(removedIter->second, { std::forward<VArg>(v), t });
+    this->statsRecorder.recordInsert(insertedFlag, newKeyFlag ? 1 : removedIter->second.size());
+    if(insertedFlag) {
+        this->touchKey(k);
+    }
+    std::vector<Change> * changes = this->changeRecorder();
+    this->currentData.modify([&](CurrentData & current) {
+        this->removeFromCurrentData(current, k, t, std::exchange(changes, nullptr));
+    });
+
+    if(newKeyFlag) {
+        StorageType::orderedInsert(removed[std::forward<KArg>(k)], { std::forward<VArg>(v), t });
+    }
+    this->publishChanges();
 }
 
 
 
-template <typename K, typename V, typename T>
-void LWWElementDict<K, V, T>::removeFromCurrentData(const K & k, const V & v, const T & t) {
-    if(this->currentData.find(k) != this->currentData.end()) {
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+template <typename KArg, typename VArg>
+void LWWElementDict<K, V, T, Storage>::addToCurrentData(
+    CurrentData & current,
+    KArg && k,
+    VArg && v,
+    const T & t,
+    std::vector<Change> * changes
+) {
+    const auto timeCont = this->getLastRemovalTime(k);
+    if(timeCont) {
         // If element's timestamps for insertion and removal are the same, then removal has priority.
-        if(t >= this->currentData[k].second) {
-            this->currentData.erase(k);
+        if(t <= *timeCont) {
+            return;
+        }
+    }
+
+    auto currentIter = current.find(k);
+    if(currentIter == current.end()) {
+        currentIter = current.emplace_hint(currentIter, std::forward<KArg>(k), std::make_pair(std::forward<VArg>(v), t));
+        if(changes) {
+            changes->push_back({ Change::Type::inserted, currentIter->first, currentIter->second.first, t });
+        }
+    } else if(lwwSupersedes(v, t, currentIter->second.first, currentIter->second.second)) {
+        currentIter->second.first = std::forward<VArg>(v);
+        currentIter->second.second = t;
+        if(changes) {
+            changes->push_back({ Change::Type::replaced, currentIter->first, currentIter->second.first, t });
         }
     }
 }
 
 
 
-template <typename K, typename V, typename T>
-void LWWElementDict<K, V, T>::orderedInsert(
-    std::multimap<V, T> & multimap,
-    const std::pair<V, T> & pair
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::removeFromCurrentData(
+    CurrentData & current,
+    const K & k,
+    const T & t,
+    std::vector<Change> * changes
 ) {
-    const auto multimapRange = multimap.equal_range(pair.first);
+    const auto currentIter = current.find(k);
 
-    if(multimapRange.first == multimapRange.second) {
-        multimap.insert(pair);
-    } else {
-        bool insertFlag = true;
-
-        for(auto multimapIter = multimapRange.first; multimapIter != multimapRange.second; ++multimapIter) {
-            if(pair.second < multimapIter->second) {
-                multimap.insert(multimapIter, pair);
-                insertFlag = false;
-                break;
-            } else if(pair.second == multimapIter->second) {
-                insertFlag = false;
-                break;
+    if(currentIter != current.end()) {
+        // If element's timestamps for insertion and removal are the same, then removal has priority.
+        if(t >= currentIter->second.second) {
+            current.erase(currentIter);
+            if(changes) {
+                changes->push_back({ Change::Type::removed, k, std::nullopt, t });
             }
         }
+    }
+}
+
 
-        if(insertFlag) {
-            multimap.insert(multimapRange.second, pair);
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+typename LWWElementDict<K, V, T, Storage>::CurrentData::iterator LWWElementDict<K, V, T, Storage>::updateCurrentData(
+    CurrentData & current,
+    typename CurrentData::iterator cursor,
+    const KeyUpdate & update,
+    std::vector<Change> * changes
+) {
+    cursor = orderedSeek(current, cursor, *update.k);
+    const bool containedFlag = cursor != current.end() && !(*update.k < cursor->first);
+
+    // If element's timestamps for insertion and removal are the same, then removal has priority.
+    if(update.t && !(update.lastRemovalTime && *update.t <= *update.lastRemovalTime)) {
+        if(!containedFlag) {
+            if(changes) {
+                changes->push_back({ Change::Type::inserted, *update.k, *update.v, *update.t });
+            }
+            return std::next(current.emplace_hint(cursor, *update.k, std::make_pair(*update.v, *update.t)));
+        }
+
+        if(lwwSupersedes(*update.v, *update.t, cursor->second.first, cursor->second.second)) {
+            cursor->second = { *update.v, *update.t };
+            if(changes) {
+                changes->push_back({ Change::Type::replaced, *update.k, *update.v, *update.t });
+            }
+        }
+    } else if(update.lastRemovalTime && containedFlag && *update.lastRemovalTime >= cursor->second.second) {
+        if(changes) {
+            changes->push_back({ Change::Type::removed, *update.k, std::nullopt, *update.lastRemovalTime });
         }
+        return current.erase(cursor);
     }
+
+    return containedFlag ? std::next(cursor) : cursor;
 }
 
 
 
-template <typename K, typename V, typename T>
-void LWWElementDict<K, V, T>::mergeData(
-    const bool & addFlag,
-    std::map<K, std::multimap<V, T>> & dataDest,
-    const std::map<K, std::multimap<V, T>> & dataSrc
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::vector<typename LWWElementDict<K, V, T, Storage>::KeyUpdate> LWWElementDict<K, V, T, Storage>::collectKeyUpdates(
+    const ElementRefs & added,
+    const ElementRefs & removed
 ) {
-    for(const auto & [keySrc, multimapSrc] : dataSrc) {
-        auto mapIterDest = dataDest.find(keySrc);
+    std::vector<KeyUpdate> updates;
 
-        if(mapIterDest == dataDest.end()) {
-            dataDest[keySrc] = multimapSrc;
-        } else {
-            for(auto multimapIterSrc = multimapSrc.begin(); multimapIterSrc != multimapSrc.end(); ++multimapIterSrc) {
-                this->orderedInsert(mapIterDest->second, *multimapIterSrc);
-                
-                if(addFlag) {
-                    this->addToCurrentData(keySrc, multimapIterSrc->first, multimapIterSrc->second);
-                } else {
-                    this->removeFromCurrentData(keySrc, multimapIterSrc->first, multimapIterSrc->second);
-                }
+    for(auto addedIter = added.begin(); addedIter != added.end();) {
+        KeyUpdate update;
+        update.k = std::get<0>(*addedIter);
+
+        for(; addedIter != added.end() && std::get<0>(*addedIter) == update.k; ++addedIter) {
+            const auto & [k, v, t] = *addedIter;
+            if(!update.t || lwwSupersedes(*v, *t, *update.v, *update.t)) {
+                update.v = v;
+                update.t = t;
             }
         }
+
+        const auto lastRemovalTime = this->getLastRemovalTime(*update.k);
+        if(lastRemovalTime) {
+            update.lastRemovalTime = *lastRemovalTime;
+        }
+
+        updates.push_back(std::move(update));
+    }
+
+    for(auto removedIter = removed.begin(); removedIter != removed.end();) {
+        KeyUpdate update;
+        update.k = std::get<0>(*removedIter);
+
+        while(removedIter != removed.end() && std::get<0>(*removedIter) == update.k) {
+            ++removedIter;
+        }
+
+        const auto lastRemovalTime = this->getLastRemovalTime(*update.k);
+        if(lastRemovalTime) {
+            update.lastRemovalTime = *lastRemovalTime;
+        }
+
+        updates.push_back(std::move(update));
     }
+
+    return updates;
 }
 
 
 
-template <typename K, typename V, typename T>
-const auto & LWWElementDict<K, V, T>::getAddedData() const {
-    return this->addedData;
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::mergeData(
+    StorageType & dataDest,
+    const StorageType & dataSrc,
+    ElementRefs & inserted
+) {
+    // Already contained elements have been accounted for in currentData.
+    dataDest.merge(dataSrc,
+        [&inserted](const K & k, const V & v, const T & t) {
+            inserted.emplace_back(&k, &v, &t);
+        },
+        [this](const T & t) {
+            return !this->isCompacted(t);
+        }
+    );
 }
 
 
 
-template <typename K, typename V, typename T>
-const auto & LWWElementDict<K, V, T>::getRemovedData() const {
-    return this->removedData;
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::parallelMergeData(
+    StorageType & dataDest,
+    const StorageType & dataSrc,
+    std::vector<ElementRefs> & inserted,
+    LWWThreadPool & pool
+) {
+    // Structural changes happen up front, so ranges only modify histories of their own keys.
+    dataDest.insertMissingKeys(dataSrc);
+
+    const std::size_t rangeCount = std::min(dataSrc.size(), pool.getThreadCount() * 4);
+    std::vector<typename StorageType::const_iterator> bounds;
+    bounds.reserve(rangeCount + 1);
+    auto boundIter = dataSrc.begin();
+    for(std::size_t range = 0; range < rangeCount; ++range) {
+        bounds.push_back(boundIter);
+        std::advance(boundIter, dataSrc.size() / rangeCount + (range < dataSrc.size() % rangeCount ? 1 : 0));
+    }
+    bounds.push_back(dataSrc.end());
+
+    inserted.assign(rangeCount, ElementRefs());
+    pool.parallelFor(rangeCount, [&](const std::size_t & range) {
+        auto & rangeInserted = inserted[range];
+        const auto onInserted = [&rangeInserted](const K & k, const V & v, const T & t) {
+            rangeInserted.emplace_back(&k, &v, &t);
+        };
+        const auto admit = [this](const T & t) {
+            return !this->isCompacted(t);
+        };
+
+        for(auto srcIter = bounds[range]; srcIter != bounds[range + 1]; ++srcIter) {
+            StorageType::mergeHistory(srcIter->first, dataDest.find(srcIter->first)->second, srcIter->second, onInserted, admit);
+        }
+    });
+
+    // Keys whose every element was rejected by the watermark must not stay behind as empty histories.
+    if(this->stableTime) {
+        for(const auto & entry : dataSrc) {
+            const auto destIter = dataDest.find(entry.first);
+            if(destIter->second.empty()) {
+                dataDest.erase(destIter);
+            }
+        }
+    }
 }
 
 
 
-template <typename K, typename V, typename T>
-const auto & LWWElementDict<K, V, T>::getCurrentData() const {
-    return this->currentData;
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::mergeStorages(const StorageType & added, const StorageType & removed) {
+    ElementRefs addedRefs;
+    ElementRefs removedRefs;
+    this->mergeData(this->writableData(this->addedData), added, addedRefs);
+    this->mergeData(this->writableData(this->removedData), removed, removedRefs);
+    this->statsRecorder.recordMerge(addedRefs.size() + removedRefs.size());
+
+    if(addedRefs.empty() && removedRefs.empty()) {
+        return;
+    }
+
+    const auto updates = this->collectKeyUpdates(addedRefs, removedRefs);
+    for(const auto & update : updates) {
+        this->touchKey(*update.k);
+    }
+
+    std::vector<Change> * changes = this->changeRecorder();
+    this->currentData.modify([&](CurrentData & current) {
+        auto cursor = current.begin();
+        for(const auto & update : updates) {
+            cursor = this->updateCurrentData(current, cursor, update, changes);
+        }
+        // The second instance repeats the same changes.
+        changes = nullptr;
+    });
+    this->publishChanges();
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::touchKey(const K & k) {
+    ++this->version;
+
+    const auto [versionIter, inserted] = this->keyVersions.try_emplace(k, this->version);
+    if(!inserted) {
+        this->changeLog.erase(versionIter->second);
+        versionIter->second = this->version;
+    }
+
+    this->changeLog.emplace_hint(this->changeLog.end(), this->version, k);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+typename LWWElementDict<K, V, T, Storage>::StorageType & LWWElementDict<K, V, T, Storage>::writableData(
+    std::shared_ptr<StorageType> & data
+) {
+    // Snapshots are only taken under mtx, so a sole owner stays the sole owner while the caller writes.
+    if(data.use_count() > 1) {
+        data = std::make_shared<StorageType>(*data);
+    }
+    return *data;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+std::vector<typename LWWElementDict<K, V, T, Storage>::Change> * LWWElementDict<K, V, T, Storage>::changeRecorder() {
+    return this->subscribers.empty() ? nullptr : &this->pendingChanges;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::refreshDigestIndex() const {
+    const auto historyDigest = [](const K & k, const History & history, const bool & removedFlag) {
+        std::uint64_t digest = 0;
+        for(const auto & [v, t] : history) {
+            digest += LWWMerkleTree::elementHash(k, v, t, removedFlag);
+        }
+        return digest;
+    };
+
+    if(!this->digestIndex.isBuilt()) {
+        this->digestIndex.clear();
+        for(const auto & [k, history] : *this->addedData) {
+            this->digestIndex.add(k, historyDigest(k, history, false));
+        }
+        for(const auto & [k, history] : *this->removedData) {
+            this->digestIndex.add(k, historyDigest(k, history, true));
+        }
+        this->digestIndex.markBuilt(this->version);
+        return;
+    }
+
+    // Every change of a key's histories is logged under a version newer than the one the index reflects.
+    const auto logEnd = this->changeLog.end();
+    for(auto logIter = this->changeLog.upper_bound(this->digestIndex.getBuiltVersion()); logIter != logEnd; ++logIter) {
+        const K & k = logIter->second;
+        std::uint64_t digest = 0;
+        bool presentFlag = false;
+
+        const auto addedIter = this->addedData->find(k);
+        if(addedIter != this->addedData->end()) {
+            digest += historyDigest(k, addedIter->second, false);
+            presentFlag = true;
+        }
+
+        const auto removedIter = this->removedData->find(k);
+        if(removedIter != this->removedData->end()) {
+            digest += historyDigest(k, removedIter->second, true);
+            presentFlag = true;
+        }
+
+        this->digestIndex.assign(k, digest, presentFlag);
+    }
+    this->digestIndex.markBuilt(this->version);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::publishChanges() {
+    if(this->pendingChanges.empty()) {
+        return;
+    }
+
+    for(auto subscriberIter = this->subscribers.begin(); subscriberIter != this->subscribers.end();) {
+        const auto ring = subscriberIter->lock();
+        if(!ring) {
+            subscriberIter = this->subscribers.erase(subscriberIter);
+            continue;
+        }
+
+        for(const auto & change : this->pendingChanges) {
+            ring->push(change);
+        }
+        ++subscriberIter;
+    }
+
+    this->pendingChanges.clear();
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+bool LWWElementDict<K, V, T, Storage>::isCompacted(const T & t) const {
+    return this->stableTime && t < *this->stableTime;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+const auto & LWWElementDict<K, V, T, Storage>::getAddedData() const {
+    return *this->addedData;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+const auto & LWWElementDict<K, V, T, Storage>::getRemovedData() const {
+    return *this->removedData;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+const auto & LWWElementDict<K, V, T, Storage>::getCurrentData() const {
+    return this->currentData.peek();
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+const std::uint64_t & LWWElementDict<K, V, T, Storage>::getVersion() const {
+    return this->version;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+const std::optional<T> & LWWElementDict<K, V, T, Storage>::getStableTime() const {
+    return this->stableTime;
 }
 
 
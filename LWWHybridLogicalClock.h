@@ -0,0 +1,231 @@
+/*!
+* @file LWWHybridLogicalClock.h
+* @brief Contains hybrid logical clock timestamps and their clock source
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LWWHYBRIDLOGICALCLOCK_H
+#define LWWHYBRIDLOGICALCLOCK_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+
+/*!
+* @struct LWWHybridTimestamp
+* @brief Hybrid logical clock timestamp, usable as timestamp type of a dictionary
+* @details Physical milliseconds since the Unix epoch (48 bits) and a logical counter (16 bits) are packed into a
+* single word, so ordering is one integer comparison in almost all cases. Timestamps of different replicas never
+* compare equal, the id of the issuing replica breaks ties deterministically, and removal only wins ties against
+* adds issued by the same replica for the same event.
+*/
+struct LWWHybridTimestamp {
+    static constexpr unsigned logicalBits = 16; //!< Width of the logical counter
+    static constexpr std::uint64_t logicalMask = (std::uint64_t(1) << logicalBits) - 1; //!< Logical counter bits
+
+    std::uint64_t packed = 0; //!< Physical milliseconds shifted by \a logicalBits , plus logical counter
+    std::uint32_t replicaId = 0; //!< Issuing replica, tiebreaker
+
+
+    /*!
+    * Default constructor, the earliest timestamp
+    */
+    constexpr LWWHybridTimestamp() = default;
+
+
+    /*!
+    * Constructor
+    * @param [in] packed Physical milliseconds shifted by \a logicalBits , plus logical counter
+    * @param [in] replicaId Issuing replica
+    */
+    constexpr LWWHybridTimestamp(const std::uint64_t & packed, const std::uint32_t & replicaId)
+        : packed(packed), replicaId(replicaId) {}
+
+
+    constexpr std::uint64_t getPhysical() const { return this->packed >> logicalBits; }
+    constexpr std::uint64_t getLogical() const { return this->packed & logicalMask; }
+
+
+    friend constexpr bool operator==(const LWWHybridTimestamp & lhs, const LWWHybridTimestamp & rhs) {
+        return lhs.packed == rhs.packed && lhs.replicaId == rhs.replicaId;
+    }
+
+
+    friend constexpr bool operator!=(const LWWHybridTimestamp & lhs, const LWWHybridTimestamp & rhs) {
+        return !(lhs == rhs);
+    }
+
+
+    friend constexpr bool operator<(const LWWHybridTimestamp & lhs, const LWWHybridTimestamp & rhs) {
+        return lhs.packed < rhs.packed || (lhs.packed == rhs.packed && lhs.replicaId < rhs.replicaId);
+    }
+
+
+    friend constexpr bool operator>(const LWWHybridTimestamp & lhs, const LWWHybridTimestamp & rhs) {
+        return rhs < lhs;
+    }
+
+
+    friend constexpr bool operator<=(const LWWHybridTimestamp & lhs, const LWWHybridTimestamp & rhs) {
+        return !(rhs < lhs);
+    }
+
+
+    friend constexpr bool operator>=(const LWWHybridTimestamp & lhs, const LWWHybridTimestamp & rhs) {
+        return !(lhs < rhs);
+    }
+};
+
+
+
+/*!
+* @class LWWClockSkewError
+* @brief Remote timestamp is further ahead of the local physical clock than tolerated
+*/
+class LWWClockSkewError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+
+
+/*!
+* @class LWWHybridLogicalClock
+* @brief Source of hybrid logical clock timestamps of one replica
+* @details Issued timestamps follow the physical clock whenever it is ahead, and otherwise advance the logical counter
+* of the latest timestamp issued or received. Timestamps issued by one clock are strictly increasing even if the
+* physical clock stalls or jumps backwards, and every timestamp issued after receiving a remote one is greater than
+* it, so a write causally following another one always wins regardless of clock skew. A logical counter overflowing
+* within one millisecond carries into the physical part. Lock-free, safe to use concurrently.
+*/
+class LWWHybridLogicalClock {
+private:
+    std::atomic<std::uint64_t> last { 0 }; //!< Packed time of the latest timestamp issued or received
+    std::uint32_t replicaId; //!< Id stamped into issued timestamps
+    std::uint64_t maxOffset; //!< Tolerated lead of received timestamps in milliseconds, 0 for unlimited
+    std::function<std::uint64_t()> physicalClock; //!< Physical time in milliseconds since the Unix epoch
+
+
+public:
+    /*!
+    * Constructor
+    * @param [in] replicaId Id of this replica, unique among replicas
+    * @param [in] maxOffset Largest tolerated lead of received timestamps over the physical clock, 0 for unlimited
+    * @param [in] physicalClock Callable returning physical time in milliseconds since the Unix epoch
+    */
+    explicit LWWHybridLogicalClock(
+        const std::uint32_t & replicaId,
+        const std::chrono::milliseconds & maxOffset = std::chrono::milliseconds(0),
+        std::function<std::uint64_t()> physicalClock = systemMilliseconds
+    );
+
+
+    LWWHybridLogicalClock(const LWWHybridLogicalClock &) = delete;
+    LWWHybridLogicalClock & operator=(const LWWHybridLogicalClock &) = delete;
+
+
+    /*!
+    * Issuing timestamp for a local event.
+    * @return timestamp greater than every timestamp issued or received before
+    */
+    LWWHybridTimestamp now();
+
+
+    /*!
+    * Receiving timestamp of a remote event, then issuing timestamp for the local receive event.
+    * @param [in] remote Received timestamp
+    * @return timestamp greater than \p remote and every timestamp issued or received before
+    * @throw LWWClockSkewError if \p remote leads the physical clock by more than tolerated, the clock is unchanged then
+    */
+    LWWHybridTimestamp update(const LWWHybridTimestamp & remote);
+
+
+    std::uint32_t getReplicaId() const;
+
+
+    /*!
+    * Physical time of \a std::chrono::system_clock .
+    * @return milliseconds since the Unix epoch
+    */
+    static std::uint64_t systemMilliseconds();
+
+
+private:
+    /*!
+    * Advancing \a last past \p floor and the physical clock.
+    * @param [in] floor Packed time the result has to exceed
+    * @return issued timestamp
+    */
+    LWWHybridTimestamp advance(const std::uint64_t & floor);
+};
+
+
+
+inline LWWHybridLogicalClock::LWWHybridLogicalClock(
+    const std::uint32_t & replicaId,
+    const std::chrono::milliseconds & maxOffset,
+    std::function<std::uint64_t()> physicalClock
+) : replicaId(replicaId),
+    maxOffset(static_cast<std::uint64_t>(maxOffset.count())),
+    physicalClock(std::move(physicalClock)) {
+}
+
+
+
+inline LWWHybridTimestamp LWWHybridLogicalClock::now() {
+    return this->advance(0);
+}
+
+
+
+inline LWWHybridTimestamp LWWHybridLogicalClock::update(const LWWHybridTimestamp & remote) {
+    if(this->maxOffset != 0) {
+        const std::uint64_t physical = this->physicalClock();
+        if(remote.getPhysical() > physical + this->maxOffset) {
+            throw LWWClockSkewError("LWW clock: remote timestamp leads by "
+                + std::to_string(remote.getPhysical() - physical) + " ms");
+        }
+    }
+
+    return this->advance(remote.packed);
+}
+
+
+
+inline std::uint32_t LWWHybridLogicalClock::getReplicaId() const {
+    return this->replicaId;
+}
+
+
+
+inline std::uint64_t LWWHybridLogicalClock::systemMilliseconds() {
+    const auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(sinceEpoch).count());
+}
+
+
+
+inline LWWHybridTimestamp LWWHybridLogicalClock::advance(const std::uint64_t & floor) {
+    const std::uint64_t physical = this->physicalClock() << LWWHybridTimestamp::logicalBits;
+    std::uint64_t previous = this->last.load(std::memory_order_relaxed);
+    std::uint64_t next;
+
+    do {
+        // Physical clock ahead of everything seen resets the logical counter, otherwise the counter advances.
+        const std::uint64_t latest = std::max(previous, floor);
+        next = physical > latest ? physical : latest + 1;
+    } while(!this->last.compare_exchange_weak(previous, next, std::memory_order_relaxed));
+
+    return { next, this->replicaId };
+}
+
+
+
+#endif // LWWHYBRIDLOGICALCLOCK_H
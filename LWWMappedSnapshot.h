@@ -0,0 +1,619 @@
+/*!
+* @file LWWMappedSnapshot.h
+* @brief Contains read-only memory-mapped snapshot of CRDT LWW Element Dictionary
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LWWMAPPEDSNAPSHOT_H
+#define LWWMAPPEDSNAPSHOT_H
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "LWWElementDict.h"
+#include "LWWSerialization.h"
+
+
+/*!
+* @class LWWMappedSnapshot
+* @brief Frozen dictionary state queried directly from a memory-mapped file
+* @details The file holds sorted fixed-width record tables: current elements, and for \a addedData and
+* \a removedData a key table referencing ranges of an element table. Opening validates the header only, so it takes
+* constant time regardless of snapshot size, and pages are loaded by the kernel on first access.
+* Lookups binary search the mapped current element table without copying it.
+* @tparam K key, trivially copyable
+* @tparam V value, trivially copyable
+* @tparam T timestamp, trivially copyable
+*/
+template <typename K,
+          typename V,
+          typename T>
+class LWWMappedSnapshot {
+public:
+    /*!
+    * @struct CurrentRecord
+    * @brief Current element of a key
+    */
+    struct CurrentRecord {
+        K key; //!< key
+        V value; //!< value
+        T timestamp; //!< timestamp
+    };
+
+    /*!
+    * @struct KeyRecord
+    * @brief History of a key, a range of the element table
+    */
+    struct KeyRecord {
+        K key; //!< key
+        std::uint64_t first; //!< Index of key's first element
+        std::uint64_t count; //!< Number of key's elements
+    };
+
+    /*!
+    * @struct ElementRecord
+    * @brief History element
+    */
+    struct ElementRecord {
+        V value; //!< value
+        T timestamp; //!< timestamp
+    };
+
+
+private:
+    static constexpr char magic[4] = { 'L', 'W', 'W', 'M' }; //!< Leading bytes of every snapshot file
+    static constexpr std::uint32_t formatVersion = 1; //!< Current format version
+    static constexpr std::uint32_t byteOrderMark = 0x01020304; //!< Detects files written on a different byte order
+    static constexpr std::size_t tableAlignment = 64; //!< Alignment of every table within the file
+    static constexpr bool fixedWidthFlag = std::is_trivially_copyable_v<K>
+                                           && std::is_trivially_copyable_v<V>
+                                           && std::is_trivially_copyable_v<T>; //!< Records are plain bytes
+
+    /*!
+    * @struct Header
+    * @brief Leading block of a snapshot file
+    */
+    struct Header {
+        char magic[4]; //!< Must equal \a LWWMappedSnapshot::magic
+        std::uint32_t formatVersion; //!< Format version
+        std::uint32_t byteOrderMark; //!< Must equal \a LWWMappedSnapshot::byteOrderMark
+        std::uint32_t flags; //!< Bit 0: watermark present
+        std::uint64_t recordSizes[3]; //!< Sizes of current, key and element records
+        std::uint64_t currentCount; //!< Number of current records
+        std::uint64_t addedKeyCount; //!< Number of \a addedData key records
+        std::uint64_t addedElementCount; //!< Number of \a addedData element records
+        std::uint64_t removedKeyCount; //!< Number of \a removedData key records
+        std::uint64_t removedElementCount; //!< Number of \a removedData element records
+        T stableTime; //!< Watermark, valid if flagged
+    };
+
+    /*!
+    * @struct Layout
+    * @brief Offsets of tables within a snapshot file
+    */
+    struct Layout {
+        std::uint64_t current; //!< Current records
+        std::uint64_t addedKeys; //!< \a addedData key records
+        std::uint64_t addedElements; //!< \a addedData element records
+        std::uint64_t removedKeys; //!< \a removedData key records
+        std::uint64_t removedElements; //!< \a removedData element records
+        std::uint64_t end; //!< End of last table
+    };
+
+    const char * mapping = nullptr; //!< Beginning of mapped file
+    std::size_t mappingSize = 0; //!< Size of mapped file
+
+    const Header * header = nullptr; //!< Mapped header
+    const CurrentRecord * current = nullptr; //!< Mapped current records
+    const KeyRecord * addedKeys = nullptr; //!< Mapped \a addedData key records
+    const ElementRecord * addedElements = nullptr; //!< Mapped \a addedData element records
+    const KeyRecord * removedKeys = nullptr; //!< Mapped \a removedData key records
+    const ElementRecord * removedElements = nullptr; //!< Mapped \a removedData element records
+
+
+public:
+    /*!
+    * Mapping snapshot file \p path read-only. Only the header is read.
+    * @param [in] path Snapshot file written by \a write
+    * @throw std::system_error if the file cannot be opened or mapped
+    * @throw LWWFormatError if the file is not a snapshot of this K, V and T
+    */
+    explicit LWWMappedSnapshot(const std::string & path);
+
+
+    LWWMappedSnapshot(const LWWMappedSnapshot &) = delete;
+    LWWMappedSnapshot & operator=(const LWWMappedSnapshot &) = delete;
+
+
+    /*!
+    * Destructor, unmapping the file
+    */
+    virtual ~LWWMappedSnapshot();
+
+
+    /*!
+    * Writing \p dict 's state to snapshot file \p path under the dictionary's lock. The file is written next to
+    * \p path , synced and renamed over it, and the directory is synced after the rename, so neither readers nor a
+    * crash ever leave a partial snapshot at \p path .
+    * @param [in] dict Source dictionary
+    * @param [in] path Target file
+    * @throw std::system_error if the file cannot be written
+    */
+    template <template <typename, typename, typename> class Storage>
+    static void write(const LWWElementDict<K, V, T, Storage> & dict, const std::string & path);
+
+
+    /*!
+    * Retrieving current value for specified map's key \p k from the mapping.
+    * @param [in] k key
+    * @return container with corresponding value if exists, empty otherwise
+    * @retval std::optional<V> value type within std::optional container
+    */
+    const std::optional<const V> getValueByKey(const K & k) const;
+
+
+    /*!
+    * Copying mapped \a addedData histories into a storage, validated like \a LWWSerialization::deserialize does.
+    * @return storage holding every added element
+    * @throw LWWFormatError if a key record references elements outside the element table, keys are not strictly
+    * ascending or a history is not in strictly ascending less order
+    */
+    template <typename StorageType>
+    StorageType loadAddedData() const;
+
+
+    /*!
+    * Copying mapped \a removedData histories into a storage, validated like \a LWWSerialization::deserialize does.
+    * @return storage holding every removed element
+    * @throw LWWFormatError if a key record references elements outside the element table, keys are not strictly
+    * ascending or a history is not in strictly ascending less order
+    */
+    template <typename StorageType>
+    StorageType loadRemovedData() const;
+
+
+    const CurrentRecord * begin() const;
+    const CurrentRecord * end() const;
+    std::size_t size() const;
+    const std::optional<T> getStableTime() const;
+
+
+private:
+    /*!
+    * Computing table offsets from record counts.
+    * @param [in] header Header holding record counts
+    * @return table offsets
+    */
+    static Layout layout(const Header & header);
+
+
+    /*!
+    * Rounding \p offset up to \a tableAlignment .
+    * @param [in] offset File offset
+    * @return aligned offset
+    */
+    static std::uint64_t align(const std::uint64_t & offset);
+
+
+    template <typename StorageType>
+    static StorageType loadStorage(const KeyRecord * keys,
+                                   const std::uint64_t & keyCount,
+                                   const ElementRecord * elements,
+                                   const std::uint64_t & elementCount);
+
+
+    template <typename StorageType>
+    static void writeStorage(std::vector<KeyRecord> & keys,
+                             std::vector<ElementRecord> & elements,
+                             const StorageType & storage);
+};
+
+
+
+template <typename K, typename V, typename T>
+LWWMappedSnapshot<K, V, T>::LWWMappedSnapshot(
+    const std::string & path
+) {
+    static_assert(fixedWidthFlag, "LWWMappedSnapshot requires fixed-width, trivially copyable K, V and T");
+
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW mapped snapshot: cannot open " + path);
+    }
+
+    struct stat status;
+    if(::fstat(fd, &status) != 0) {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "LWW mapped snapshot: cannot stat " + path);
+    }
+
+    this->mappingSize = static_cast<std::size_t>(status.st_size);
+    if(this->mappingSize < sizeof(Header)) {
+        ::close(fd);
+        throw LWWFormatError("LWW mapped snapshot: file too short");
+    }
+
+    void * address = ::mmap(nullptr, this->mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    const int error = errno;
+    ::close(fd);
+    if(address == MAP_FAILED) {
+        throw std::system_error(error, std::generic_category(), "LWW mapped snapshot: cannot map " + path);
+    }
+    this->mapping = static_cast<const char *>(address);
+
+    const auto reject = [this](const char * reason) {
+        ::munmap(const_cast<char *>(this->mapping), this->mappingSize);
+        throw LWWFormatError(std::string("LWW mapped snapshot: ") + reason);
+    };
+
+    this->header = reinterpret_cast<const Header *>(this->mapping);
+    if(std::memcmp(this->header->magic, magic, sizeof(magic)) != 0) {
+        reject("bad magic");
+    }
+    if(this->header->formatVersion != formatVersion) {
+        reject("unsupported format version");
+    }
+    if(this->header->byteOrderMark != byteOrderMark) {
+        reject("written on a host of different byte order");
+    }
+    if(this->header->recordSizes[0] != sizeof(CurrentRecord)
+       || this->header->recordSizes[1] != sizeof(KeyRecord)
+       || this->header->recordSizes[2] != sizeof(ElementRecord)) {
+        reject("record sizes do not match K, V and T");
+    }
+
+    // Counts larger than the file would overflow offset computation.
+    const std::uint64_t counts[] = {
+        this->header->currentCount, this->header->addedKeyCount, this->header->addedElementCount,
+        this->header->removedKeyCount, this->header->removedElementCount
+    };
+    for(const auto & count : counts) {
+        if(count > this->mappingSize) {
+            reject("record count exceeds file");
+        }
+    }
+
+    const Layout offsets = layout(*this->header);
+    if(offsets.end > this->mappingSize) {
+        reject("tables exceed file");
+    }
+
+    this->current = reinterpret_cast<const CurrentRecord *>(this->mapping + offsets.current);
+    this->addedKeys = reinterpret_cast<const KeyRecord *>(this->mapping + offsets.addedKeys);
+    this->addedElements = reinterpret_cast<const ElementRecord *>(this->mapping + offsets.addedElements);
+    this->removedKeys = reinterpret_cast<const KeyRecord *>(this->mapping + offsets.removedKeys);
+    this->removedElements = reinterpret_cast<const ElementRecord *>(this->mapping + offsets.removedElements);
+}
+
+
+
+template <typename K, typename V, typename T>
+LWWMappedSnapshot<K, V, T>::~LWWMappedSnapshot() {
+    ::munmap(const_cast<char *>(this->mapping), this->mappingSize);
+}
+
+
+
+template <typename K, typename V, typename T>
+template <template <typename, typename, typename> class Storage>
+void LWWMappedSnapshot<K, V, T>::write(const LWWElementDict<K, V, T, Storage> & dict, const std::string & path) {
+    static_assert(fixedWidthFlag, "LWWMappedSnapshot requires fixed-width, trivially copyable K, V and T");
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.formatVersion = formatVersion;
+    header.byteOrderMark = byteOrderMark;
+    header.recordSizes[0] = sizeof(CurrentRecord);
+    header.recordSizes[1] = sizeof(KeyRecord);
+    header.recordSizes[2] = sizeof(ElementRecord);
+
+    std::vector<CurrentRecord> currentRecords;
+    std::vector<KeyRecord> addedKeyRecords;
+    std::vector<ElementRecord> addedElementRecords;
+    std::vector<KeyRecord> removedKeyRecords;
+    std::vector<ElementRecord> removedElementRecords;
+
+    {
+        std::lock_guard<LWWMutex> lock(dict.mtx);
+
+        if(dict.stableTime) {
+            header.flags = 1;
+            header.stableTime = *dict.stableTime;
+        }
+
+        const auto & currentData = dict.currentData.peek();
+        currentRecords.resize(currentData.size());
+        std::memset(static_cast<void *>(currentRecords.data()), 0, currentRecords.size() * sizeof(CurrentRecord));
+        auto recordIter = currentRecords.begin();
+        for(const auto & [k, element] : currentData) {
+            recordIter->key = k;
+            recordIter->value = element.first;
+            recordIter->timestamp = element.second;
+            ++recordIter;
+        }
+
+        writeStorage(addedKeyRecords, addedElementRecords, *dict.addedData);
+        writeStorage(removedKeyRecords, removedElementRecords, *dict.removedData);
+    }
+
+    header.currentCount = currentRecords.size();
+    header.addedKeyCount = addedKeyRecords.size();
+    header.addedElementCount = addedElementRecords.size();
+    header.removedKeyCount = removedKeyRecords.size();
+    header.removedElementCount = removedElementRecords.size();
+    const Layout offsets = layout(header);
+
+    const std::string temporaryPath = path + ".tmp";
+    const int fd = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW mapped snapshot: cannot create " + temporaryPath);
+    }
+
+    const auto fail = [fd, &temporaryPath](const std::string & action) {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "LWW mapped snapshot: cannot " + action + " " + temporaryPath);
+    };
+
+    std::uint64_t position = 0;
+    const auto writeTable = [&](const std::uint64_t & offset, const void * data, const std::size_t & size) {
+        static const char padding[tableAlignment] = {};
+        const std::pair<const char *, std::size_t> chunks[] = {
+            { padding, static_cast<std::size_t>(offset - position) },
+            { static_cast<const char *>(data), size }
+        };
+
+        for(auto [bytes, remaining] : chunks) {
+            while(remaining != 0) {
+                const ssize_t count = ::write(fd, bytes, remaining);
+                if(count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if(count < 0) {
+                    fail("write");
+                }
+                bytes += count;
+                remaining -= static_cast<std::size_t>(count);
+            }
+        }
+        position = offset + size;
+    };
+
+    writeTable(0, &header, sizeof(header));
+    writeTable(offsets.current, currentRecords.data(), currentRecords.size() * sizeof(CurrentRecord));
+    writeTable(offsets.addedKeys, addedKeyRecords.data(), addedKeyRecords.size() * sizeof(KeyRecord));
+    writeTable(offsets.addedElements, addedElementRecords.data(), addedElementRecords.size() * sizeof(ElementRecord));
+    writeTable(offsets.removedKeys, removedKeyRecords.data(), removedKeyRecords.size() * sizeof(KeyRecord));
+    writeTable(offsets.removedElements, removedElementRecords.data(), removedElementRecords.size() * sizeof(ElementRecord));
+
+    // Data has to be durable before the rename can be, otherwise a crash may leave the name pointing at garbage.
+    if(::fdatasync(fd) != 0) {
+        fail("sync");
+    }
+    if(::close(fd) != 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW mapped snapshot: cannot close " + temporaryPath);
+    }
+
+    if(std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW mapped snapshot: cannot rename to " + path);
+    }
+
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    if(directory.empty()) {
+        directory = ".";
+    }
+    const int directoryFd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(directoryFd < 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW mapped snapshot: cannot open " + directory.string());
+    }
+    const int result = ::fsync(directoryFd);
+    const int error = errno;
+    ::close(directoryFd);
+    if(result != 0) {
+        throw std::system_error(error, std::generic_category(), "LWW mapped snapshot: cannot sync " + directory.string());
+    }
+}
+
+
+
+template <typename K, typename V, typename T>
+const std::optional<const V> LWWMappedSnapshot<K, V, T>::getValueByKey(const K & k) const {
+    const CurrentRecord * record = std::lower_bound(this->begin(), this->end(), k,
+        [](const CurrentRecord & lhs, const K & rhs) {
+            return lhs.key < rhs;
+        }
+    );
+
+    if(record != this->end() && !(k < record->key)) {
+        return { record->value };
+    } else {
+        return {};
+    }
+}
+
+
+
+template <typename K, typename V, typename T>
+template <typename StorageType>
+StorageType LWWMappedSnapshot<K, V, T>::loadAddedData() const {
+    return loadStorage<StorageType>(this->addedKeys, this->header->addedKeyCount,
+                                    this->addedElements, this->header->addedElementCount);
+}
+
+
+
+template <typename K, typename V, typename T>
+template <typename StorageType>
+StorageType LWWMappedSnapshot<K, V, T>::loadRemovedData() const {
+    return loadStorage<StorageType>(this->removedKeys, this->header->removedKeyCount,
+                                    this->removedElements, this->header->removedElementCount);
+}
+
+
+
+template <typename K, typename V, typename T>
+const typename LWWMappedSnapshot<K, V, T>::CurrentRecord * LWWMappedSnapshot<K, V, T>::begin() const {
+    return this->current;
+}
+
+
+
+template <typename K, typename V, typename T>
+const typename LWWMappedSnapshot<K, V, T>::CurrentRecord * LWWMappedSnapshot<K, V, T>::end() const {
+    return this->current + this->header->currentCount;
+}
+
+
+
+template <typename K, typename V, typename T>
+std::size_t LWWMappedSnapshot<K, V, T>::size() const {
+    return static_cast<std::size_t>(this->header->currentCount);
+}
+
+
+
+template <typename K, typename V, typename T>
+const std::optional<T> LWWMappedSnapshot<K, V, T>::getStableTime() const {
+    if(this->header->flags & 1u) {
+        return this->header->stableTime;
+    } else {
+        return {};
+    }
+}
+
+
+
+template <typename K, typename V, typename T>
+typename LWWMappedSnapshot<K, V, T>::Layout LWWMappedSnapshot<K, V, T>::layout(const Header & header) {
+    Layout offsets;
+    offsets.current = align(sizeof(Header));
+    offsets.addedKeys = align(offsets.current + header.currentCount * sizeof(CurrentRecord));
+    offsets.addedElements = align(offsets.addedKeys + header.addedKeyCount * sizeof(KeyRecord));
+    offsets.removedKeys = align(offsets.addedElements + header.addedElementCount * sizeof(ElementRecord));
+    offsets.removedElements = align(offsets.removedKeys + header.removedKeyCount * sizeof(KeyRecord));
+    offsets.end = offsets.removedElements + header.removedElementCount * sizeof(ElementRecord);
+    return offsets;
+}
+
+
+
+template <typename K, typename V, typename T>
+std::uint64_t LWWMappedSnapshot<K, V, T>::align(const std::uint64_t & offset) {
+    return (offset + tableAlignment - 1) / tableAlignment * tableAlignment;
+}
+
+
+
+template <typename K, typename V, typename T>
+template <typename StorageType>
+StorageType LWWMappedSnapshot<K, V, T>::loadStorage(
+    const KeyRecord * keys,
+    const std::uint64_t & keyCount,
+    const ElementRecord * elements,
+    const std::uint64_t & elementCount
+) {
+    StorageType storage;
+
+    for(const KeyRecord * key = keys; key != keys + keyCount; ++key) {
+        if(key->first > elementCount || key->count > elementCount - key->first) {
+            throw LWWFormatError("LWW mapped snapshot: key record exceeds element table");
+        }
+        // Key tables are binary searched, so they have to be strictly ascending.
+        if(key != keys && !((key - 1)->key < key->key)) {
+            throw LWWFormatError("LWW mapped snapshot: key table out of order or holding duplicates");
+        }
+
+        auto & history = LWWSerialization::loadKey(storage, key->key);
+        for(const ElementRecord * element = elements + key->first; element != elements + key->first + key->count; ++element) {
+            LWWSerialization::loadElement<StorageType>(history, element->value, element->timestamp);
+        }
+        LWWSerialization::checkHistory<StorageType>(history, key->count);
+    }
+
+    return storage;
+}
+
+
+
+template <typename K, typename V, typename T>
+template <typename StorageType>
+void LWWMappedSnapshot<K, V, T>::writeStorage(
+    std::vector<KeyRecord> & keys,
+    std::vector<ElementRecord> & elements,
+    const StorageType & storage
+) {
+    // Unordered storages are written sorted by key as well, so every key table can be binary searched.
+    std::vector<const typename StorageType::value_type *> entries;
+    entries.reserve(storage.size());
+    for(const auto & entry : storage) {
+        entries.push_back(&entry);
+    }
+    const auto keyLess = [](const auto * lhs, const auto * rhs) {
+        return lhs->first < rhs->first;
+    };
+    if(!std::is_sorted(entries.begin(), entries.end(), keyLess)) {
+        std::sort(entries.begin(), entries.end(), keyLess);
+    }
+
+    for(const auto * entry : entries) {
+        KeyRecord key;
+        std::memset(&key, 0, sizeof(key));
+        key.key = entry->first;
+        key.first = elements.size();
+
+        for(const auto & [v, t] : entry->second) {
+            ElementRecord element;
+            std::memset(&element, 0, sizeof(element));
+            element.value = v;
+            element.timestamp = t;
+            elements.push_back(element);
+        }
+
+        key.count = elements.size() - key.first;
+        keys.push_back(key);
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage>
+void LWWElementDict<K, V, T, Storage>::mergeWith(const LWWMappedSnapshot<K, V, T> & snapshot) {
+    [[maybe_unused]] const auto timer = this->statsRecorder.time(LWWStatsRecorder::Operation::merge);
+    const auto added = snapshot.template loadAddedData<StorageType>();
+    const auto removed = snapshot.template loadRemovedData<StorageType>();
+
+    {
+        std::lock_guard<LWWMutex> lock(this->mtx);
+        this->mergeStorages(added, removed);
+    }
+
+    // Merging does not carry the watermark, what the writer compacted away is discarded here as well.
+    const auto stableTime = snapshot.getStableTime();
+    if(stableTime) {
+        this->compact(*stableTime);
+    }
+}
+
+
+
+#endif // LWWMAPPEDSNAPSHOT_H
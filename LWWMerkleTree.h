@@ -0,0 +1,462 @@
+/*!
+* @file LWWMerkleTree.h
+* @brief Contains range-hash trees digesting dictionary state for anti-entropy between replicas
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LWWMERKLETREE_H
+#define LWWMERKLETREE_H
+
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "LWWHybridLogicalClock.h"
+#include "LWWSharedValue.h"
+
+
+/*!
+* @struct LWWDigestHash
+* @brief Hash of keys, values and timestamps digested into a \a LWWMerkleTree . Specialize for user types.
+* @details Digests are only comparable between replicas hashing equally, i.e. built from the same code. Defaults to
+* \a std::hash , time points, durations, \a LWWHybridTimestamp and \a LWWSharedValue are provided.
+* @tparam X hashed type
+*/
+template <typename X, typename Enable = void>
+struct LWWDigestHash {
+    std::uint64_t operator()(const X & x) const {
+        return static_cast<std::uint64_t>(std::hash<X>()(x));
+    }
+};
+
+
+
+template <typename Rep, typename Period>
+struct LWWDigestHash<std::chrono::duration<Rep, Period>> {
+    std::uint64_t operator()(const std::chrono::duration<Rep, Period> & duration) const {
+        return LWWDigestHash<Rep>()(duration.count());
+    }
+};
+
+
+
+template <typename Clock, typename Duration>
+struct LWWDigestHash<std::chrono::time_point<Clock, Duration>> {
+    std::uint64_t operator()(const std::chrono::time_point<Clock, Duration> & timePoint) const {
+        return LWWDigestHash<Duration>()(timePoint.time_since_epoch());
+    }
+};
+
+
+
+template <>
+struct LWWDigestHash<LWWHybridTimestamp> {
+    std::uint64_t operator()(const LWWHybridTimestamp & timestamp) const {
+        return timestamp.packed ^ (std::uint64_t(timestamp.replicaId) << 32 | timestamp.replicaId);
+    }
+};
+
+
+
+template <typename V>
+struct LWWDigestHash<LWWSharedValue<V>> {
+    std::uint64_t operator()(const LWWSharedValue<V> & value) const {
+        return LWWDigestHash<V>()(value.get());
+    }
+};
+
+
+
+/*!
+* Scrambling \p h so that every input bit affects every output bit (finalizer of SplitMix64).
+* @param [in] h Hash
+* @return mixed hash
+*/
+inline std::uint64_t lwwMixHash(std::uint64_t h) {
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+
+
+/*!
+* @struct LWWKeyRange
+* @brief Range of key buckets [ \a first , \a last ) at resolution \a LWWMerkleTree::maxDepth
+*/
+struct LWWKeyRange {
+    std::uint32_t first; //!< First bucket of the range
+    std::uint32_t last; //!< Bucket following the range
+
+
+    friend bool operator==(const LWWKeyRange & lhs, const LWWKeyRange & rhs) {
+        return lhs.first == rhs.first && lhs.last == rhs.last;
+    }
+
+
+    friend bool operator!=(const LWWKeyRange & lhs, const LWWKeyRange & rhs) {
+        return !(lhs == rhs);
+    }
+};
+
+
+
+/*!
+* @class LWWMerkleTree
+* @brief Digest of a dictionary's added and removed elements as a complete binary tree of key range hashes
+* @details Keys are hashed into 2^ \a maxDepth buckets. Every element contributes its hash to the bucket of its key,
+* a bucket's hash is the sum of its elements' hashes and every node's hash the sum of its children's. Replicas holding
+* the same elements therefore have equal trees regardless of the order elements arrived in, and comparing trees top
+* down finds the buckets whose elements differ without looking into equal subtrees.
+*/
+class LWWMerkleTree {
+public:
+    static constexpr unsigned maxDepth = 14; //!< Resolution of key buckets
+
+
+private:
+    unsigned depth; //!< Number of levels below the root
+    std::vector<std::uint64_t> nodes; //!< Node hashes in level order, children of node i at 2i+1 and 2i+2
+
+
+public:
+    /*!
+    * Constructor, aggregating bucket hashes into a tree
+    * @param [in] depth Number of levels below the root, at most \a maxDepth
+    * @param [in] bucketHashes Hash of every bucket at resolution \a maxDepth
+    * @throw std::invalid_argument if \p depth exceeds \a maxDepth or \p bucketHashes do not cover every bucket
+    */
+    LWWMerkleTree(const unsigned & depth, const std::vector<std::uint64_t> & bucketHashes);
+
+
+    /*!
+    * Finding key ranges whose elements differ between this tree and \p other .
+    * @param [in] other Tree of another replica
+    * @return disjoint ranges in ascending order, adjacent ranges coalesced, empty if the trees are equal
+    * @throw std::invalid_argument if depths differ
+    */
+    std::vector<LWWKeyRange> diff(const LWWMerkleTree & other) const;
+
+
+    std::uint64_t getRootHash() const;
+    const unsigned & getDepth() const;
+    const std::vector<std::uint64_t> & getNodes() const;
+
+
+    /*!
+    * Bucket of key \p k .
+    * @param [in] k key
+    * @return bucket at resolution \a maxDepth
+    */
+    template <typename K>
+    static std::uint32_t bucketOf(const K & k);
+
+
+    /*!
+    * Hash of one element, contributed to the bucket of its key.
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    * @param [in] removedFlag Whether the element is a removal
+    * @return element hash
+    */
+    template <typename K, typename V, typename T>
+    static std::uint64_t elementHash(const K & k, const V & v, const T & t, const bool & removedFlag);
+
+
+private:
+    /*!
+    * Collecting differing leaves below node \p index in ascending order.
+    * @param [in] other Tree of another replica
+    * @param [in] index Node index
+    * @param [in,out] ranges Differing ranges
+    */
+    void collectDifferences(const LWWMerkleTree & other, const std::size_t & index, std::vector<LWWKeyRange> & ranges) const;
+};
+
+
+
+/*!
+* @class LWWDigestIndex
+* @brief Per-key digests of a dictionary and bucket hashes of its \a LWWMerkleTree , kept by the dictionary
+* @details Keys are ordered by bucket first, so keys of a bucket range are found without visiting other keys.
+* @tparam K key
+*/
+template <typename K>
+class LWWDigestIndex {
+private:
+    /*!
+    * @struct BucketOrder
+    * @brief Ordering of (bucket, key) entries, also comparable with a bare bucket
+    */
+    struct BucketOrder {
+        using is_transparent = void;
+
+        bool operator()(const std::pair<std::uint32_t, K> & lhs, const std::pair<std::uint32_t, K> & rhs) const {
+            return lhs.first < rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+        }
+
+        bool operator()(const std::pair<std::uint32_t, K> & lhs, const std::uint32_t & bucket) const {
+            return lhs.first < bucket;
+        }
+
+        bool operator()(const std::uint32_t & bucket, const std::pair<std::uint32_t, K> & rhs) const {
+            return bucket < rhs.first;
+        }
+    };
+
+    std::map<std::pair<std::uint32_t, K>, std::uint64_t, BucketOrder> keyDigests; //!< Digest per (bucket, key)
+    std::vector<std::uint64_t> bucketHashes; //!< Sum of key digests per bucket, empty until built
+    std::uint64_t builtVersion = 0; //!< Local version of the dictionary the index reflects
+
+
+public:
+    bool isBuilt() const;
+    const std::uint64_t & getBuiltVersion() const;
+    const std::vector<std::uint64_t> & getBucketHashes() const;
+
+
+    /*!
+    * Discarding every digest, the index has to be built again.
+    */
+    void reset();
+
+
+    /*!
+    * Starting to build the index from scratch.
+    */
+    void clear();
+
+
+    /*!
+    * Adding \p digest to key \p k 's digest.
+    * @param [in] k key
+    * @param [in] digest Added digest
+    */
+    void add(const K & k, const std::uint64_t & digest);
+
+
+    /*!
+    * Replacing key \p k 's digest.
+    * @param [in] k key
+    * @param [in] digest New digest
+    * @param [in] presentFlag Whether \p k still has any history, its digest is dropped otherwise
+    */
+    void assign(const K & k, const std::uint64_t & digest, const bool & presentFlag);
+
+
+    /*!
+    * Marking the index as reflecting local version \p version .
+    * @param [in] version Local version of the dictionary
+    */
+    void markBuilt(const std::uint64_t & version);
+
+
+    /*!
+    * Invoking \p visitor on every key within \p range in bucket order.
+    * @param [in] range Bucket range
+    * @param [in] visitor Callable accepting const key reference
+    */
+    template <typename F>
+    void forEachKey(const LWWKeyRange & range, F && visitor) const;
+};
+
+
+
+inline LWWMerkleTree::LWWMerkleTree(
+    const unsigned & depth,
+    const std::vector<std::uint64_t> & bucketHashes
+) : depth(depth) {
+    if(depth > maxDepth) {
+        throw std::invalid_argument("LWW Merkle tree: depth exceeds " + std::to_string(maxDepth));
+    }
+    if(bucketHashes.size() != std::size_t(1) << maxDepth) {
+        throw std::invalid_argument("LWW Merkle tree: bucket hashes do not cover every bucket");
+    }
+
+    const std::size_t leafCount = std::size_t(1) << depth;
+    const std::size_t bucketsPerLeaf = bucketHashes.size() / leafCount;
+    this->nodes.assign(2 * leafCount - 1, 0);
+
+    for(std::size_t bucket = 0; bucket < bucketHashes.size(); ++bucket) {
+        this->nodes[leafCount - 1 + bucket / bucketsPerLeaf] += bucketHashes[bucket];
+    }
+    for(std::size_t index = leafCount - 1; index-- > 0;) {
+        this->nodes[index] = this->nodes[2 * index + 1] + this->nodes[2 * index + 2];
+    }
+}
+
+
+
+inline std::vector<LWWKeyRange> LWWMerkleTree::diff(const LWWMerkleTree & other) const {
+    if(this->depth != other.depth) {
+        throw std::invalid_argument("LWW Merkle tree: depths differ");
+    }
+
+    std::vector<LWWKeyRange> ranges;
+    this->collectDifferences(other, 0, ranges);
+    return ranges;
+}
+
+
+
+inline std::uint64_t LWWMerkleTree::getRootHash() const {
+    return this->nodes.front();
+}
+
+
+
+inline const unsigned & LWWMerkleTree::getDepth() const {
+    return this->depth;
+}
+
+
+
+inline const std::vector<std::uint64_t> & LWWMerkleTree::getNodes() const {
+    return this->nodes;
+}
+
+
+
+template <typename K>
+std::uint32_t LWWMerkleTree::bucketOf(const K & k) {
+    return static_cast<std::uint32_t>(lwwMixHash(LWWDigestHash<K>()(k)) >> (64 - maxDepth));
+}
+
+
+
+template <typename K, typename V, typename T>
+std::uint64_t LWWMerkleTree::elementHash(const K & k, const V & v, const T & t, const bool & removedFlag) {
+    std::uint64_t h = lwwMixHash(LWWDigestHash<K>()(k));
+    h = lwwMixHash(h ^ LWWDigestHash<V>()(v));
+    h = lwwMixHash(h ^ LWWDigestHash<T>()(t));
+    return lwwMixHash(h ^ (removedFlag ? 0x9E3779B97F4A7C15ull : 0));
+}
+
+
+
+inline void LWWMerkleTree::collectDifferences(
+    const LWWMerkleTree & other,
+    const std::size_t & index,
+    std::vector<LWWKeyRange> & ranges
+) const {
+    if(this->nodes[index] == other.nodes[index]) {
+        return;
+    }
+
+    const std::size_t leafCount = std::size_t(1) << this->depth;
+    if(index < leafCount - 1) {
+        this->collectDifferences(other, 2 * index + 1, ranges);
+        this->collectDifferences(other, 2 * index + 2, ranges);
+        return;
+    }
+
+    const std::uint32_t bucketsPerLeaf = std::uint32_t(1) << (maxDepth - this->depth);
+    const std::uint32_t first = static_cast<std::uint32_t>(index - (leafCount - 1)) * bucketsPerLeaf;
+    if(!ranges.empty() && ranges.back().last == first) {
+        ranges.back().last += bucketsPerLeaf;
+    } else {
+        ranges.push_back({ first, first + bucketsPerLeaf });
+    }
+}
+
+
+
+template <typename K>
+bool LWWDigestIndex<K>::isBuilt() const {
+    return !this->bucketHashes.empty();
+}
+
+
+
+template <typename K>
+const std::uint64_t & LWWDigestIndex<K>::getBuiltVersion() const {
+    return this->builtVersion;
+}
+
+
+
+template <typename K>
+const std::vector<std::uint64_t> & LWWDigestIndex<K>::getBucketHashes() const {
+    return this->bucketHashes;
+}
+
+
+
+template <typename K>
+void LWWDigestIndex<K>::reset() {
+    this->keyDigests.clear();
+    this->bucketHashes.clear();
+    this->bucketHashes.shrink_to_fit();
+    this->builtVersion = 0;
+}
+
+
+
+template <typename K>
+void LWWDigestIndex<K>::clear() {
+    this->keyDigests.clear();
+    this->bucketHashes.assign(std::size_t(1) << LWWMerkleTree::maxDepth, 0);
+    this->builtVersion = 0;
+}
+
+
+
+template <typename K>
+void LWWDigestIndex<K>::add(const K & k, const std::uint64_t & digest) {
+    const std::uint32_t bucket = LWWMerkleTree::bucketOf(k);
+    this->keyDigests[{ bucket, k }] += digest;
+    this->bucketHashes[bucket] += digest;
+}
+
+
+
+template <typename K>
+void LWWDigestIndex<K>::assign(const K & k, const std::uint64_t & digest, const bool & presentFlag) {
+    const std::uint32_t bucket = LWWMerkleTree::bucketOf(k);
+    auto digestIter = this->keyDigests.find(std::make_pair(bucket, k));
+
+    if(digestIter != this->keyDigests.end()) {
+        this->bucketHashes[bucket] -= digestIter->second;
+        if(!presentFlag) {
+            this->keyDigests.erase(digestIter);
+            return;
+        }
+        digestIter->second = digest;
+    } else if(!presentFlag) {
+        return;
+    } else {
+        this->keyDigests.emplace(std::make_pair(bucket, k), digest);
+    }
+
+    this->bucketHashes[bucket] += digest;
+}
+
+
+
+template <typename K>
+void LWWDigestIndex<K>::markBuilt(const std::uint64_t & version) {
+    this->builtVersion = version;
+}
+
+
+
+template <typename K>
+template <typename F>
+void LWWDigestIndex<K>::forEachKey(const LWWKeyRange & range, F && visitor) const {
+    const auto last = this->keyDigests.lower_bound(range.last);
+    for(auto digestIter = this->keyDigests.lower_bound(range.first); digestIter != last; ++digestIter) {
+        visitor(digestIter->first.second);
+    }
+}
+
+
+
+#endif // LWWMERKLETREE_H
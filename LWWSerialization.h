@@ -0,0 +1,691 @@
+/*!
+* @file LWWSerialization.h
+* @brief Contains binary snapshot format of CRDT LWW Element Dictionary
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LWWSERIALIZATION_H
+#define LWWSERIALIZATION_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "LWWElementDict.h"
+#include "LWWHybridLogicalClock.h"
+#include "LWWSharedValue.h"
+
+
+/*!
+* @class LWWFormatError
+* @brief Thrown when a snapshot is truncated, malformed or written in an unsupported format
+*/
+class LWWFormatError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+
+
+/*!
+* @class LWWWriter
+* @brief Appends raw bytes to a buffer
+*/
+class LWWWriter {
+private:
+    std::vector<char> & buffer; //!< Target buffer
+
+
+public:
+    /*!
+    * Constructor
+    * @param [in,out] buffer Target buffer, written bytes are appended
+    */
+    explicit LWWWriter(std::vector<char> & buffer);
+
+
+    /*!
+    * Appending \p size bytes starting at \p data .
+    * @param [in] data Source bytes
+    * @param [in] size Number of bytes
+    */
+    void write(const void * data, const std::size_t & size);
+};
+
+
+
+/*!
+* @class LWWReader
+* @brief Consumes raw bytes of a buffer, never reading past its end
+*/
+class LWWReader {
+private:
+    const char * cursor; //!< Next unread byte
+    const char * end; //!< End of buffer
+
+
+public:
+    /*!
+    * Constructor
+    * @param [in] data Beginning of buffer
+    * @param [in] size Size of buffer in bytes
+    */
+    LWWReader(const char * data, const std::size_t & size);
+
+
+    /*!
+    * Copying next \p size bytes into \p data .
+    * @param [out] data Destination
+    * @param [in] size Number of bytes
+    * @throw LWWFormatError if fewer than \p size bytes remain
+    */
+    void read(void * data, const std::size_t & size);
+
+
+    /*!
+    * Consuming next \p size bytes without copying.
+    * @param [in] size Number of bytes
+    * @return beginning of consumed bytes, valid as long as the buffer
+    * @throw LWWFormatError if fewer than \p size bytes remain
+    */
+    const char * skip(const std::size_t & size);
+
+
+    /*!
+    * Number of unread bytes.
+    * @return remaining size
+    */
+    std::size_t remaining() const;
+};
+
+
+
+/*!
+* @struct LWWCodec
+* @brief Binary encoding of a key, value or timestamp type. Specialize for user types.
+* @details A specialization provides static \a encode(LWWWriter &, const X &) and \a decode(LWWReader &) returning X.
+* Arithmetic and enumeration types, std::basic_string, std::chrono durations and time points,
+* \a LWWHybridTimestamp and \a LWWSharedValue are provided.
+* @tparam X encoded type
+*/
+template <typename X, typename Enable = void>
+struct LWWCodec;
+
+
+
+/*!
+* @struct LWWCodec
+* @brief Arithmetic and enumeration types, stored as their native object representation
+*/
+template <typename X>
+struct LWWCodec<X, std::enable_if_t<std::is_arithmetic_v<X> || std::is_enum_v<X>>> {
+    static void encode(LWWWriter & writer, const X & x) {
+        writer.write(&x, sizeof(X));
+    }
+
+    static X decode(LWWReader & reader) {
+        X x;
+        reader.read(&x, sizeof(X));
+        return x;
+    }
+};
+
+
+
+/*!
+* @struct LWWCodec
+* @brief Strings, stored as 64-bit length followed by characters
+*/
+template <typename Char, typename Traits, typename Alloc>
+struct LWWCodec<std::basic_string<Char, Traits, Alloc>> {
+    using String = std::basic_string<Char, Traits, Alloc>;
+
+    static void encode(LWWWriter & writer, const String & s) {
+        const std::uint64_t length = s.size();
+        writer.write(&length, sizeof(length));
+        writer.write(s.data(), length * sizeof(Char));
+    }
+
+    static String decode(LWWReader & reader) {
+        std::uint64_t length;
+        reader.read(&length, sizeof(length));
+        if(length > reader.remaining() / sizeof(Char)) {
+            throw LWWFormatError("LWW snapshot: string length exceeds input");
+        }
+
+        const Char * characters = reinterpret_cast<const Char *>(reader.skip(length * sizeof(Char)));
+        return String(characters, characters + length);
+    }
+};
+
+
+
+/*!
+* @struct LWWCodec
+* @brief Durations, stored as tick count
+*/
+template <typename Rep, typename Period>
+struct LWWCodec<std::chrono::duration<Rep, Period>> {
+    using Duration = std::chrono::duration<Rep, Period>;
+
+    static void encode(LWWWriter & writer, const Duration & d) {
+        LWWCodec<Rep>::encode(writer, d.count());
+    }
+
+    static Duration decode(LWWReader & reader) {
+        return Duration(LWWCodec<Rep>::decode(reader));
+    }
+};
+
+
+
+/*!
+* @struct LWWCodec
+* @brief Time points, stored as duration since clock's epoch
+*/
+template <typename Clock, typename Duration>
+struct LWWCodec<std::chrono::time_point<Clock, Duration>> {
+    using TimePoint = std::chrono::time_point<Clock, Duration>;
+
+    static void encode(LWWWriter & writer, const TimePoint & tp) {
+        LWWCodec<Duration>::encode(writer, tp.time_since_epoch());
+    }
+
+    static TimePoint decode(LWWReader & reader) {
+        return TimePoint(LWWCodec<Duration>::decode(reader));
+    }
+};
+
+
+
+/*!
+* @struct LWWCodec
+* @brief Hybrid logical clock timestamps, stored as packed time followed by replica id
+*/
+template <>
+struct LWWCodec<LWWHybridTimestamp> {
+    static void encode(LWWWriter & writer, const LWWHybridTimestamp & t) {
+        LWWCodec<std::uint64_t>::encode(writer, t.packed);
+        LWWCodec<std::uint32_t>::encode(writer, t.replicaId);
+    }
+
+    static LWWHybridTimestamp decode(LWWReader & reader) {
+        const std::uint64_t packed = LWWCodec<std::uint64_t>::decode(reader);
+        return { packed, LWWCodec<std::uint32_t>::decode(reader) };
+    }
+};
+
+
+
+/*!
+* @struct LWWCodec
+* @brief Shared values, stored as the referenced value
+*/
+template <typename V>
+struct LWWCodec<LWWSharedValue<V>> {
+    static void encode(LWWWriter & writer, const LWWSharedValue<V> & v) {
+        LWWCodec<V>::encode(writer, v.get());
+    }
+
+    static LWWSharedValue<V> decode(LWWReader & reader) {
+        return LWWSharedValue<V>(LWWCodec<V>::decode(reader));
+    }
+};
+
+
+
+/*!
+* @struct LWWSerialization
+* @brief Versioned binary snapshot of a dictionary's \a addedData , \a removedData , \a currentData and watermark
+* @details Layout, all integers in host byte order:
+* - header: magic "LWWD", u32 format version, u32 byte order mark, u8 flags (bit 0: watermark present)
+* - watermark timestamp, if present
+* - \a addedData and \a removedData : u64 key count, then per key: key, u64 element count, elements in less order
+* - \a currentData : u64 key count, then per key: key, value, timestamp
+*
+* Elements are written in storage order, so loading appends them without searching. Loading rejects histories out of
+* less order, duplicate elements or keys, and a stored \a currentData differing from the one the histories yield, so
+* malformed input cannot break invariants of a restored dictionary.
+*/
+struct LWWSerialization {
+    static constexpr char magic[4] = { 'L', 'W', 'W', 'D' }; //!< Leading bytes of every snapshot
+    static constexpr std::uint32_t formatVersion = 1; //!< Current format version
+    static constexpr std::uint32_t byteOrderMark = 0x01020304; //!< Detects snapshots written on a different byte order
+
+
+    /*!
+    * Serializing \p dict under its lock.
+    * @param [in] dict Source dictionary
+    * @return snapshot bytes
+    */
+    template <typename Dict>
+    static std::vector<char> serialize(const Dict & dict);
+
+
+    /*!
+    * Restoring a dictionary from snapshot bytes. The result is a new replica whose local version history holds
+    * every restored key, so its full state is reported by \a extractDelta .
+    * @param [in] data Beginning of snapshot
+    * @param [in] size Size of snapshot in bytes
+    * @return restored dictionary
+    * @throw LWWFormatError if the snapshot is truncated, malformed or of an unsupported format
+    */
+    template <typename Dict>
+    static std::unique_ptr<Dict> deserialize(const char * data, const std::size_t & size);
+
+
+    /*!
+    * Restoring a dictionary from snapshot bytes.
+    * @param [in] bytes Snapshot
+    * @return restored dictionary
+    * @throw LWWFormatError if the snapshot is truncated, malformed or of an unsupported format
+    */
+    template <typename Dict>
+    static std::unique_ptr<Dict> deserialize(const std::vector<char> & bytes);
+
+
+private:
+    template <typename StorageType, typename K, typename V, typename T>
+    static void writeStorage(LWWWriter & writer, const StorageType & storage);
+
+    /*!
+    * Reading a storage written by \a writeStorage .
+    * @param [in,out] reader Input
+    * @param [out] storage Empty target storage
+    * @throw LWWFormatError if keys repeat or a history is not in strictly ascending less order
+    */
+    template <typename StorageType, typename K, typename V, typename T>
+    static void readStorage(LWWReader & reader, StorageType & storage);
+
+    /*!
+    * Appending key \p k to \p storage being loaded.
+    * @param [in,out] storage Target storage
+    * @param [in] k key
+    * @return empty history of \p k
+    * @throw LWWFormatError if \p storage already holds \p k
+    */
+    template <typename StorageType, typename K>
+    static typename StorageType::History & loadKey(StorageType & storage, K && k);
+
+    /*!
+    * Appending element (\p v , \p t ) to \p history being loaded.
+    * @param [in,out] history Target history
+    * @param [in] v value
+    * @param [in] t timestamp
+    * @throw LWWFormatError if the element does not strictly follow the last element of \p history in less order
+    */
+    template <typename StorageType, typename V, typename T>
+    static void loadElement(typename StorageType::History & history, V && v, T && t);
+
+    /*!
+    * Checking that loaded \p history kept all of its \p elementCount elements.
+    * @param [in] history Loaded history
+    * @param [in] elementCount Number of elements loaded into \p history
+    * @throw LWWFormatError if \p history holds a different number of elements
+    */
+    template <typename StorageType>
+    static void checkHistory(const typename StorageType::History & history, const std::uint64_t & elementCount);
+
+    /*!
+    * Finding the current element of key \p k the way a dictionary maintains it.
+    * @param [in] k key
+    * @param [in] history History of added elements of \p k
+    * @param [in] removed Histories of removed elements
+    * @return winning element of \p history , its end if \p k has no current element
+    */
+    template <typename StorageType, typename K>
+    static typename StorageType::History::const_iterator currentElement(
+        const K & k,
+        const typename StorageType::History & history,
+        const StorageType & removed
+    );
+
+    /*!
+    * Reading an element count, rejecting counts that cannot fit into the remaining input.
+    * @param [in,out] reader Input
+    * @return count
+    */
+    static std::uint64_t readCount(LWWReader & reader);
+
+    template <typename, typename, typename>
+    friend class LWWMappedSnapshot; //!< Loads mapped storages with the same checks
+};
+
+
+
+inline LWWWriter::LWWWriter(
+    std::vector<char> & buffer
+):
+    buffer(buffer)
+{
+}
+
+
+
+inline void LWWWriter::write(const void * data, const std::size_t & size) {
+    const char * bytes = static_cast<const char *>(data);
+    this->buffer.insert(this->buffer.end(), bytes, bytes + size);
+}
+
+
+
+inline LWWReader::LWWReader(
+    const char * data,
+    const std::size_t & size
+):
+    cursor(data),
+    end(data + size)
+{
+}
+
+
+
+inline void LWWReader::read(void * data, const std::size_t & size) {
+    std::memcpy(data, this->skip(size), size);
+}
+
+
+
+inline const char * LWWReader::skip(const std::size_t & size) {
+    if(size > this->remaining()) {
+        throw LWWFormatError("LWW snapshot: unexpected end of input");
+    }
+
+    const char * position = this->cursor;
+    this->cursor += size;
+    return position;
+}
+
+
+
+inline std::size_t LWWReader::remaining() const {
+    return static_cast<std::size_t>(this->end - this->cursor);
+}
+
+
+
+template <typename Dict>
+std::vector<char> LWWSerialization::serialize(const Dict & dict) {
+    using K = typename Dict::CurrentData::key_type;
+    using V = typename Dict::CurrentData::mapped_type::first_type;
+    using T = typename Dict::CurrentData::mapped_type::second_type;
+
+    std::vector<char> bytes;
+    LWWWriter writer(bytes);
+
+    std::lock_guard<LWWMutex> lock(dict.mtx);
+
+    const std::uint8_t flags = dict.stableTime ? 1 : 0;
+    writer.write(magic, sizeof(magic));
+    writer.write(&formatVersion, sizeof(formatVersion));
+    writer.write(&byteOrderMark, sizeof(byteOrderMark));
+    writer.write(&flags, sizeof(flags));
+    if(dict.stableTime) {
+        LWWCodec<T>::encode(writer, *dict.stableTime);
+    }
+
+    writeStorage<typename Dict::StorageType, K, V, T>(writer, *dict.addedData);
+    writeStorage<typename Dict::StorageType, K, V, T>(writer, *dict.removedData);
+
+    const auto & current = dict.currentData.peek();
+    const std::uint64_t currentCount = current.size();
+    writer.write(&currentCount, sizeof(currentCount));
+    for(const auto & [k, element] : current) {
+        LWWCodec<K>::encode(writer, k);
+        LWWCodec<V>::encode(writer, element.first);
+        LWWCodec<T>::encode(writer, element.second);
+    }
+
+    return bytes;
+}
+
+
+
+template <typename Dict>
+std::unique_ptr<Dict> LWWSerialization::deserialize(const char * data, const std::size_t & size) {
+    using K = typename Dict::CurrentData::key_type;
+    using V = typename Dict::CurrentData::mapped_type::first_type;
+    using T = typename Dict::CurrentData::mapped_type::second_type;
+
+    LWWReader reader(data, size);
+
+    char header[sizeof(magic)];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint8_t flags;
+    reader.read(header, sizeof(header));
+    if(std::memcmp(header, magic, sizeof(magic)) != 0) {
+        throw LWWFormatError("LWW snapshot: bad magic");
+    }
+    reader.read(&version, sizeof(version));
+    if(version != formatVersion) {
+        throw LWWFormatError("LWW snapshot: unsupported format version " + std::to_string(version));
+    }
+    reader.read(&byteOrder, sizeof(byteOrder));
+    if(byteOrder != byteOrderMark) {
+        throw LWWFormatError("LWW snapshot: written on a host of different byte order");
+    }
+    reader.read(&flags, sizeof(flags));
+    if(flags & ~1u) {
+        throw LWWFormatError("LWW snapshot: unknown flags");
+    }
+
+    auto dict = std::make_unique<Dict>();
+    std::lock_guard<LWWMutex> lock(dict->mtx);
+
+    if(flags & 1u) {
+        dict->stableTime = LWWCodec<T>::decode(reader);
+    }
+
+    readStorage<typename Dict::StorageType, K, V, T>(reader, *dict->addedData);
+    readStorage<typename Dict::StorageType, K, V, T>(reader, *dict->removedData);
+
+    // Stored current elements have to be exactly the ones the histories yield, in ascending key order.
+    std::vector<std::pair<const K *, typename Dict::History::const_iterator>> elements;
+    for(const auto & [k, history] : *dict->addedData) {
+        const auto element = currentElement(k, history, *dict->removedData);
+        if(element != history.end()) {
+            elements.emplace_back(&k, element);
+        }
+    }
+    const auto keyLess = [](const auto & lhs, const auto & rhs) {
+        return *lhs.first < *rhs.first;
+    };
+    if(!std::is_sorted(elements.begin(), elements.end(), keyLess)) {
+        std::sort(elements.begin(), elements.end(), keyLess);
+    }
+
+    if(readCount(reader) != elements.size()) {
+        throw LWWFormatError("LWW snapshot: current elements do not match histories");
+    }
+
+    const auto equivalent = [](const auto & lhs, const auto & rhs) {
+        return !(lhs < rhs) && !(rhs < lhs);
+    };
+    typename Dict::CurrentData current;
+    for(const auto & [k, element] : elements) {
+        K storedK = LWWCodec<K>::decode(reader);
+        V storedV = LWWCodec<V>::decode(reader);
+        T storedT = LWWCodec<T>::decode(reader);
+        if(!equivalent(storedK, *k) || !equivalent(storedV, element->first) || !equivalent(storedT, element->second)) {
+            throw LWWFormatError("LWW snapshot: current elements do not match histories");
+        }
+
+        current.emplace_hint(current.end(), std::move(storedK), std::make_pair(std::move(storedV), std::move(storedT)));
+    }
+
+    if(reader.remaining() != 0) {
+        throw LWWFormatError("LWW snapshot: trailing bytes");
+    }
+
+    // Registering every restored key under its own local version, in key order so bookkeeping inserts are hinted.
+    std::vector<const K *> keys;
+    keys.reserve(dict->addedData->size() + dict->removedData->size());
+    for(const auto & [k, history] : *dict->addedData) {
+        keys.push_back(&k);
+    }
+    for(const auto & [k, history] : *dict->removedData) {
+        keys.push_back(&k);
+    }
+    std::sort(keys.begin(), keys.end(), [](const K * lhs, const K * rhs) {
+        return *lhs < *rhs;
+    });
+    keys.erase(std::unique(keys.begin(), keys.end(), [](const K * lhs, const K * rhs) {
+        return !(*lhs < *rhs) && !(*rhs < *lhs);
+    }), keys.end());
+
+    for(const K * k : keys) {
+        ++dict->version;
+        dict->keyVersions.emplace_hint(dict->keyVersions.end(), *k, dict->version);
+        dict->changeLog.emplace_hint(dict->changeLog.end(), dict->version, *k);
+    }
+
+    // Second instance takes over the decoded map instead of copying it again.
+    bool copiedFlag = false;
+    dict->currentData.modify([&current, &copiedFlag](typename Dict::CurrentData & instance) {
+        if(copiedFlag) {
+            instance = std::move(current);
+        } else {
+            instance = current;
+            copiedFlag = true;
+        }
+    });
+
+    return dict;
+}
+
+
+
+template <typename Dict>
+std::unique_ptr<Dict> LWWSerialization::deserialize(const std::vector<char> & bytes) {
+    return deserialize<Dict>(bytes.data(), bytes.size());
+}
+
+
+
+template <typename StorageType, typename K, typename V, typename T>
+void LWWSerialization::writeStorage(LWWWriter & writer, const StorageType & storage) {
+    const std::uint64_t keyCount = storage.size();
+    writer.write(&keyCount, sizeof(keyCount));
+
+    for(const auto & [k, history] : storage) {
+        LWWCodec<K>::encode(writer, k);
+
+        const std::uint64_t elementCount = static_cast<std::uint64_t>(std::distance(history.begin(), history.end()));
+        writer.write(&elementCount, sizeof(elementCount));
+        for(const auto & [v, t] : history) {
+            LWWCodec<V>::encode(writer, v);
+            LWWCodec<T>::encode(writer, t);
+        }
+    }
+}
+
+
+
+template <typename StorageType, typename K, typename V, typename T>
+void LWWSerialization::readStorage(LWWReader & reader, StorageType & storage) {
+    for(std::uint64_t keyCount = readCount(reader); keyCount != 0; --keyCount) {
+        auto & history = loadKey(storage, LWWCodec<K>::decode(reader));
+
+        const std::uint64_t elementCount = readCount(reader);
+        for(std::uint64_t count = elementCount; count != 0; --count) {
+            V v = LWWCodec<V>::decode(reader);
+            loadElement<StorageType>(history, std::move(v), LWWCodec<T>::decode(reader));
+        }
+        checkHistory<StorageType>(history, elementCount);
+    }
+}
+
+
+
+template <typename StorageType, typename K>
+typename StorageType::History & LWWSerialization::loadKey(StorageType & storage, K && k) {
+    const std::size_t storageSize = storage.size();
+    auto & history = storage.appendKey(std::forward<K>(k));
+    if(storage.size() == storageSize) {
+        throw LWWFormatError("LWW snapshot: duplicate key");
+    }
+    return history;
+}
+
+
+
+template <typename StorageType, typename V, typename T>
+void LWWSerialization::loadElement(typename StorageType::History & history, V && v, T && t) {
+    // Every element has to follow the previous one in less order, which also rules out duplicates.
+    if(history.begin() != history.end()) {
+        const auto & last = *std::prev(history.end());
+        if(!(last.first < v || (!(v < last.first) && last.second < t))) {
+            throw LWWFormatError("LWW snapshot: history out of order or holding duplicates");
+        }
+    }
+    StorageType::appendElement(history, { std::forward<V>(v), std::forward<T>(t) });
+}
+
+
+
+template <typename StorageType>
+void LWWSerialization::checkHistory(const typename StorageType::History & history, const std::uint64_t & elementCount) {
+    // Storages keeping fewer elements than written cannot have written this history.
+    if(static_cast<std::uint64_t>(std::distance(history.begin(), history.end())) != elementCount) {
+        throw LWWFormatError("LWW snapshot: history out of order or holding duplicates");
+    }
+}
+
+
+
+template <typename StorageType, typename K>
+typename StorageType::History::const_iterator LWWSerialization::currentElement(
+    const K & k,
+    const typename StorageType::History & history,
+    const StorageType & removed
+) {
+    auto winner = history.end();
+    for(auto historyIter = history.begin(); historyIter != history.end(); ++historyIter) {
+        if(winner == history.end() || lwwSupersedes(historyIter->first, historyIter->second, winner->first, winner->second)) {
+            winner = historyIter;
+        }
+    }
+    if(winner == history.end()) {
+        return winner;
+    }
+
+    // If element's timestamps for insertion and removal are the same, then removal has priority.
+    const auto removedIter = removed.find(k);
+    if(removedIter != removed.end()) {
+        const auto lastRemovalTime = StorageType::lastTime(removedIter->second);
+        if(lastRemovalTime && !(*lastRemovalTime < winner->second)) {
+            return history.end();
+        }
+    }
+
+    return winner;
+}
+
+
+
+inline std::uint64_t LWWSerialization::readCount(LWWReader & reader) {
+    std::uint64_t count;
+    reader.read(&count, sizeof(count));
+
+    // Every encoded key or element occupies at least one byte.
+    if(count > reader.remaining()) {
+        throw LWWFormatError("LWW snapshot: count exceeds input");
+    }
+    return count;
+}
+
+
+
+#endif // LWWSERIALIZATION_H
@@ -0,0 +1,164 @@
+/*!
+* @file LWWSharedValue.h
+* @brief Contains immutable reference-counted value handle
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LWWSHAREDVALUE_H
+#define LWWSHAREDVALUE_H
+
+
+#include <memory>
+#include <utility>
+
+
+/*!
+* @class LWWSharedValue
+* @brief Immutable value shared by every copy of the handle
+* @details Used as value type of a dictionary, a value is allocated once and its history element, both instances of
+* \a currentData and every snapshot reference the same object, so copying a value costs a reference count increment
+* regardless of its size. Handles compare by the referenced values.
+* @tparam V referenced value
+*/
+template <typename V>
+class LWWSharedValue {
+private:
+    std::shared_ptr<const V> value; //!< Referenced value, never null
+
+
+public:
+    /*!
+    * Default constructor, referencing a value-initialized \a V
+    */
+    LWWSharedValue();
+
+
+    /*!
+    * Constructor, copying \p v into a new shared value
+    * @param [in] v value
+    */
+    LWWSharedValue(const V & v);
+
+
+    /*!
+    * Constructor, moving \p v into a new shared value
+    * @param [in] v value
+    */
+    LWWSharedValue(V && v);
+
+
+    /*!
+    * Constructor, constructing a new shared value in place from \p args
+    * @param [in] args Arguments of \a V 's constructor
+    */
+    template <typename... Args>
+    explicit LWWSharedValue(std::in_place_t, Args &&... args);
+
+
+    const V & get() const;
+    const V & operator*() const;
+    const V * operator->() const;
+
+
+    /*!
+    * Checking whether this handle and \p other reference the same object.
+    * @param [in] other Other handle
+    * @return true if the value is shared
+    */
+    bool sharesValueWith(const LWWSharedValue & other) const;
+
+
+    friend bool operator==(const LWWSharedValue & lhs, const LWWSharedValue & rhs) {
+        return lhs.value == rhs.value || *lhs.value == *rhs.value;
+    }
+
+
+    friend bool operator!=(const LWWSharedValue & lhs, const LWWSharedValue & rhs) {
+        return !(lhs == rhs);
+    }
+
+
+    friend bool operator<(const LWWSharedValue & lhs, const LWWSharedValue & rhs) {
+        return lhs.value != rhs.value && *lhs.value < *rhs.value;
+    }
+
+
+    friend bool operator>(const LWWSharedValue & lhs, const LWWSharedValue & rhs) {
+        return rhs < lhs;
+    }
+
+
+    friend bool operator<=(const LWWSharedValue & lhs, const LWWSharedValue & rhs) {
+        return !(rhs < lhs);
+    }
+
+
+    friend bool operator>=(const LWWSharedValue & lhs, const LWWSharedValue & rhs) {
+        return !(lhs < rhs);
+    }
+};
+
+
+
+template <typename V>
+LWWSharedValue<V>::LWWSharedValue(
+) : value(std::make_shared<const V>()) {
+}
+
+
+
+template <typename V>
+LWWSharedValue<V>::LWWSharedValue(
+    const V & v
+) : value(std::make_shared<const V>(v)) {
+}
+
+
+
+template <typename V>
+LWWSharedValue<V>::LWWSharedValue(
+    V && v
+) : value(std::make_shared<const V>(std::move(v))) {
+}
+
+
+
+template <typename V>
+template <typename... Args>
+LWWSharedValue<V>::LWWSharedValue(
+    std::in_place_t,
+    Args &&... args
+) : value(std::make_shared<const V>(std::forward<Args>(args)...)) {
+}
+
+
+
+template <typename V>
+const V & LWWSharedValue<V>::get() const {
+    return *this->value;
+}
+
+
+
+template <typename V>
+const V & LWWSharedValue<V>::operator*() const {
+    return *this->value;
+}
+
+
+
+template <typename V>
+const V * LWWSharedValue<V>::operator->() const {
+    return this->value.get();
+}
+
+
+
+template <typename V>
+bool LWWSharedValue<V>::sharesValueWith(const LWWSharedValue & other) const {
+    return this->value == other.value;
+}
+
+
+
+#endif // LWWSHAREDVALUE_H
@@ -0,0 +1,516 @@
+/*!
+* @file LWWStats.h
+* @brief Contains optional operation counters, latency histograms and lock contention metrics of dictionaries
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+* @details Instrumentation is compiled in only if \a LWW_ENABLE_STATS is defined, consistently across all translation
+* units. Otherwise recording compiles to nothing, \a LWWMutex is \a std::mutex and statistics stay empty.
+*/
+
+#ifndef LWWSTATS_H
+#define LWWSTATS_H
+
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*!
+* @class LWWHistogram
+* @brief Histogram of unsigned values with constant memory and relative precision, recordable concurrently
+* @details Values are bucketed like HDR histograms: exactly below \a subBucketCount , above that every power of two is
+* split into \a subBucketCount linear sub-buckets, so reported values are within 12.5 % of recorded ones. Recording is
+* a few relaxed atomic operations.
+*/
+class LWWHistogram {
+public:
+    static constexpr unsigned subBucketBits = 3; //!< Precision, log2 of sub-buckets per power of two
+    static constexpr std::size_t subBucketCount = std::size_t(1) << subBucketBits; //!< Sub-buckets per power of two
+    static constexpr std::size_t bucketCount = (64 - subBucketBits + 1) << subBucketBits; //!< Buckets covering 64 bits
+
+    /*!
+    * @struct Snapshot
+    * @brief Recorded values at one point in time
+    */
+    struct Snapshot {
+        std::vector<std::uint64_t> counts = std::vector<std::uint64_t>(bucketCount); //!< Number of values per bucket
+        std::uint64_t count = 0; //!< Number of values
+        std::uint64_t sum = 0; //!< Sum of values
+        std::uint64_t max = 0; //!< Largest value
+
+
+        /*!
+        * Estimating value at quantile \p q .
+        * @param [in] q Quantile within [0, 1]
+        * @return upper bound of the bucket holding the quantile, capped at \a max , 0 if empty
+        */
+        std::uint64_t percentile(const double & q) const;
+
+
+        double mean() const;
+
+
+        /*!
+        * Adding values recorded by another histogram.
+        * @param [in] other Other snapshot
+        * @return this snapshot
+        */
+        Snapshot & operator+=(const Snapshot & other);
+    };
+
+
+private:
+    std::array<std::atomic<std::uint64_t>, bucketCount> counts {}; //!< Number of values per bucket
+    std::atomic<std::uint64_t> sum { 0 }; //!< Sum of values
+    std::atomic<std::uint64_t> max { 0 }; //!< Largest value
+
+
+public:
+    void record(const std::uint64_t & value);
+
+
+    Snapshot snapshot() const;
+
+
+    static std::size_t bucketOf(const std::uint64_t & value);
+
+
+    /*!
+    * Largest value of \p bucket .
+    * @param [in] bucket Bucket index
+    * @return upper bound, inclusive
+    */
+    static std::uint64_t bucketUpperBound(const std::size_t & bucket);
+};
+
+
+
+/*!
+* @struct LWWStats
+* @brief Statistics of a dictionary at one point in time
+* @details Latencies are in nanoseconds and include waiting for \a mtx . Number of operations of every kind is the
+* \a count of its latency histogram, except for lookups, whose latency is sampled.
+*/
+struct LWWStats {
+    LWWHistogram::Snapshot addLatency; //!< Single element adds and updates
+    LWWHistogram::Snapshot removeLatency; //!< Single element removals
+    std::uint64_t lookupCount = 0; //!< \a getValueByKey calls
+    LWWHistogram::Snapshot lookupLatency; //!< Sample of \a getValueByKey calls, one in \a lookupSampleRate per thread
+    LWWHistogram::Snapshot batchLatency; //!< \a applyBatch calls
+    LWWHistogram::Snapshot mergeLatency; //!< \a mergeWith and \a applyDelta calls
+
+    std::uint64_t duplicateCount = 0; //!< Element inserts hitting an element already contained in its history
+    LWWHistogram::Snapshot historyDepth; //!< Size of a key's history after every element insert
+    LWWHistogram::Snapshot mergeSize; //!< Elements inserted by every merge, duplicates excluded
+
+    std::uint64_t lockCount = 0; //!< Acquisitions of \a mtx
+    std::uint64_t contendedLockCount = 0; //!< Acquisitions of \a mtx that had to wait
+    LWWHistogram::Snapshot lockWait; //!< Time waited for \a mtx by contended acquisitions
+
+
+    /*!
+    * Adding statistics of another dictionary, e.g. of another shard.
+    * @param [in] other Other statistics
+    * @return these statistics
+    */
+    LWWStats & operator+=(const LWWStats & other);
+};
+
+
+
+#ifdef LWW_ENABLE_STATS
+
+/*!
+* @class LWWMutex
+* @brief Mutex of a dictionary recording acquisitions and time spent waiting
+* @details Acquisition first tries to lock without waiting, so uncontended locking costs one counter increment more
+* than \a std::mutex and the clock is only read when the mutex is contended.
+*/
+class LWWMutex {
+private:
+    std::mutex mutex; //!< Underlying mutex
+    std::atomic<std::uint64_t> lockCount { 0 }; //!< Acquisitions
+    std::atomic<std::uint64_t> contendedLockCount { 0 }; //!< Acquisitions that had to wait
+    LWWHistogram lockWait; //!< Nanoseconds waited by contended acquisitions
+
+
+public:
+    void lock();
+    bool try_lock();
+    void unlock();
+
+
+    /*!
+    * Copying lock metrics into \p stats .
+    * @param [out] stats Statistics
+    */
+    void collect(LWWStats & stats) const;
+};
+
+
+
+/*!
+* @class LWWStatsRecorder
+* @brief Live statistics of a dictionary, recorded concurrently
+* @details Writers are timed and counted exactly, their cost is small next to taking \a mtx . Wait-free lookups are
+* counted on striped counters, so concurrent readers do not contend on one cache line, and only one lookup in
+* \a lookupSampleRate per thread reads the clock.
+*/
+class LWWStatsRecorder {
+public:
+    static constexpr std::uint32_t lookupSampleRate = 64; //!< Lookups per thread per timed lookup
+
+    /*!
+    * @enum Operation
+    * @brief Timed kind of operation
+    */
+    enum class Operation {
+        add,
+        remove,
+        lookup,
+        batch,
+        merge
+    };
+
+    /*!
+    * @class Timer
+    * @brief Recording latency of one operation when leaving scope
+    */
+    class Timer {
+    private:
+        LWWHistogram * histogram; //!< Latency histogram of the operation, nullptr if not timed
+        std::chrono::steady_clock::time_point start; //!< Start of the operation
+
+    public:
+        explicit Timer(LWWHistogram * histogram);
+        Timer(const Timer &) = delete;
+        Timer & operator=(const Timer &) = delete;
+        ~Timer();
+    };
+
+
+private:
+    static constexpr std::size_t lookupStripes = 16; //!< Stripes of the lookup counter
+
+    /*!
+    * @struct LookupCounter
+    * @brief Stripe of the lookup counter occupying its own cache line
+    */
+    struct alignas(64) LookupCounter {
+        std::atomic<std::uint64_t> count { 0 }; //!< Lookups counted on the stripe
+    };
+
+    std::array<LWWHistogram, 5> latencies; //!< Latency histogram per \a Operation
+    std::array<LookupCounter, lookupStripes> lookupCounts; //!< Lookups, striped by thread
+    std::atomic<std::uint64_t> duplicateCount { 0 }; //!< Inserts of already contained elements
+    LWWHistogram historyDepth; //!< History size after inserts
+    LWWHistogram mergeSize; //!< Elements inserted per merge
+
+
+public:
+    /*!
+    * Starting to time \p operation .
+    * @param [in] operation Kind of operation
+    * @return timer recording the latency when destroyed
+    */
+    Timer time(const Operation & operation);
+
+
+    /*!
+    * Counting a lookup and sampling its latency.
+    * @return timer recording the latency when destroyed if the lookup is sampled
+    */
+    Timer timeLookup();
+
+
+    /*!
+    * Recording insert of an element into a history.
+    * @param [in] insertedFlag Whether the element was new, false for a duplicate
+    * @param [in] historySize Size of the history after the insert
+    */
+    void recordInsert(const bool & insertedFlag, const std::size_t & historySize);
+
+
+    /*!
+    * Recording a merge.
+    * @param [in] insertedCount Number of elements new to the destination
+    */
+    void recordMerge(const std::size_t & insertedCount);
+
+
+    /*!
+    * Taking statistics recorded so far.
+    * @param [in] mtx Mutex of the dictionary
+    * @return statistics
+    */
+    LWWStats snapshot(const LWWMutex & mtx) const;
+};
+
+#else
+
+using LWWMutex = std::mutex; //!< Mutex of a dictionary, uninstrumented
+
+/*!
+* @class LWWStatsRecorder
+* @brief Disabled statistics, every call compiles to nothing
+*/
+class LWWStatsRecorder {
+public:
+    static constexpr std::uint32_t lookupSampleRate = 64;
+
+    enum class Operation {
+        add,
+        remove,
+        lookup,
+        batch,
+        merge
+    };
+
+    struct Timer {};
+
+
+    Timer time(const Operation &) { return {}; }
+    Timer timeLookup() { return {}; }
+    void recordInsert(const bool &, const std::size_t &) {}
+    void recordMerge(const std::size_t &) {}
+    LWWStats snapshot(const LWWMutex &) const { return {}; }
+};
+
+#endif // LWW_ENABLE_STATS
+
+
+
+inline std::uint64_t LWWHistogram::Snapshot::percentile(const double & q) const {
+    if(this->count == 0) {
+        return 0;
+    }
+
+    // Rank of the quantile among recorded values, 1-based.
+    const double exactRank = q <= 0 ? 1 : q >= 1 ? double(this->count) : q * double(this->count);
+    const std::uint64_t rank = std::max<std::uint64_t>(1, std::uint64_t(exactRank + 0.999999));
+
+    std::uint64_t seen = 0;
+    for(std::size_t bucket = 0; bucket < this->counts.size(); ++bucket) {
+        seen += this->counts[bucket];
+        if(seen >= rank) {
+            return std::min(LWWHistogram::bucketUpperBound(bucket), this->max);
+        }
+    }
+    return this->max;
+}
+
+
+
+inline double LWWHistogram::Snapshot::mean() const {
+    return this->count ? double(this->sum) / double(this->count) : 0.0;
+}
+
+
+
+inline LWWHistogram::Snapshot & LWWHistogram::Snapshot::operator+=(const Snapshot & other) {
+    for(std::size_t bucket = 0; bucket < this->counts.size(); ++bucket) {
+        this->counts[bucket] += other.counts[bucket];
+    }
+    this->count += other.count;
+    this->sum += other.sum;
+    this->max = std::max(this->max, other.max);
+    return *this;
+}
+
+
+
+inline void LWWHistogram::record(const std::uint64_t & value) {
+    this->counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    this->sum.fetch_add(value, std::memory_order_relaxed);
+
+    std::uint64_t previousMax = this->max.load(std::memory_order_relaxed);
+    while(previousMax < value && !this->max.compare_exchange_weak(previousMax, value, std::memory_order_relaxed)) {
+    }
+}
+
+
+
+inline LWWHistogram::Snapshot LWWHistogram::snapshot() const {
+    Snapshot snapshot;
+    for(std::size_t bucket = 0; bucket < bucketCount; ++bucket) {
+        snapshot.counts[bucket] = this->counts[bucket].load(std::memory_order_relaxed);
+        snapshot.count += snapshot.counts[bucket];
+    }
+    snapshot.sum = this->sum.load(std::memory_order_relaxed);
+    snapshot.max = this->max.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+
+
+inline std::size_t LWWHistogram::bucketOf(const std::uint64_t & value) {
+    if(value < subBucketCount) {
+        return std::size_t(value);
+    }
+
+    // Position of the highest set bit selects the power of two, the following bits the sub-bucket.
+    unsigned magnitude = 0;
+    for(unsigned step = 32; step; step >>= 1) {
+        if(value >> (magnitude + step)) {
+            magnitude += step;
+        }
+    }
+    const unsigned shift = magnitude - subBucketBits;
+    return ((std::size_t(shift) + 1) << subBucketBits) + std::size_t((value >> shift) & (subBucketCount - 1));
+}
+
+
+
+inline std::uint64_t LWWHistogram::bucketUpperBound(const std::size_t & bucket) {
+    if(bucket < subBucketCount) {
+        return bucket;
+    }
+
+    const unsigned shift = unsigned(bucket >> subBucketBits) - 1;
+    const std::uint64_t lower = std::uint64_t(subBucketCount + (bucket & (subBucketCount - 1))) << shift;
+    return lower + ((std::uint64_t(1) << shift) - 1);
+}
+
+
+
+inline LWWStats & LWWStats::operator+=(const LWWStats & other) {
+    this->addLatency += other.addLatency;
+    this->removeLatency += other.removeLatency;
+    this->lookupCount += other.lookupCount;
+    this->lookupLatency += other.lookupLatency;
+    this->batchLatency += other.batchLatency;
+    this->mergeLatency += other.mergeLatency;
+    this->duplicateCount += other.duplicateCount;
+    this->historyDepth += other.historyDepth;
+    this->mergeSize += other.mergeSize;
+    this->lockCount += other.lockCount;
+    this->contendedLockCount += other.contendedLockCount;
+    this->lockWait += other.lockWait;
+    return *this;
+}
+
+
+
+#ifdef LWW_ENABLE_STATS
+
+inline void LWWMutex::lock() {
+    if(!this->mutex.try_lock()) {
+        const auto start = std::chrono::steady_clock::now();
+        this->mutex.lock();
+        const auto waited = std::chrono::steady_clock::now() - start;
+
+        this->contendedLockCount.fetch_add(1, std::memory_order_relaxed);
+        this->lockWait.record(std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count()));
+    }
+    this->lockCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+
+inline bool LWWMutex::try_lock() {
+    if(!this->mutex.try_lock()) {
+        return false;
+    }
+    this->lockCount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+
+
+inline void LWWMutex::unlock() {
+    this->mutex.unlock();
+}
+
+
+
+inline void LWWMutex::collect(LWWStats & stats) const {
+    stats.lockCount = this->lockCount.load(std::memory_order_relaxed);
+    stats.contendedLockCount = this->contendedLockCount.load(std::memory_order_relaxed);
+    stats.lockWait = this->lockWait.snapshot();
+}
+
+
+
+inline LWWStatsRecorder::Timer::Timer(
+    LWWHistogram * histogram
+) : histogram(histogram) {
+    if(this->histogram) {
+        this->start = std::chrono::steady_clock::now();
+    }
+}
+
+
+
+inline LWWStatsRecorder::Timer::~Timer() {
+    if(this->histogram) {
+        const auto elapsed = std::chrono::steady_clock::now() - this->start;
+        this->histogram->record(std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+}
+
+
+
+inline LWWStatsRecorder::Timer LWWStatsRecorder::time(const Operation & operation) {
+    return Timer(&this->latencies[static_cast<std::size_t>(operation)]);
+}
+
+
+
+inline LWWStatsRecorder::Timer LWWStatsRecorder::timeLookup() {
+    thread_local const std::size_t stripe = std::hash<std::thread::id>()(std::this_thread::get_id()) % lookupStripes;
+    thread_local std::uint32_t untilSample = 0;
+
+    this->lookupCounts[stripe].count.fetch_add(1, std::memory_order_relaxed);
+    if(untilSample-- != 0) {
+        return Timer(nullptr);
+    }
+    untilSample = lookupSampleRate - 1;
+    return Timer(&this->latencies[static_cast<std::size_t>(Operation::lookup)]);
+}
+
+
+
+inline void LWWStatsRecorder::recordInsert(const bool & insertedFlag, const std::size_t & historySize) {
+    if(!insertedFlag) {
+        this->duplicateCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->historyDepth.record(historySize);
+}
+
+
+
+inline void LWWStatsRecorder::recordMerge(const std::size_t & insertedCount) {
+    this->mergeSize.record(insertedCount);
+}
+
+
+
+inline LWWStats LWWStatsRecorder::snapshot(const LWWMutex & mtx) const {
+    LWWStats stats;
+    stats.addLatency = this->latencies[static_cast<std::size_t>(Operation::add)].snapshot();
+    stats.removeLatency = this->latencies[static_cast<std::size_t>(Operation::remove)].snapshot();
+    for(const auto & counter : this->lookupCounts) {
+        stats.lookupCount += counter.count.load(std::memory_order_relaxed);
+    }
+    stats.lookupLatency = this->latencies[static_cast<std::size_t>(Operation::lookup)].snapshot();
+    stats.batchLatency = this->latencies[static_cast<std::size_t>(Operation::batch)].snapshot();
+    stats.mergeLatency = this->latencies[static_cast<std::size_t>(Operation::merge)].snapshot();
+    stats.duplicateCount = this->duplicateCount.load(std::memory_order_relaxed);
+    stats.historyDepth = this->historyDepth.snapshot();
+    stats.mergeSize = this->mergeSize.snapshot();
+    mtx.collect(stats);
+    return stats;
+}
+
+#endif // LWW_ENABLE_STATS
+
+
+
+#endif // LWWSTATS_H
@@ -0,0 +1,1283 @@
+/*!
+* @file LWWStorage.h
+* @brief Contains storage policies for CRDT LWW Element Dictionary history
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LWWSTORAGE_H
+#define LWWSTORAGE_H
+
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <utility>
+#include <vector>
+
+
+/*!
+* Whether element ( \p v , \p t ) wins over element ( \p currentV , \p currentT ) of the same key. The later
+* timestamp wins, equal timestamps are won by the greater value, so every replica picks the same winner regardless of
+* the order elements arrived in.
+* @param [in] v Candidate value
+* @param [in] t Candidate timestamp
+* @param [in] currentV Value of the held element
+* @param [in] currentT Timestamp of the held element
+* @return true if the candidate replaces the held element
+*/
+template <typename V, typename T>
+bool lwwSupersedes(const V & v, const T & t, const V & currentV, const T & currentT) {
+    return currentT < t || (!(t < currentT) && currentV < v);
+}
+
+
+
+/*!
+* Positioning \p hint at the first element of ordered map \p map not less than \p k . Cheap when keys are sought in
+* ascending order, otherwise falls back to \a lower_bound .
+* @param [in] map Ordered map
+* @param [in] hint Iterator expected to be at or shortly before the sought position
+* @param [in] k key
+* @return iterator to the first element not less than \p k
+*/
+template <typename M>
+typename M::iterator orderedSeek(M & map, typename M::iterator hint, const typename M::key_type & k) {
+    static constexpr int maxSteps = 8;
+
+    for(int step = 0; step < maxSteps && hint != map.end() && hint->first < k; ++step) {
+        ++hint;
+    }
+
+    if(hint != map.end() && hint->first < k) {
+        return map.lower_bound(k);
+    }
+
+    if(hint != map.begin() && !(std::prev(hint)->first < k)) {
+        return map.lower_bound(k);
+    }
+
+    return hint;
+}
+
+
+
+/*!
+* Single-pass merge join of ordered map \p dataSrc into ordered map \p dataDest . Missing keys are inserted with
+* their admitted history, histories of existing keys are merged by \p mergeHistory .
+* @param [in,out] dataDest Merging destination
+* @param [in] dataSrc Merging source
+* @param [in] mergeHistory Callable merging (key, destination history, source history, \p onInserted , \p admit )
+* @param [in] onInserted Callable invoked with (key, value, timestamp) of every inserted element of \p dataSrc
+* @param [in] admit Predicate on timestamp, elements of \p dataSrc it rejects are skipped
+*/
+template <typename M, typename H, typename F, typename A>
+void mergeOrderedMaps(M & dataDest, const M & dataSrc, H && mergeHistory, F && onInserted, A && admit) {
+    auto destIter = dataDest.begin();
+
+    for(const auto & [keySrc, historySrc] : dataSrc) {
+        destIter = orderedSeek(dataDest, destIter, keySrc);
+
+        if(destIter != dataDest.end() && !(keySrc < destIter->first)) {
+            mergeHistory(keySrc, destIter->second, historySrc, onInserted, admit);
+            ++destIter;
+            continue;
+        }
+
+        const bool admittedFlag = std::all_of(historySrc.begin(), historySrc.end(), [&admit](const auto & pair) {
+            return admit(pair.second);
+        });
+
+        if(admittedFlag) {
+            destIter = dataDest.emplace_hint(destIter, keySrc, historySrc);
+            for(const auto & [v, t] : historySrc) {
+                onInserted(keySrc, v, t);
+            }
+            ++destIter;
+        } else {
+            destIter = dataDest.emplace_hint(destIter, keySrc, typename M::mapped_type());
+            mergeHistory(keySrc, destIter->second, historySrc, onInserted, admit);
+            destIter = destIter->second.empty() ? dataDest.erase(destIter) : std::next(destIter);
+        }
+    }
+}
+
+
+
+/*!
+* @class BasicTreeStorage
+* @brief Node-based history storage built on an ordered map of multimaps
+* @details Keys are kept in less order, every key owns a multimap of (value, timestamp) pairs kept in less order of
+* value and, for equal values, in less order of timestamp.
+* @tparam K key
+* @tparam V value
+* @tparam T timestamp
+* @tparam Map map of \a K to multimap of \a V to \a T , \a std::map or \a std::pmr::map
+*/
+template <typename K,
+          typename V,
+          typename T,
+          typename Map>
+class BasicTreeStorage : public Map {
+public:
+    using History = typename Map::mapped_type; //!< Per-key history container
+
+
+    using Map::Map;
+
+
+    /*!
+    * Less-ordered insertion
+    * @param [in,out] history Target container
+    * @param [in] pair Data to insert, moved from if inserted
+    * @return true if \p pair was inserted, false if it was already present
+    */
+    static bool orderedInsert(History & history, std::pair<V, T> && pair);
+
+
+    /*!
+    * Fetching latest timestamp contained in \p history .
+    * @param [in] history Source container
+    * @return latest timestamp if \p history is not empty, empty otherwise
+    * @retval std::optional<T> timestamp type within std::optional container
+    */
+    static const std::optional<const T> lastTime(const History & history);
+
+
+    /*!
+    * Merging \p src into this instance in a single ordered pass over both containers.
+    * @param [in] src Merging source
+    * @param [in] onInserted Callable invoked with (key, value, timestamp) of every element of \p src not previously
+    * contained, referencing \p src
+    * @param [in] admit Predicate on timestamp, elements of \p src it rejects are skipped
+    */
+    template <typename F, typename A>
+    void merge(const BasicTreeStorage & src, F && onInserted, A && admit);
+
+    /*!
+    * Merging history \p historySrc of key \p k into \p historyDest .
+    * @param [in] k key
+    * @param [in,out] historyDest Merging destination
+    * @param [in] historySrc Merging source
+    * @param [in] onInserted Callable invoked with (key, value, timestamp) of every element of \p historySrc not
+    * previously contained, referencing \p historySrc
+    * @param [in] admit Predicate on timestamp, elements of \p historySrc it rejects are skipped
+    */
+    template <typename F, typename A>
+    static void mergeHistory(const K & k, History & historyDest, const History & historySrc, F && onInserted, A && admit);
+
+
+    /*!
+    * Inserting empty histories for keys of \p src missing in this instance, so that afterwards histories can be
+    * merged concurrently without changing the container's structure.
+    * @param [in] src Merging source
+    */
+    void insertMissingKeys(const BasicTreeStorage & src);
+
+
+    /*!
+    * Discarding elements of \p history older than \p stableTime , except the latest ones.
+    * @param [in,out] history Target container
+    * @param [in] stableTime Watermark
+    */
+    static void compactHistory(History & history, const T & stableTime);
+
+
+    /*!
+    * Inserting key \p k known to be absent, cheapest when keys are inserted in less order.
+    * @param [in] k key
+    * @return empty history of key \p k
+    */
+    History & appendKey(const K & k);
+
+
+    /*!
+    * Inserting \p pair known to follow all elements of \p history in less order.
+    * @param [in,out] history Target container
+    * @param [in] pair Data to insert
+    */
+    static void appendElement(History & history, std::pair<V, T> && pair);
+
+};
+
+
+
+/*!
+* Default storage policy, \a BasicTreeStorage allocating from the global heap.
+*/
+template <typename K,
+          typename V,
+          typename T>
+using TreeStorage = BasicTreeStorage<K, V, T, std::map<K, std::multimap<V, T>>>;
+
+
+
+/*!
+* @struct LWWPool
+* @brief Owner of the memory pool of a pooled storage
+* @details Separate base class, so the pool is constructed before and destroyed after the containers allocating
+* from it.
+*/
+struct LWWPool {
+    std::shared_ptr<std::pmr::memory_resource> pool =
+        std::make_shared<std::pmr::synchronized_pool_resource>(); //!< Pool shared with moved-to instances
+};
+
+
+
+/*!
+* @class PooledTreeStorage
+* @brief \a BasicTreeStorage allocating its map and history nodes from a pool owned by the instance
+* @details Every instance, and so every dictionary and every shard of a sharded dictionary, owns an arena of
+* fixed-size node slabs, which keeps node allocations off the contended global heap and keeps nodes of one
+* dictionary close together. Copies allocate from their own new pool, moves share the pool of the source. The pool
+* is synchronized, since parallel merging inserts into distinct histories concurrently. Memory of erased nodes is
+* reused by the pool and returned to the heap once the instance is destroyed.
+* @tparam K key
+* @tparam V value
+* @tparam T timestamp
+*/
+template <typename K,
+          typename V,
+          typename T>
+class PooledTreeStorage : private LWWPool,
+                          public BasicTreeStorage<K, V, T, std::pmr::map<K, std::pmr::multimap<V, T>>> {
+private:
+    using Base = BasicTreeStorage<K, V, T, std::pmr::map<K, std::pmr::multimap<V, T>>>;
+
+
+public:
+    /*!
+    * Default constructor, creating the pool
+    */
+    PooledTreeStorage();
+
+
+    /*!
+    * Copy constructor, copying \p src into a new pool
+    * @param [in] src Copying source
+    */
+    PooledTreeStorage(const PooledTreeStorage & src);
+
+
+    /*!
+    * Move constructor, taking over nodes of \p src together with its pool
+    * @param [in] src Moving source
+    */
+    PooledTreeStorage(PooledTreeStorage && src);
+
+
+    /*!
+    * Copy assignment, copying elements of \p src into this instance's pool
+    * @param [in] src Copying source
+    * @return this instance
+    */
+    PooledTreeStorage & operator=(const PooledTreeStorage & src);
+
+
+    /*!
+    * Move assignment, moving elements of \p src into this instance's pool unless both share it
+    * @param [in] src Moving source
+    * @return this instance
+    */
+    PooledTreeStorage & operator=(PooledTreeStorage && src);
+};
+
+
+
+/*!
+* @class FlatStorage
+* @brief Cache-friendly history storage built on an open-addressing hash table of contiguous histories
+* @details Keys and their histories are stored densely in a single vector and indexed by a linear probing table
+* of (hash, slot) buckets. Every history is a vector of (value, timestamp) pairs sorted in the same less order as
+* \a TreeStorage , so both policies expose identical history contents. Iteration order over keys is unspecified.
+* Erasing a key moves the last key into its slot.
+* @tparam K key, hashed with \a std::hash
+* @tparam V value
+* @tparam T timestamp
+*/
+template <typename K,
+          typename V,
+          typename T>
+class FlatStorage {
+public:
+    using History = std::vector<std::pair<V, T>>; //!< Per-key history container
+    using key_type = K;
+    using mapped_type = History;
+    using value_type = std::pair<K, History>;
+    using size_type = std::size_t;
+    using iterator = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+
+private:
+    /*!
+    * @struct Bucket
+    * @brief Probing table entry
+    */
+    struct Bucket {
+        std::uint32_t hash = 0; //!< Lower bits of mixed key hash
+        std::uint32_t slot = 0; //!< One-based index into \a entries , 0 marks an empty bucket
+    };
+
+    std::vector<value_type> entries; //!< Densely stored keys and histories
+    std::vector<Bucket> buckets; //!< Linear probing table
+    std::size_t shift = 64; //!< Right shift mapping mixed hash to bucket index
+
+
+public:
+    /*!
+    * Default constructor
+    */
+    FlatStorage() = default;
+
+
+    /*!
+    * Finding key \p k .
+    * @param [in] k key
+    * @return iterator to key's entry if exists, \a end() otherwise
+    */
+    iterator find(const K & k);
+
+
+    /*!
+    * Finding key \p k .
+    * @param [in] k key
+    * @return iterator to key's entry if exists, \a end() otherwise
+    */
+    const_iterator find(const K & k) const;
+
+
+    /*!
+    * Accessing history for key \p k , inserting an empty one if key does not exist.
+    * @param [in] k key
+    * @return history for key \p k
+    */
+    History & operator[](const K & k);
+
+
+    /*!
+    * Accessing history for key \p k , inserting an empty one if key does not exist, moving \p k into the table.
+    * @param [in] k key
+    * @return history for key \p k
+    */
+    History & operator[](K && k);
+
+
+    /*!
+    * Erasing entry at \p pos . Last entry is moved into the erased slot.
+    * @param [in] pos Valid dereferenceable iterator
+    * @return iterator to the entry now occupying \p pos , or \a end()
+    */
+    iterator erase(iterator pos);
+
+
+    /*!
+    * Erasing key \p k .
+    * @param [in] k key
+    * @return number of erased entries
+    */
+    std::size_t erase(const K & k);
+
+
+    /*!
+    * Reserving space for at least \p count keys.
+    * @param [in] count Expected number of keys
+    */
+    void reserve(std::size_t count);
+
+
+    /*!
+    * Erasing all entries.
+    */
+    void clear();
+
+
+    iterator begin() { return this->entries.begin(); }
+    iterator end() { return this->entries.end(); }
+    const_iterator begin() const { return this->entries.begin(); }
+    const_iterator end() const { return this->entries.end(); }
+    std::size_t size() const { return this->entries.size(); }
+    bool empty() const { return this->entries.empty(); }
+
+
+    /*!
+    * Less-ordered insertion
+    * @param [in,out] history Target container
+    * @param [in] pair Data to insert, moved from if inserted
+    * @return true if \p pair was inserted, false if it was already present
+    */
+    static bool orderedInsert(History & history, std::pair<V, T> && pair);
+
+
+    /*!
+    * Fetching latest timestamp contained in \p history .
+    * @param [in] history Source container
+    * @return latest timestamp if \p history is not empty, empty otherwise
+    * @retval std::optional<T> timestamp type within std::optional container
+    */
+    static const std::optional<const T> lastTime(const History & history);
+
+
+    /*!
+    * Merging \p src into this instance probing every source key once and merging histories
+    * linearly.
+    * @param [in] src Merging source
+    * @param [in] onInserted Callable invoked with (key, value, timestamp) of every element of \p src not previously
+    * contained, referencing \p src
+    * @param [in] admit Predicate on timestamp, elements of \p src it rejects are skipped
+    */
+    template <typename F, typename A>
+    void merge(const FlatStorage & src, F && onInserted, A && admit);
+
+    /*!
+    * Merging history \p historySrc of key \p k into \p historyDest .
+    * @param [in] k key
+    * @param [in,out] historyDest Merging destination
+    * @param [in] historySrc Merging source
+    * @param [in] onInserted Callable invoked with (key, value, timestamp) of every element of \p historySrc not
+    * previously contained, referencing \p historySrc
+    * @param [in] admit Predicate on timestamp, elements of \p historySrc it rejects are skipped
+    */
+    template <typename F, typename A>
+    static void mergeHistory(const K & k, History & historyDest, const History & historySrc, F && onInserted, A && admit);
+
+
+    /*!
+    * Inserting empty histories for keys of \p src missing in this instance, so that afterwards histories can be
+    * merged concurrently without changing the container's structure.
+    * @param [in] src Merging source
+    */
+    void insertMissingKeys(const FlatStorage & src);
+
+
+    /*!
+    * Discarding elements of \p history older than \p stableTime , except the latest ones.
+    * @param [in,out] history Target container
+    * @param [in] stableTime Watermark
+    */
+    static void compactHistory(History & history, const T & stableTime);
+
+
+    /*!
+    * Inserting key \p k known to be absent, cheapest when keys are inserted in less order.
+    * @param [in] k key
+    * @return empty history of key \p k
+    */
+    History & appendKey(const K & k);
+
+
+    /*!
+    * Inserting \p pair known to follow all elements of \p history in less order.
+    * @param [in,out] history Target container
+    * @param [in] pair Data to insert
+    */
+    static void appendElement(History & history, std::pair<V, T> && pair);
+
+
+
+private:
+    /*!
+    * Mixing \a std::hash output so that low quality hashes (e.g. identity for integers) spread over buckets.
+    * @param [in] k key
+    * @return mixed hash
+    */
+    static std::uint64_t mixedHash(const K & k);
+
+
+    /*!
+    * Locating bucket holding key \p k .
+    * @param [in] k key
+    * @param [in] hash Mixed hash of \p k
+    * @return bucket index if key exists, \a buckets size otherwise
+    */
+    std::size_t findBucket(const K & k, const std::uint64_t & hash) const;
+
+
+    /*!
+    * Locating bucket pointing at entry \p slot .
+    * @param [in] slot Zero-based entry index
+    * @return bucket index
+    */
+    std::size_t findBucketBySlot(const std::size_t & slot) const;
+
+
+    /*!
+    * Placing entry \p slot into the first free bucket of its probe sequence.
+    * @param [in] hash Mixed hash of entry's key
+    * @param [in] slot Zero-based entry index
+    */
+    void placeBucket(const std::uint64_t & hash, const std::size_t & slot);
+
+
+    /*!
+    * Accessing history for key \p k , inserting an empty one if key does not exist.
+    * @param [in] k key, moved into the table if passed as rvalue
+    * @return history for key \p k
+    */
+    template <typename KArg>
+    History & accessKey(KArg && k);
+
+
+    /*!
+    * Rebuilding probing table with \p capacity buckets.
+    * @param [in] capacity Power of two bucket count
+    */
+    void rehash(const std::size_t & capacity);
+};
+
+
+
+/*!
+* @class LWWRegister
+* @brief Single-slot history keeping only the winning (value, timestamp) pair
+* @details A pair replaces the held one only if it wins by \a lwwSupersedes , exactly as in \a currentData of a
+* full-history dictionary, so registers of replicas agree regardless of arrival order.
+* Iterable as a history of zero or one elements.
+* @tparam V value
+* @tparam T timestamp
+*/
+template <typename V,
+          typename T>
+class LWWRegister {
+public:
+    using value_type = std::pair<V, T>;
+    using const_iterator = const value_type *;
+
+
+private:
+    std::optional<value_type> winner; //!< Winning pair, empty until first insertion
+
+
+public:
+    /*!
+    * Replacing held pair with \p pair if \p pair wins.
+    * @param [in] pair Candidate pair
+    * @return true if \p pair replaced held pair, false otherwise
+    */
+    bool assign(const value_type & pair) {
+        if(this->winner && !lwwSupersedes(pair.first, pair.second, this->winner->first, this->winner->second)) {
+            return false;
+        }
+
+        this->winner = pair;
+        return true;
+    }
+
+
+    /*!
+    * Replacing held pair with \p pair if \p pair wins.
+    * @param [in] pair Candidate pair, moved from if it replaced held pair
+    * @return true if \p pair replaced held pair, false otherwise
+    */
+    bool assign(value_type && pair) {
+        if(this->winner && !lwwSupersedes(pair.first, pair.second, this->winner->first, this->winner->second)) {
+            return false;
+        }
+
+        this->winner = std::move(pair);
+        return true;
+    }
+
+
+    const_iterator begin() const { return this->winner ? &*this->winner : nullptr; }
+    const_iterator end() const { return this->winner ? &*this->winner + 1 : nullptr; }
+    std::size_t size() const { return this->winner ? 1 : 0; }
+    bool empty() const { return !this->winner; }
+};
+
+
+
+/*!
+* @class CompactStorage
+* @brief Constant-size per-key history storage
+* @details Every key stores only its winning pair in an \a LWWRegister . Used for \a addedData it keeps the latest
+* add (value, timestamp), for \a removedData the latest removal timestamp. Memory is proportional to the number of
+* keys instead of the number of operations, merging reduces to a per-key maximum and \a currentData evolves exactly
+* as with full-history policies. Superseded pairs are not retained, so histories are not replayable.
+* @tparam K key
+* @tparam V value
+* @tparam T timestamp
+*/
+template <typename K,
+          typename V,
+          typename T>
+class CompactStorage : public std::map<K, LWWRegister<V, T>> {
+public:
+    using History = LWWRegister<V, T>; //!< Per-key history container
+
+
+    using std::map<K, LWWRegister<V, T>>::map;
+
+
+    /*!
+    * Keeping newer of held pair and \p pair .
+    * @param [in,out] history Target register
+    * @param [in] pair Data to insert, moved from if it became the held pair
+    * @return true if \p pair became the held pair, false otherwise
+    */
+    static bool orderedInsert(History & history, std::pair<V, T> && pair) {
+        return history.assign(std::move(pair));
+    }
+
+
+    /*!
+    * Fetching timestamp of held pair.
+    * @param [in] history Source register
+    * @return held pair's timestamp if exists, empty otherwise
+    * @retval std::optional<T> timestamp type within std::optional container
+    */
+    static const std::optional<const T> lastTime(const History & history) {
+        if(history.empty()) {
+            return {};
+        }
+
+        return { history.begin()->second };
+    }
+
+
+    /*!
+    * Merging \p src into this instance in a single ordered pass, keeping the newer register per key.
+    * @param [in] src Merging source
+    * @param [in] onInserted Callable invoked with (key, value, timestamp) of every element of \p src not previously
+    * contained, referencing \p src
+    * @param [in] admit Predicate on timestamp, elements of \p src it rejects are skipped
+    */
+    template <typename F, typename A>
+    void merge(const CompactStorage & src, F && onInserted, A && admit);
+
+    /*!
+    * Merging history \p historySrc of key \p k into \p historyDest .
+    * @param [in] k key
+    * @param [in,out] historyDest Merging destination
+    * @param [in] historySrc Merging source
+    * @param [in] onInserted Callable invoked with (key, value, timestamp) of every element of \p historySrc not
+    * previously contained, referencing \p historySrc
+    * @param [in] admit Predicate on timestamp, elements of \p historySrc it rejects are skipped
+    */
+    template <typename F, typename A>
+    static void mergeHistory(const K & k, History & historyDest, const History & historySrc, F && onInserted, A && admit);
+
+
+    /*!
+    * Inserting empty histories for keys of \p src missing in this instance, so that afterwards histories can be
+    * merged concurrently without changing the container's structure.
+    * @param [in] src Merging source
+    */
+    void insertMissingKeys(const CompactStorage & src);
+
+
+    /*!
+    * Discarding elements of \p history older than \p stableTime , except the latest ones.
+    * @param [in,out] history Target container
+    * @param [in] stableTime Watermark
+    */
+    static void compactHistory(History & history, const T & stableTime);
+
+
+    /*!
+    * Inserting key \p k known to be absent, cheapest when keys are inserted in less order.
+    * @param [in] k key
+    * @return empty history of key \p k
+    */
+    History & appendKey(const K & k);
+
+
+    /*!
+    * Inserting \p pair known to follow all elements of \p history in less order.
+    * @param [in,out] history Target container
+    * @param [in] pair Data to insert
+    */
+    static void appendElement(History & history, std::pair<V, T> && pair);
+
+};
+
+
+
+template <typename K, typename V, typename T>
+template <typename F, typename A>
+void CompactStorage<K, V, T>::merge(const CompactStorage & src, F && onInserted, A && admit) {
+    mergeOrderedMaps(*this, src,
+        [](const K & k, History & historyDest, const History & historySrc, F & onInserted, A & admit) {
+            mergeHistory(k, historyDest, historySrc, onInserted, admit);
+        },
+        onInserted,
+        admit
+    );
+}
+
+
+
+template <typename K, typename V, typename T>
+template <typename F, typename A>
+void CompactStorage<K, V, T>::mergeHistory(
+    const K & k,
+    History & historyDest,
+    const History & historySrc,
+    F && onInserted,
+    A && admit
+) {
+    for(const auto & pair : historySrc) {
+        if(admit(pair.second) && historyDest.assign(pair)) {
+            onInserted(k, pair.first, pair.second);
+        }
+    }
+}
+
+
+
+template <typename K, typename V, typename T>
+void CompactStorage<K, V, T>::insertMissingKeys(const CompactStorage & src) {
+    auto destIter = this->begin();
+
+    for(const auto & entry : src) {
+        destIter = orderedSeek(*this, destIter, entry.first);
+        if(destIter == this->end() || entry.first < destIter->first) {
+            destIter = this->emplace_hint(destIter, entry.first, History());
+        }
+        ++destIter;
+    }
+}
+
+
+
+template <typename K, typename V, typename T>
+void CompactStorage<K, V, T>::compactHistory(History &, const T &) {
+}
+
+
+
+template <typename K, typename V, typename T>
+typename CompactStorage<K, V, T>::History & CompactStorage<K, V, T>::appendKey(const K & k) {
+    return this->emplace_hint(this->end(), k, History())->second;
+}
+
+
+
+template <typename K, typename V, typename T>
+void CompactStorage<K, V, T>::appendElement(History & history, std::pair<V, T> && pair) {
+    history.assign(std::move(pair));
+}
+
+
+
+template <typename K, typename V, typename T, typename Map>
+bool BasicTreeStorage<K, V, T, Map>::orderedInsert(
+    History & history,
+    std::pair<V, T> && pair
+) {
+    const auto historyRange = history.equal_range(pair.first);
+
+    for(auto historyIter = historyRange.first; historyIter != historyRange.second; ++historyIter) {
+        if(pair.second < historyIter->second) {
+            history.insert(historyIter, std::move(pair));
+            return true;
+        } else if(!(historyIter->second < pair.second)) {
+            return false;
+        }
+    }
+
+    history.insert(historyRange.second, std::move(pair));
+    return true;
+}
+
+
+
+template <typename K, typename V, typename T, typename Map>
+const std::optional<const T> BasicTreeStorage<K, V, T, Map>::lastTime(const History & history) {
+    if(history.empty()) {
+        return {};
+    }
+
+    auto historyIter = history.begin();
+    const T * last = &historyIter->second;
+
+    for(++historyIter; historyIter != history.end(); ++historyIter) {
+        if(*last < historyIter->second) {
+            last = &historyIter->second;
+        }
+    }
+
+    return { *last };
+}
+
+
+
+template <typename K, typename V, typename T, typename Map>
+template <typename F, typename A>
+void BasicTreeStorage<K, V, T, Map>::merge(const BasicTreeStorage & src, F && onInserted, A && admit) {
+    mergeOrderedMaps(*this, src,
+        [](const K & k, History & historyDest, const History & historySrc, F & onInserted, A & admit) {
+            mergeHistory(k, historyDest, historySrc, onInserted, admit);
+        },
+        onInserted,
+        admit
+    );
+}
+
+
+
+template <typename K, typename V, typename T, typename Map>
+template <typename F, typename A>
+void BasicTreeStorage<K, V, T, Map>::mergeHistory(
+    const K & k,
+    History & historyDest,
+    const History & historySrc,
+    F && onInserted,
+    A && admit
+) {
+    auto destIter = historyDest.begin();
+
+    for(const auto & [v, t] : historySrc) {
+        if(!admit(t)) {
+            continue;
+        }
+
+        while(destIter != historyDest.end()
+            && (destIter->first < v || (!(v < destIter->first) && destIter->second < t))) {
+            ++destIter;
+        }
+
+        if(destIter != historyDest.end() && !(v < destIter->first) && !(t < destIter->second)) {
+            continue;
+        }
+
+        historyDest.insert(destIter, { v, t });
+        onInserted(k, v, t);
+    }
+}
+
+
+
+template <typename K, typename V, typename T, typename Map>
+void BasicTreeStorage<K, V, T, Map>::insertMissingKeys(const BasicTreeStorage & src) {
+    auto destIter = this->begin();
+
+    for(const auto & entry : src) {
+        destIter = orderedSeek(*this, destIter, entry.first);
+        if(destIter == this->end() || entry.first < destIter->first) {
+            destIter = this->emplace_hint(destIter, entry.first, History());
+        }
+        ++destIter;
+    }
+}
+
+
+
+template <typename K, typename V, typename T, typename Map>
+void BasicTreeStorage<K, V, T, Map>::compactHistory(History & history, const T & stableTime) {
+    const auto last = lastTime(history);
+
+    for(auto historyIter = history.begin(); historyIter != history.end();) {
+        if(historyIter->second < stableTime && historyIter->second < *last) {
+            historyIter = history.erase(historyIter);
+        } else {
+            ++historyIter;
+        }
+    }
+}
+
+
+
+template <typename K, typename V, typename T, typename Map>
+typename BasicTreeStorage<K, V, T, Map>::History & BasicTreeStorage<K, V, T, Map>::appendKey(const K & k) {
+    return this->emplace_hint(this->end(), k, History())->second;
+}
+
+
+
+template <typename K, typename V, typename T, typename Map>
+void BasicTreeStorage<K, V, T, Map>::appendElement(History & history, std::pair<V, T> && pair) {
+    history.emplace_hint(history.end(), std::move(pair));
+}
+
+
+
+template <typename K, typename V, typename T>
+PooledTreeStorage<K, V, T>::PooledTreeStorage() : Base(this->pool.get()) {}
+
+
+
+template <typename K, typename V, typename T>
+PooledTreeStorage<K, V, T>::PooledTreeStorage(
+    const PooledTreeStorage & src
+) : LWWPool(), Base(src, this->pool.get()) {}
+
+
+
+template <typename K, typename V, typename T>
+PooledTreeStorage<K, V, T>::PooledTreeStorage(
+    PooledTreeStorage && src
+) : LWWPool(src), Base(std::move(src)) {}
+
+
+
+template <typename K, typename V, typename T>
+PooledTreeStorage<K, V, T> & PooledTreeStorage<K, V, T>::operator=(const PooledTreeStorage & src) {
+    // Polymorphic allocators do not propagate, the pool is kept.
+    Base::operator=(src);
+    return *this;
+}
+
+
+
+template <typename K, typename V, typename T>
+PooledTreeStorage<K, V, T> & PooledTreeStorage<K, V, T>::operator=(PooledTreeStorage && src) {
+    Base::operator=(std::move(src));
+    return *this;
+}
+
+
+
+template <typename K, typename V, typename T>
+typename FlatStorage<K, V, T>::iterator FlatStorage<K, V, T>::find(const K & k) {
+    const std::size_t bucket = this->findBucket(k, mixedHash(k));
+
+    if(bucket == this->buckets.size()) {
+        return this->entries.end();
+    }
+
+    return this->entries.begin() + (this->buckets[bucket].slot - 1);
+}
+
+
+
+template <typename K, typename V, typename T>
+typename FlatStorage<K, V, T>::const_iterator FlatStorage<K, V, T>::find(const K & k) const {
+    const std::size_t bucket = this->findBucket(k, mixedHash(k));
+
+    if(bucket == this->buckets.size()) {
+        return this->entries.end();
+    }
+
+    return this->entries.begin() + (this->buckets[bucket].slot - 1);
+}
+
+
+
+template <typename K, typename V, typename T>
+typename FlatStorage<K, V, T>::History & FlatStorage<K, V, T>::operator[](const K & k) {
+    return this->accessKey(k);
+}
+
+
+
+template <typename K, typename V, typename T>
+typename FlatStorage<K, V, T>::History & FlatStorage<K, V, T>::operator[](K && k) {
+    return this->accessKey(std::move(k));
+}
+
+
+
+template <typename K, typename V, typename T>
+template <typename KArg>
+typename FlatStorage<K, V, T>::History & FlatStorage<K, V, T>::accessKey(KArg && k) {
+    const std::uint64_t hash = mixedHash(k);
+    const std::size_t bucket = this->findBucket(k, hash);
+
+    if(bucket != this->buckets.size()) {
+        return this->entries[this->buckets[bucket].slot - 1].second;
+    }
+
+    // Keeping load factor at or below 3/4.
+    if((this->entries.size() + 1) * 4 > this->buckets.size() * 3) {
+        this->rehash(this->buckets.empty() ? 16 : this->buckets.size() * 2);
+    }
+
+    this->entries.emplace_back(std::forward<KArg>(k), History());
+    this->placeBucket(hash, this->entries.size() - 1);
+
+    return this->entries.back().second;
+}
+
+
+
+template <typename K, typename V, typename T>
+typename FlatStorage<K, V, T>::iterator FlatStorage<K, V, T>::erase(iterator pos) {
+    const std::size_t slot = pos - this->entries.begin();
+    const std::size_t mask = this->buckets.size() - 1;
+    std::size_t hole = this->findBucketBySlot(slot);
+
+    // Backward shift deletion keeps probe sequences free of tombstones.
+    for(std::size_t next = (hole + 1) & mask; this->buckets[next].slot != 0; next = (next + 1) & mask) {
+        const std::size_t ideal = mixedHash(this->entries[this->buckets[next].slot - 1].first) >> this->shift;
+
+        if(((next - ideal) & mask) >= ((next - hole) & mask)) {
+            this->buckets[hole] = this->buckets[next];
+            hole = next;
+        }
+    }
+    this->buckets[hole] = Bucket();
+
+    const std::size_t lastSlot = this->entries.size() - 1;
+    if(slot != lastSlot) {
+        this->buckets[this->findBucketBySlot(lastSlot)].slot = static_cast<std::uint32_t>(slot + 1);
+        this->entries[slot] = std::move(this->entries[lastSlot]);
+    }
+    this->entries.pop_back();
+
+    return this->entries.begin() + slot;
+}
+
+
+
+template <typename K, typename V, typename T>
+std::size_t FlatStorage<K, V, T>::erase(const K & k) {
+    const auto entryIter = this->find(k);
+
+    if(entryIter == this->entries.end()) {
+        return 0;
+    }
+
+    this->erase(entryIter);
+    return 1;
+}
+
+
+
+template <typename K, typename V, typename T>
+void FlatStorage<K, V, T>::reserve(std::size_t count) {
+    std::size_t capacity = this->buckets.empty() ? 16 : this->buckets.size();
+
+    while(count * 4 > capacity * 3) {
+        capacity *= 2;
+    }
+
+    this->entries.reserve(count);
+
+    if(capacity != this->buckets.size()) {
+        this->rehash(capacity);
+    }
+}
+
+
+
+template <typename K, typename V, typename T>
+void FlatStorage<K, V, T>::clear() {
+    this->entries.clear();
+    std::fill(this->buckets.begin(), this->buckets.end(), Bucket());
+}
+
+
+
+template <typename K, typename V, typename T>
+bool FlatStorage<K, V, T>::orderedInsert(
+    History & history,
+    std::pair<V, T> && pair
+) {
+    const auto historyIter = std::lower_bound(history.begin(), history.end(), pair);
+
+    if(historyIter != history.end() && !(pair < *historyIter)) {
+        return false;
+    }
+
+    history.insert(historyIter, std::move(pair));
+    return true;
+}
+
+
+
+template <typename K, typename V, typename T>
+const std::optional<const T> FlatStorage<K, V, T>::lastTime(const History & history) {
+    if(history.empty()) {
+        return {};
+    }
+
+    const T * last = &history.front().second;
+
+    for(const auto & [v, t] : history) {
+        if(*last < t) {
+            last = &t;
+        }
+    }
+
+    return { *last };
+}
+
+
+
+template <typename K, typename V, typename T>
+template <typename F, typename A>
+void FlatStorage<K, V, T>::merge(const FlatStorage & src, F && onInserted, A && admit) {
+    // Sized for disjoint key sets, so the table never rehashes partway through.
+    this->reserve(this->size() + src.size());
+
+    for(const auto & [keySrc, historySrc] : src) {
+        const auto entryIter = this->find(keySrc);
+
+        if(entryIter == this->end()) {
+            History admitted;
+            admitted.reserve(historySrc.size());
+
+            for(const auto & pair : historySrc) {
+                if(admit(pair.second)) {
+                    admitted.push_back(pair);
+                    onInserted(keySrc, pair.first, pair.second);
+                }
+            }
+
+            if(!admitted.empty()) {
+                (*this)[keySrc] = std::move(admitted);
+            }
+            continue;
+        }
+
+        mergeHistory(keySrc, entryIter->second, historySrc, onInserted, admit);
+    }
+}
+
+
+
+template <typename K, typename V, typename T>
+template <typename F, typename A>
+void FlatStorage<K, V, T>::mergeHistory(
+    const K & k,
+    History & historyDest,
+    const History & historySrc,
+    F && onInserted,
+    A && admit
+) {
+    if(std::includes(historyDest.begin(), historyDest.end(), historySrc.begin(), historySrc.end())) {
+        return;
+    }
+
+    History merged;
+    merged.reserve(historyDest.size() + historySrc.size());
+    auto destIter = historyDest.begin();
+
+    for(const auto & pair : historySrc) {
+        while(destIter != historyDest.end() && *destIter < pair) {
+            merged.push_back(std::move(*destIter++));
+        }
+
+        if(!admit(pair.second) || (destIter != historyDest.end() && !(pair < *destIter))) {
+            continue;
+        }
+
+        merged.push_back(pair);
+        onInserted(k, pair.first, pair.second);
+    }
+
+    merged.insert(merged.end(), std::make_move_iterator(destIter), std::make_move_iterator(historyDest.end()));
+    historyDest.swap(merged);
+}
+
+
+
+template <typename K, typename V, typename T>
+void FlatStorage<K, V, T>::insertMissingKeys(const FlatStorage & src) {
+    // Sized for disjoint key sets, so the table never rehashes partway through.
+    this->reserve(this->size() + src.size());
+
+    for(const auto & entry : src) {
+        (*this)[entry.first];
+    }
+}
+
+
+
+template <typename K, typename V, typename T>
+void FlatStorage<K, V, T>::compactHistory(History & history, const T & stableTime) {
+    const auto last = lastTime(history);
+
+    history.erase(
+        std::remove_if(history.begin(), history.end(), [&](const auto & pair) {
+            return pair.second < stableTime && pair.second < *last;
+        }),
+        history.end()
+    );
+}
+
+
+
+template <typename K, typename V, typename T>
+typename FlatStorage<K, V, T>::History & FlatStorage<K, V, T>::appendKey(const K & k) {
+    return (*this)[k];
+}
+
+
+
+template <typename K, typename V, typename T>
+void FlatStorage<K, V, T>::appendElement(History & history, std::pair<V, T> && pair) {
+    history.push_back(std::move(pair));
+}
+
+
+
+template <typename K, typename V, typename T>
+std::uint64_t FlatStorage<K, V, T>::mixedHash(const K & k) {
+    return static_cast<std::uint64_t>(std::hash<K>()(k)) * 0x9E3779B97F4A7C15ull;
+}
+
+
+
+template <typename K, typename V, typename T>
+std::size_t FlatStorage<K, V, T>::findBucket(const K & k, const std::uint64_t & hash) const {
+    if(this->buckets.empty()) {
+        return 0;
+    }
+
+    const std::size_t mask = this->buckets.size() - 1;
+    const std::uint32_t fingerprint = static_cast<std::uint32_t>(hash);
+
+    for(std::size_t bucket = hash >> this->shift; this->buckets[bucket].slot != 0; bucket = (bucket + 1) & mask) {
+        if(this->buckets[bucket].hash == fingerprint && this->entries[this->buckets[bucket].slot - 1].first == k) {
+            return bucket;
+        }
+    }
+
+    return this->buckets.size();
+}
+
+
+
+template <typename K, typename V, typename T>
+std::size_t FlatStorage<K, V, T>::findBucketBySlot(const std::size_t & slot) const {
+    const std::size_t mask = this->buckets.size() - 1;
+    std::size_t bucket = mixedHash(this->entries[slot].first) >> this->shift;
+
+    while(this->buckets[bucket].slot != slot + 1) {
+        bucket = (bucket + 1) & mask;
+    }
+
+    return bucket;
+}
+
+
+
+template <typename K, typename V, typename T>
+void FlatStorage<K, V, T>::placeBucket(const std::uint64_t & hash, const std::size_t & slot) {
+    const std::size_t mask = this->buckets.size() - 1;
+    std::size_t bucket = hash >> this->shift;
+
+    while(this->buckets[bucket].slot != 0) {
+        bucket = (bucket + 1) & mask;
+    }
+
+    this->buckets[bucket] = { static_cast<std::uint32_t>(hash), static_cast<std::uint32_t>(slot + 1) };
+}
+
+
+
+template <typename K, typename V, typename T>
+void FlatStorage<K, V, T>::rehash(const std::size_t & capacity) {
+    this->buckets.assign(capacity, Bucket());
+
+    this->shift = 64;
+    for(std::size_t bucketCount = capacity; bucketCount > 1; bucketCount >>= 1) {
+        --this->shift;
+    }
+
+    for(std::size_t slot = 0; slot < this->entries.size(); ++slot) {
+        this->placeBucket(mixedHash(this->entries[slot].first), slot);
+    }
+}
+
+
+
+#endif // LWWSTORAGE_H
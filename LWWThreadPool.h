@@ -0,0 +1,203 @@
+/*!
+* @file LWWThreadPool.h
+* @brief Contains fixed-size thread pool executing parallel loops
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LWWTHREADPOOL_H
+#define LWWTHREADPOOL_H
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+/*!
+* @class LWWThreadPool
+* @brief Fixed set of worker threads sharing the iterations of one parallel loop at a time
+* @details The calling thread takes part in every loop, so a pool of N threads starts N - 1 workers.
+* Iterations are handed out one by one from a shared counter, which balances unevenly sized iterations.
+*/
+class LWWThreadPool {
+private:
+    std::vector<std::thread> workers; //!< Worker threads
+
+    std::mutex runMtx; //!< Serializes loops of concurrent callers
+    std::mutex mtx; //!< Guards loop state
+    std::condition_variable wake; //!< Signals workers a new loop or shutdown
+    std::condition_variable done; //!< Signals the caller that every worker left the loop
+
+    const std::function<void(std::size_t)> * body = nullptr; //!< Loop body of current loop
+    std::size_t iterationCount = 0; //!< Number of iterations of current loop
+    std::atomic<std::size_t> nextIteration { 0 }; //!< Next iteration to be handed out
+    std::size_t activeWorkers = 0; //!< Workers that have not yet left current loop
+    std::uint64_t generation = 0; //!< Number of loops started
+    bool stopFlag = false; //!< Workers are to exit
+    std::exception_ptr error; //!< First exception thrown by current loop's body
+
+
+public:
+    /*!
+    * Constructor
+    * @param [in] threadCount Number of threads executing every loop, including the caller, at least 1
+    */
+    explicit LWWThreadPool(const std::size_t & threadCount = std::thread::hardware_concurrency());
+
+
+    LWWThreadPool(const LWWThreadPool &) = delete;
+    LWWThreadPool & operator=(const LWWThreadPool &) = delete;
+
+
+    /*!
+    * Destructor, joining workers
+    */
+    virtual ~LWWThreadPool();
+
+
+    /*!
+    * Invoking \p body with every index in [0, \p count ) on the pool's threads and waiting for completion.
+    * @param [in] count Number of iterations
+    * @param [in] body Callable accepting iteration index, invoked concurrently
+    * @throw first exception thrown by \p body , remaining iterations are skipped then
+    */
+    template <typename F>
+    void parallelFor(const std::size_t & count, F && body);
+
+
+    std::size_t getThreadCount() const;
+
+
+private:
+    /*!
+    * Worker thread body, taking part in every loop until shutdown.
+    */
+    void runWorker();
+
+
+    /*!
+    * Executing iterations of current loop until none are left.
+    */
+    void drain();
+};
+
+
+
+inline LWWThreadPool::LWWThreadPool(
+    const std::size_t & threadCount
+) {
+    for(std::size_t index = 1; index < threadCount; ++index) {
+        this->workers.emplace_back(&LWWThreadPool::runWorker, this);
+    }
+}
+
+
+
+inline LWWThreadPool::~LWWThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->stopFlag = true;
+    }
+    this->wake.notify_all();
+
+    for(auto & worker : this->workers) {
+        worker.join();
+    }
+}
+
+
+
+template <typename F>
+void LWWThreadPool::parallelFor(const std::size_t & count, F && body) {
+    if(count == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLock(this->runMtx);
+    const std::function<void(std::size_t)> function = [&body](std::size_t index) {
+        body(index);
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(this->mtx);
+        this->body = &function;
+        this->iterationCount = count;
+        this->nextIteration.store(0);
+        this->activeWorkers = this->workers.size();
+        this->error = nullptr;
+        ++this->generation;
+    }
+    this->wake.notify_all();
+
+    this->drain();
+
+    std::unique_lock<std::mutex> lock(this->mtx);
+    this->done.wait(lock, [this]() {
+        return this->activeWorkers == 0;
+    });
+    this->body = nullptr;
+
+    if(this->error) {
+        std::rethrow_exception(std::exchange(this->error, nullptr));
+    }
+}
+
+
+
+inline std::size_t LWWThreadPool::getThreadCount() const {
+    return this->workers.size() + 1;
+}
+
+
+
+inline void LWWThreadPool::runWorker() {
+    std::uint64_t seenGeneration = 0;
+    std::unique_lock<std::mutex> lock(this->mtx);
+
+    while(true) {
+        this->wake.wait(lock, [this, &seenGeneration]() {
+            return this->stopFlag || this->generation != seenGeneration;
+        });
+        if(this->stopFlag) {
+            return;
+        }
+        seenGeneration = this->generation;
+
+        lock.unlock();
+        this->drain();
+        lock.lock();
+
+        if(--this->activeWorkers == 0) {
+            this->done.notify_one();
+        }
+    }
+}
+
+
+
+inline void LWWThreadPool::drain() {
+    for(std::size_t index = this->nextIteration.fetch_add(1);
+        index < this->iterationCount;
+        index = this->nextIteration.fetch_add(1)) {
+        try {
+            (*this->body)(index);
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(this->mtx);
+            if(!this->error) {
+                this->error = std::current_exception();
+            }
+            this->nextIteration.store(this->iterationCount);
+        }
+    }
+}
+
+
+
+#endif // LWWTHREADPOOL_H
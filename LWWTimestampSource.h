@@ -0,0 +1,136 @@
+/*!
+* @file LWWTimestampSource.h
+* @brief Contains sources of timestamps for automatically stamped operations
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LWWTIMESTAMPSOURCE_H
+#define LWWTIMESTAMPSOURCE_H
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <stdexcept>
+#include <type_traits>
+
+#include "LWWHybridLogicalClock.h"
+
+
+/*!
+* @struct LWWTimestampSource
+* @brief Source of timestamps for operations stamped by the dictionary. Specialize for user timestamp types.
+* @details A specialization is default constructible and provides \a next() returning a timestamp greater than every
+* timestamp it returned before on the calling thread and unequal to those of other threads, along with a call operator
+* forwarding to it. Dictionaries stamp with a default
+* constructed source unless given their own one, see \a LWWElementDict::setTimestampSource . Time points of
+* std::chrono clocks and \a LWWHybridTimestamp are provided.
+* @tparam T timestamp
+*/
+template <typename T, typename Enable = void>
+struct LWWTimestampSource;
+
+
+
+/*!
+* Reading \p Clock cheaply. System and steady clocks are read from the kernel's coarse clocks, updated once per tick,
+* which costs a few nanoseconds instead of a full clock read.
+* @return current time of \p Clock at tick resolution
+*/
+template <typename Clock>
+typename Clock::time_point lwwCoarseNow() {
+#if defined(CLOCK_REALTIME_COARSE) && defined(CLOCK_MONOTONIC_COARSE)
+    constexpr bool systemFlag = std::is_same_v<Clock, std::chrono::system_clock>;
+    constexpr bool steadyFlag = std::is_same_v<Clock, std::chrono::steady_clock>;
+
+    if constexpr(systemFlag || steadyFlag) {
+        timespec time;
+        ::clock_gettime(systemFlag ? CLOCK_REALTIME_COARSE : CLOCK_MONOTONIC_COARSE, &time);
+        const auto sinceEpoch = std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+        return typename Clock::time_point(std::chrono::duration_cast<typename Clock::duration>(sinceEpoch));
+    }
+#endif
+
+    return Clock::now();
+}
+
+
+
+/*!
+* @struct LWWTimestampSource
+* @brief Time points, read from the coarse clock and advanced per operation within a clock tick
+* @details Every thread keeps its own latest timestamp and stamps only ticks of \a Duration congruent to its slot
+* modulo \a slotCount , so timestamps of a thread are strictly increasing and threads never issue equal timestamps
+* without sharing any state after their first call. Slots are handed out in order of first use and repeat after
+* \a slotCount threads. Threads issuing more operations per clock tick than \a Duration has ticks per clock tick,
+* divided by \a slotCount , run ahead of the clock until it catches up.
+*/
+template <typename Clock, typename Duration>
+struct LWWTimestampSource<std::chrono::time_point<Clock, Duration>> {
+    using TimePoint = std::chrono::time_point<Clock, Duration>;
+    using Rep = typename Duration::rep;
+
+    static constexpr Rep slotCount = 256; //!< Number of thread slots interleaved within ticks of \a Duration
+
+    TimePoint next() const {
+        thread_local const Rep slot = static_cast<Rep>(nextSlot().fetch_add(1, std::memory_order_relaxed) % slotCount);
+        thread_local Rep last = TimePoint::min().time_since_epoch().count();
+
+        const Rep now = std::chrono::time_point_cast<Duration>(lwwCoarseNow<Clock>()).time_since_epoch().count();
+        const Rep floor = now > last ? now : last + 1;
+
+        // Smallest tick of the thread's slot not preceding the floor.
+        last = floor + ((slot - floor) % slotCount + slotCount) % slotCount;
+        return TimePoint(Duration(last));
+    }
+
+    TimePoint operator()() const {
+        return this->next();
+    }
+
+private:
+    static std::atomic<std::uint32_t> & nextSlot() {
+        static std::atomic<std::uint32_t> slot { 0 };
+        return slot;
+    }
+};
+
+
+
+/*!
+* @struct LWWTimestampSource
+* @brief Hybrid logical clock timestamps, issued by the clock of one replica
+* @details Timestamps are strictly increasing across all threads using the clock. A default constructed source has no
+* clock and refuses to issue timestamps, so every replica has to give its dictionaries a source of its own clock.
+*/
+template <>
+struct LWWTimestampSource<LWWHybridTimestamp> {
+    LWWTimestampSource() = default;
+
+
+    /*!
+    * Constructor
+    * @param [in] clock Clock of this replica, must outlive the source
+    */
+    explicit LWWTimestampSource(LWWHybridLogicalClock & clock) : clock(&clock) {}
+
+
+    LWWHybridTimestamp next() const {
+        if(!this->clock) {
+            throw std::logic_error("LWW timestamp source: no hybrid logical clock given");
+        }
+        return this->clock->now();
+    }
+
+    LWWHybridTimestamp operator()() const {
+        return this->next();
+    }
+
+private:
+    LWWHybridLogicalClock * clock = nullptr; //!< Clock of this replica
+};
+
+
+
+#endif // LWWTIMESTAMPSOURCE_H
@@ -0,0 +1,376 @@
+/*!
+* @file LWWWriteAheadLog.h
+* @brief Contains append-only write-ahead log with group commit
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LWWWRITEAHEADLOG_H
+#define LWWWRITEAHEADLOG_H
+
+
+#include <array>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*!
+* Computing CRC-32 (IEEE 802.3) of \p size bytes starting at \p data .
+* @param [in] data Source bytes
+* @param [in] size Number of bytes
+* @param [in] previous Checksum of preceding bytes, to checksum bytes split into several parts
+* @return checksum
+*/
+inline std::uint32_t lwwCrc32(const char * data, const std::size_t & size, const std::uint32_t & previous = 0) {
+    static const auto table = [] {
+        std::array<std::uint32_t, 256> entries {};
+        for(std::uint32_t index = 0; index < entries.size(); ++index) {
+            std::uint32_t crc = index;
+            for(int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1u) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+            }
+            entries[index] = crc;
+        }
+        return entries;
+    }();
+
+    std::uint32_t crc = previous ^ 0xFFFFFFFFu;
+    for(std::size_t index = 0; index < size; ++index) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[index])) & 0xFFu] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+
+
+/*!
+* @class LWWWriteAheadLog
+* @brief Durable append-only log of opaque records
+* @details Every record is framed as u32 payload length, u32 CRC-32 of length and payload, and payload. Covering the
+* length, the checksum never checks out for zero bytes a crash leaves on a preallocated or extended file. Concurrent
+* committers are batched by group commit: the first committer to find no flush in progress becomes leader, writes
+* every record appended so far with a single write and a single fdatasync, and wakes the followers whose records it
+* covered.
+* Recovery accepts the longest prefix of intact records and cuts off the rest, which is what a crash during an
+* append leaves behind.
+*/
+class LWWWriteAheadLog {
+private:
+    static constexpr char magic[4] = { 'L', 'W', 'W', 'L' }; //!< Leading bytes of every log file
+    static constexpr std::uint32_t formatVersion = 2; //!< Current format version
+    static constexpr std::size_t headerSize = 8; //!< Magic and format version
+    static constexpr std::size_t frameSize = 8; //!< Payload length and checksum preceding every payload
+
+    int fd = -1; //!< Log file descriptor
+
+    std::mutex mtx; //!< Guards group commit state
+    std::condition_variable flushed; //!< Signalled whenever a leader finishes flushing
+    std::vector<char> pending; //!< Framed records appended but not yet written
+    std::uint64_t appendedOffset = 0; //!< Log offset following the last appended record
+    std::uint64_t durableOffset = 0; //!< Log offset up to which records are on stable storage
+    bool flushingFlag = false; //!< A leader is writing and syncing
+    bool failedFlag = false; //!< A flush failed, the file may hold a torn tail and no longer accepts records
+    std::uint64_t syncCount = 0; //!< Number of fdatasync calls issued
+
+
+public:
+    /*!
+    * Opening log file \p path , creating it if missing. Records must be recovered before new ones are committed.
+    * @param [in] path Log file
+    * @throw std::system_error if the file cannot be opened
+    */
+    explicit LWWWriteAheadLog(const std::string & path);
+
+
+    LWWWriteAheadLog(const LWWWriteAheadLog &) = delete;
+    LWWWriteAheadLog & operator=(const LWWWriteAheadLog &) = delete;
+
+
+    /*!
+    * Destructor, closing the file
+    */
+    virtual ~LWWWriteAheadLog();
+
+
+    /*!
+    * Invoking \p onRecord with (payload, size) of every intact record in log order, then cutting off the torn or
+    * corrupt tail, so new records follow the last intact one. \p onRecord returning false rejects its record, which
+    * is then cut off with the tail, as long as no intact record follows it.
+    * @param [in] onRecord Callable accepting (const char *, std::size_t), returning void or bool
+    * @return number of recovered records
+    * @throw std::system_error if the file cannot be read or truncated, or an intact record follows a rejected one
+    */
+    template <typename F>
+    std::size_t recover(F && onRecord);
+
+
+    /*!
+    * Framing \p payload and appending it to \p records .
+    * @param [in,out] records Framed records
+    * @param [in] payload Record payload
+    */
+    static void frame(std::vector<char> & records, const std::vector<char> & payload);
+
+
+    /*!
+    * Appending framed \p records and waiting until they are on stable storage. Safe to call concurrently,
+    * concurrent committers share writes and syncs.
+    * @param [in] records Records framed by \a frame
+    * @throw std::system_error if writing or syncing fails, now or during an earlier flush
+    */
+    void commit(const std::vector<char> & records);
+
+
+    /*!
+    * Number of fdatasync calls issued so far.
+    * @return sync count
+    */
+    std::uint64_t getSyncCount();
+
+
+    /*!
+    * Size of the log including records still being committed.
+    * @return size in bytes
+    */
+    std::uint64_t getSize();
+
+
+private:
+    /*!
+    * Checking whether an intact record is framed at \p offset of \p bytes .
+    * @param [in] bytes Log content
+    * @param [in] offset Frame offset
+    * @param [out] size Payload size of the intact record
+    * @return true if the frame is complete and its checksum matches
+    */
+    static bool intactFrame(const std::vector<char> & bytes, const std::size_t & offset, std::uint32_t & size);
+
+
+    /*!
+    * Writing \p size bytes starting at \p data completely.
+    * @param [in] data Source bytes
+    * @param [in] size Number of bytes
+    * @throw std::system_error if writing fails
+    */
+    void writeFully(const char * data, std::size_t size);
+};
+
+
+
+inline LWWWriteAheadLog::LWWWriteAheadLog(
+    const std::string & path
+) {
+    this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(this->fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW log: cannot open " + path);
+    }
+}
+
+
+
+inline LWWWriteAheadLog::~LWWWriteAheadLog() {
+    ::close(this->fd);
+}
+
+
+
+template <typename F>
+std::size_t LWWWriteAheadLog::recover(F && onRecord) {
+    struct stat status;
+    if(::fstat(this->fd, &status) != 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW log: cannot stat");
+    }
+
+    std::vector<char> bytes(static_cast<std::size_t>(status.st_size));
+    for(std::size_t offset = 0; offset < bytes.size();) {
+        const ssize_t count = ::pread(this->fd, bytes.data() + offset, bytes.size() - offset, static_cast<off_t>(offset));
+        if(count < 0 && errno == EINTR) {
+            continue;
+        }
+        if(count <= 0) {
+            throw std::system_error(count < 0 ? errno : EIO, std::generic_category(), "LWW log: cannot read");
+        }
+        offset += static_cast<std::size_t>(count);
+    }
+
+    std::size_t recovered = 0;
+    std::size_t validEnd = headerSize;
+
+    if(bytes.size() >= sizeof(magic) && std::memcmp(bytes.data(), magic, sizeof(magic)) != 0) {
+        throw std::system_error(EINVAL, std::generic_category(), "LWW log: not a log file");
+    }
+    if(bytes.size() >= headerSize && std::memcmp(bytes.data() + sizeof(magic), &formatVersion, sizeof(formatVersion)) != 0) {
+        throw std::system_error(EINVAL, std::generic_category(), "LWW log: unsupported format version");
+    }
+
+    const bool headerFlag = bytes.size() >= headerSize;
+    std::uint32_t size;
+    while(headerFlag && intactFrame(bytes, validEnd, size)) {
+        const char * payload = bytes.data() + validEnd + frameSize;
+
+        if constexpr(std::is_same_v<std::invoke_result_t<F &, const char *, std::size_t>, bool>) {
+            if(!onRecord(payload, static_cast<std::size_t>(size))) {
+                std::uint32_t followingSize;
+                if(intactFrame(bytes, validEnd + frameSize + size, followingSize)) {
+                    throw std::system_error(EILSEQ, std::generic_category(), "LWW log: rejected record is not the tail");
+                }
+                break;
+            }
+        } else {
+            onRecord(payload, static_cast<std::size_t>(size));
+        }
+        validEnd += frameSize + size;
+        ++recovered;
+    }
+
+    if(!headerFlag) {
+        // Missing or torn header, the log is empty.
+        char header[headerSize];
+        std::memcpy(header, magic, sizeof(magic));
+        std::memcpy(header + sizeof(magic), &formatVersion, sizeof(formatVersion));
+        if(::ftruncate(this->fd, 0) != 0 || ::pwrite(this->fd, header, headerSize, 0) != static_cast<ssize_t>(headerSize)) {
+            throw std::system_error(errno, std::generic_category(), "LWW log: cannot write header");
+        }
+    } else if(validEnd != bytes.size() && ::ftruncate(this->fd, static_cast<off_t>(validEnd)) != 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW log: cannot cut off torn tail");
+    }
+
+    if(::lseek(this->fd, static_cast<off_t>(validEnd), SEEK_SET) < 0 || ::fdatasync(this->fd) != 0) {
+        throw std::system_error(errno, std::generic_category(), "LWW log: cannot position after recovered records");
+    }
+
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->appendedOffset = validEnd;
+    this->durableOffset = validEnd;
+    return recovered;
+}
+
+
+
+inline void LWWWriteAheadLog::frame(std::vector<char> & records, const std::vector<char> & payload) {
+    const std::uint32_t size = static_cast<std::uint32_t>(payload.size());
+    const std::uint32_t lengthCrc = lwwCrc32(reinterpret_cast<const char *>(&size), sizeof(size));
+    const std::uint32_t crc = lwwCrc32(payload.data(), payload.size(), lengthCrc);
+
+    const std::size_t offset = records.size();
+    records.resize(offset + frameSize + payload.size());
+    std::memcpy(records.data() + offset, &size, sizeof(size));
+    std::memcpy(records.data() + offset + sizeof(size), &crc, sizeof(crc));
+    std::memcpy(records.data() + offset + frameSize, payload.data(), payload.size());
+}
+
+
+
+inline void LWWWriteAheadLog::commit(const std::vector<char> & records) {
+    std::unique_lock<std::mutex> lock(this->mtx);
+    if(this->failedFlag) {
+        throw std::system_error(EIO, std::generic_category(), "LWW log: failed earlier");
+    }
+
+    this->pending.insert(this->pending.end(), records.begin(), records.end());
+    this->appendedOffset += records.size();
+    const std::uint64_t target = this->appendedOffset;
+
+    while(this->durableOffset < target) {
+        if(this->failedFlag) {
+            throw std::system_error(EIO, std::generic_category(), "LWW log: failed while committing");
+        }
+        if(this->flushingFlag) {
+            this->flushed.wait(lock);
+            continue;
+        }
+
+        // Becoming leader for every record appended so far, including those of waiting followers.
+        this->flushingFlag = true;
+        std::vector<char> batch;
+        batch.swap(this->pending);
+        const std::uint64_t batchEnd = this->appendedOffset;
+        lock.unlock();
+
+        try {
+            this->writeFully(batch.data(), batch.size());
+            if(::fdatasync(this->fd) != 0) {
+                throw std::system_error(errno, std::generic_category(), "LWW log: cannot sync");
+            }
+        } catch(...) {
+            lock.lock();
+            this->failedFlag = true;
+            this->flushingFlag = false;
+            this->flushed.notify_all();
+            throw;
+        }
+
+        lock.lock();
+        ++this->syncCount;
+        this->durableOffset = batchEnd;
+        this->flushingFlag = false;
+        this->flushed.notify_all();
+    }
+}
+
+
+
+inline std::uint64_t LWWWriteAheadLog::getSyncCount() {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->syncCount;
+}
+
+
+
+inline std::uint64_t LWWWriteAheadLog::getSize() {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    return this->appendedOffset;
+}
+
+
+
+inline bool LWWWriteAheadLog::intactFrame(
+    const std::vector<char> & bytes,
+    const std::size_t & offset,
+    std::uint32_t & size
+) {
+    if(offset > bytes.size() || bytes.size() - offset < frameSize) {
+        return false;
+    }
+
+    std::uint32_t crc;
+    std::memcpy(&size, bytes.data() + offset, sizeof(size));
+    std::memcpy(&crc, bytes.data() + offset + sizeof(size), sizeof(crc));
+    if(size > bytes.size() - offset - frameSize) {
+        return false;
+    }
+
+    const std::uint32_t lengthCrc = lwwCrc32(reinterpret_cast<const char *>(&size), sizeof(size));
+    return lwwCrc32(bytes.data() + offset + frameSize, size, lengthCrc) == crc;
+}
+
+
+
+inline void LWWWriteAheadLog::writeFully(const char * data, std::size_t size) {
+    while(size != 0) {
+        const ssize_t count = ::write(this->fd, data, size);
+        if(count < 0 && errno == EINTR) {
+            continue;
+        }
+        if(count < 0) {
+            throw std::system_error(errno, std::generic_category(), "LWW log: cannot write");
+        }
+        data += count;
+        size -= static_cast<std::size_t>(count);
+    }
+}
+
+
+
+#endif // LWWWRITEAHEADLOG_H
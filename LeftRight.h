@@ -0,0 +1,255 @@
+/*!
+* @file LeftRight.h
+* @brief Contains Left-Right concurrency control primitive providing wait-free reads
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef LEFTRIGHT_H
+#define LEFTRIGHT_H
+
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+
+/*!
+* @class LeftRight
+* @brief Two instances of a container, one published to readers while the other is modified
+* @details Implementation of Left-Right technique (Ramalhete, Correia). Readers announce themselves on a striped
+* read indicator and access the published instance without locks, retries or allocations, so reads are wait-free.
+* A writer modifies the hidden instance, publishes it, waits until readers leave the previously published one and
+* repeats the same modification on it. Writers must be serialized by the caller and a modification must be
+* deterministic, so that both instances stay identical.
+* @tparam C container type
+*/
+template <typename C>
+class LeftRight {
+private:
+    static constexpr std::size_t readIndicatorSlots = 32; //!< Stripes of every read indicator
+
+    /*!
+    * @struct ReadCounter
+    * @brief Stripe of a read indicator occupying its own cache line
+    */
+    struct alignas(64) ReadCounter {
+        std::atomic<std::int64_t> count { 0 }; //!< Number of readers currently announced on the stripe
+    };
+
+    mutable std::array<std::array<ReadCounter, readIndicatorSlots>, 2> readIndicators; //!< Read indicator per version
+    std::atomic<int> versionIndex { 0 }; //!< Read indicator new readers announce on
+    std::atomic<int> leftRight { 0 }; //!< Instance published to readers
+    std::array<C, 2> instances; //!< Left and right instance
+
+
+public:
+    /*!
+    * @class ReadGuard
+    * @brief Reader announced for the guard's lifetime, the instance it reads stays unmodified until it is destroyed
+    * @details Writers wait for the guard's destruction before modifying its instance, so a guard must not be held by
+    * a thread that modifies the same \a LeftRight .
+    */
+    class ReadGuard {
+    private:
+        std::atomic<std::int64_t> * count; //!< Stripe the reader is announced on, nullptr once moved from
+        const C * instance; //!< Instance published when the reader arrived
+
+
+    public:
+        /*!
+        * Constructor, announcing a reader of \p leftRight
+        * @param [in] leftRight Read instances
+        */
+        explicit ReadGuard(const LeftRight & leftRight);
+
+
+        ReadGuard(ReadGuard && guard) noexcept;
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard & operator=(const ReadGuard &) = delete;
+        ReadGuard & operator=(ReadGuard &&) = delete;
+        ~ReadGuard();
+
+
+        const C & get() const;
+    };
+
+
+    /*!
+    * Default constructor
+    */
+    LeftRight() = default;
+
+
+    LeftRight(const LeftRight &) = delete;
+    LeftRight & operator=(const LeftRight &) = delete;
+
+
+    /*!
+    * Invoking \p reader on the published instance. Wait-free, never blocks on writers.
+    * @param [in] reader Callable accepting const instance reference
+    * @return result of \p reader
+    */
+    template <typename F>
+    decltype(auto) read(F && reader) const;
+
+
+    /*!
+    * Announcing a reader of the published instance until the returned guard is destroyed. Wait-free.
+    * @return guard giving access to the published instance
+    */
+    ReadGuard guard() const;
+
+
+    /*!
+    * Applying \p modifier to both instances. Callers must serialize invocations.
+    * @param [in] modifier Deterministic callable accepting instance reference, invoked exactly twice
+    */
+    template <typename F>
+    void modify(F && modifier);
+
+
+    /*!
+    * Accessing published instance without announcing a reader. Only safe while no writer is active.
+    * @return published instance
+    */
+    const C & peek() const;
+
+
+private:
+    /*!
+    * Stripe of a read indicator assigned to the calling thread.
+    * @return stripe index
+    */
+    static std::size_t readSlot();
+
+
+    /*!
+    * Checking whether no reader is announced on read indicator \p version .
+    * @param [in] version Read indicator index
+    * @return true if read indicator is empty
+    */
+    bool isEmpty(const int & version) const;
+
+
+    /*!
+    * Redirecting new readers to the other read indicator and waiting until both indicators drain.
+    */
+    void toggleVersionAndWait();
+};
+
+
+
+template <typename C>
+LeftRight<C>::ReadGuard::ReadGuard(
+    const LeftRight & leftRight
+) : count(&leftRight.readIndicators[leftRight.versionIndex.load()][readSlot()].count) {
+    this->count->fetch_add(1);
+    this->instance = &leftRight.instances[leftRight.leftRight.load()];
+}
+
+
+
+template <typename C>
+LeftRight<C>::ReadGuard::ReadGuard(
+    ReadGuard && guard
+) noexcept : count(std::exchange(guard.count, nullptr)), instance(guard.instance) {
+}
+
+
+
+template <typename C>
+LeftRight<C>::ReadGuard::~ReadGuard() {
+    if(this->count) {
+        this->count->fetch_sub(1, std::memory_order_release);
+    }
+}
+
+
+
+template <typename C>
+const C & LeftRight<C>::ReadGuard::get() const {
+    return *this->instance;
+}
+
+
+
+template <typename C>
+template <typename F>
+decltype(auto) LeftRight<C>::read(F && reader) const {
+    // Leaving read indicator when reading finishes, including by exception.
+    const ReadGuard guard(*this);
+    return std::forward<F>(reader)(guard.get());
+}
+
+
+
+template <typename C>
+typename LeftRight<C>::ReadGuard LeftRight<C>::guard() const {
+    return ReadGuard(*this);
+}
+
+
+
+template <typename C>
+template <typename F>
+void LeftRight<C>::modify(F && modifier) {
+    const int published = this->leftRight.load(std::memory_order_relaxed);
+
+    modifier(this->instances[1 - published]);
+    this->leftRight.store(1 - published);
+    this->toggleVersionAndWait();
+    modifier(this->instances[published]);
+}
+
+
+
+template <typename C>
+const C & LeftRight<C>::peek() const {
+    return this->instances[this->leftRight.load()];
+}
+
+
+
+template <typename C>
+std::size_t LeftRight<C>::readSlot() {
+    static std::atomic<std::size_t> nextSlot { 0 };
+    thread_local const std::size_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed) % readIndicatorSlots;
+    return slot;
+}
+
+
+
+template <typename C>
+bool LeftRight<C>::isEmpty(const int & version) const {
+    for(const auto & counter : this->readIndicators[version]) {
+        if(counter.count.load() != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+
+template <typename C>
+void LeftRight<C>::toggleVersionAndWait() {
+    const int previous = this->versionIndex.load(std::memory_order_relaxed);
+    const int next = 1 - previous;
+
+    while(!this->isEmpty(next)) {
+        std::this_thread::yield();
+    }
+
+    this->versionIndex.store(next);
+
+    while(!this->isEmpty(previous)) {
+        std::this_thread::yield();
+    }
+}
+
+
+
+#endif // LEFTRIGHT_H
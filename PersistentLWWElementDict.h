@@ -0,0 +1,606 @@
+/*!
+* @file PersistentLWWElementDict.h
+* @brief Contains persistent CRDT LWW Element Dictionary built on a hash array mapped trie
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef PERSISTENTLWWELEMENTDICT_H
+#define PERSISTENTLWWELEMENTDICT_H
+
+
+#include <algorithm>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "LWWStorage.h"
+
+
+/*!
+* @class PersistentLWWElementDict
+* @brief CRDT Last-Write-Wins Element Dictionary with constant-time copies
+* @details State is a hash array mapped trie of immutable nodes, every key owning an immutable entry with its add and
+* remove histories and its current element. Modifications copy the path from the root to the modified entry and share
+* every other node, so copying a dictionary copies a single pointer and a snapshot per request costs nothing until
+* either side is modified. Merging walks both tries in parallel and skips subtrees they share, so merging replicas
+* forked from a common snapshot costs time proportional to their divergence.
+*
+* An instance is not synchronized, but instances never affect each other: a copy taken under the owner's
+* synchronization can be read and modified by another thread freely. Removal wins timestamp ties with adds, ties
+* between adds are won by the add of greater value, so replicas converge regardless of arrival order.
+* @tparam K key, hashed with \a Hash
+* @tparam V value
+* @tparam T timestamp
+* @tparam Hash key hash function
+*/
+template <typename K,
+          typename V,
+          typename T,
+          typename Hash = std::hash<K>>
+class PersistentLWWElementDict {
+public:
+    using History = std::vector<std::pair<V, T>>; //!< Per-key history in less order
+    using CurrentData = std::map<K, std::pair<V, T>>; //!< Current elements by key
+
+    /*!
+    * @struct Entry
+    * @brief Immutable state of a single key
+    */
+    struct Entry {
+        History added; //!< CRDT added elements
+        History removed; //!< CRDT removed elements
+        std::optional<std::pair<V, T>> current; //!< CRDT current element
+    };
+
+    using EntryPtr = std::shared_ptr<const Entry>; //!< Shared immutable entry
+
+
+private:
+    static constexpr unsigned bitsPerLevel = 5; //!< Hash bits consumed per trie level
+
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>; //!< Shared immutable node
+
+    /*!
+    * @struct Node
+    * @brief Branch indexing children by hash bits, or leaf holding keys of equal hash
+    */
+    struct Node {
+        std::size_t count = 0; //!< Number of keys within the subtree
+        std::uint32_t bitmap = 0; //!< Branch: occupied child slots
+        std::vector<NodePtr> children; //!< Branch: children of occupied slots, in slot order
+        std::uint64_t hash = 0; //!< Leaf: mixed hash of every contained key
+        std::vector<std::pair<K, EntryPtr>> entries; //!< Leaf: keys and entries, empty for branches
+
+        bool isLeaf() const {
+            return !this->entries.empty();
+        }
+    };
+
+    NodePtr root; //!< Trie root, null if empty
+    Hash hash; //!< Key hash function
+
+
+public:
+    /*!
+    * Default constructor
+    */
+    PersistentLWWElementDict() = default;
+
+
+    /*!
+    * Insert new element into key's \a added history
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    void addElement(const K & k, const V & v, const T & t);
+
+
+    /*!
+    * Insert new element into key's \a removed history
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    void removeElement(const K & k, const V & v, const T & t);
+
+
+    /*!
+    * Invoking addElement method
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    void updateValue(const K & k, const V & v, const T & t);
+
+
+    /*!
+    * Retrieving current value for specified map's key \p k .
+    * @param [in] k key
+    * @return container with corresponding value if exists, empty otherwise
+    * @retval std::optional<V> value type within std::optional container
+    */
+    const std::optional<const V> getValueByKey(const K & k) const;
+
+
+    /*!
+    * Adding elements of \p dict to this instance. Subtrees shared by both instances are skipped.
+    * @param [in] dict Source dictionary
+    */
+    void mergeWith(const PersistentLWWElementDict & dict);
+
+
+    /*!
+    * Fetching immutable state of key \p k .
+    * @param [in] k key
+    * @return entry if key has any history, null otherwise
+    */
+    EntryPtr getEntry(const K & k) const;
+
+
+    /*!
+    * Collecting current elements of all keys. Linear in the number of keys.
+    * @return current elements by key
+    */
+    CurrentData getCurrentData() const;
+
+
+    /*!
+    * Checking whether this instance and \p dict share the whole trie, which is the case for unmodified copies.
+    * @param [in] dict Other dictionary
+    * @return true if both instances share their root
+    */
+    bool sharesStateWith(const PersistentLWWElementDict & dict) const;
+
+
+    std::size_t size() const;
+
+
+private:
+    /*!
+    * Replacing the entry of key \p k by the result of \p modify , copying nodes along the path.
+    * @param [in] node Subtree root, may be null
+    * @param [in] h Mixed hash of \p k
+    * @param [in] depth Level of \p node
+    * @param [in] k key
+    * @param [in] modify Callable mapping existing entry, null if absent, to new entry; returning the existing entry
+    * leaves the subtree unchanged
+    * @return new subtree root, \p node itself if unchanged
+    */
+    template <typename F>
+    static NodePtr update(const NodePtr & node, const std::uint64_t & h, const unsigned & depth, const K & k, F && modify);
+
+
+    /*!
+    * Merging subtree \p src into subtree \p dest , both at level \p depth .
+    * @param [in] dest Destination subtree, may be null
+    * @param [in] src Source subtree, may be null
+    * @param [in] depth Level of both subtrees
+    * @return merged subtree, \p dest itself if unchanged
+    */
+    static NodePtr mergeNodes(const NodePtr & dest, const NodePtr & src, const unsigned & depth);
+
+
+    /*!
+    * Merging entries of one key.
+    * @param [in] dest Destination entry
+    * @param [in] src Source entry
+    * @return merged entry, \p dest itself if \p src adds nothing
+    */
+    static EntryPtr mergeEntries(const EntryPtr & dest, const EntryPtr & src);
+
+
+    /*!
+    * Creating entry \p entry extended by \p pair in its added or removed history.
+    * @param [in] entry Existing entry, may be null
+    * @param [in] pair Element
+    * @param [in] removedFlag Whether \p pair is a removal
+    * @return new entry, \p entry itself if \p pair is already contained
+    */
+    static EntryPtr insertElement(const EntryPtr & entry, const std::pair<V, T> & pair, const bool & removedFlag);
+
+
+    /*!
+    * Recomputing current element of \p entry from its histories.
+    * @param [in,out] entry Entry being built
+    */
+    static void updateCurrent(Entry & entry);
+
+
+    /*!
+    * Slot of hash \p h at level \p depth .
+    * @param [in] h Mixed hash
+    * @param [in] depth Level
+    * @return slot index
+    */
+    static unsigned slot(const std::uint64_t & h, const unsigned & depth);
+
+
+    /*!
+    * Position of slot \p index among occupied children of \p bitmap .
+    * @param [in] bitmap Occupied slots
+    * @param [in] index Slot index
+    * @return child position
+    */
+    static std::size_t position(const std::uint32_t & bitmap, const unsigned & index);
+
+
+    /*!
+    * Hash of key \p k , mixed so identity hashes of sequential keys spread over all levels.
+    * @param [in] k key
+    * @return mixed hash
+    */
+    std::uint64_t mixedHash(const K & k) const;
+
+
+    template <typename F>
+    static void forEachEntry(const NodePtr & node, F && visit);
+};
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+void PersistentLWWElementDict<K, V, T, Hash>::addElement(const K & k, const V & v, const T & t) {
+    this->root = update(this->root, this->mixedHash(k), 0, k, [&](const EntryPtr & entry) {
+        return insertElement(entry, { v, t }, false);
+    });
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+void PersistentLWWElementDict<K, V, T, Hash>::removeElement(const K & k, const V & v, const T & t) {
+    this->root = update(this->root, this->mixedHash(k), 0, k, [&](const EntryPtr & entry) {
+        return insertElement(entry, { v, t }, true);
+    });
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+void PersistentLWWElementDict<K, V, T, Hash>::updateValue(const K & k, const V & v, const T & t) {
+    this->addElement(k, v, t);
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+const std::optional<const V> PersistentLWWElementDict<K, V, T, Hash>::getValueByKey(const K & k) const {
+    const EntryPtr entry = this->getEntry(k);
+
+    if(entry && entry->current) {
+        return { entry->current->first };
+    } else {
+        return {};
+    }
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+void PersistentLWWElementDict<K, V, T, Hash>::mergeWith(const PersistentLWWElementDict & dict) {
+    this->root = mergeNodes(this->root, dict.root, 0);
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+typename PersistentLWWElementDict<K, V, T, Hash>::EntryPtr
+PersistentLWWElementDict<K, V, T, Hash>::getEntry(const K & k) const {
+    const std::uint64_t h = this->mixedHash(k);
+    const Node * node = this->root.get();
+
+    for(unsigned depth = 0; node; ++depth) {
+        if(node->isLeaf()) {
+            if(node->hash != h) {
+                return nullptr;
+            }
+            for(const auto & [key, entry] : node->entries) {
+                if(!(key < k) && !(k < key)) {
+                    return entry;
+                }
+            }
+            return nullptr;
+        }
+
+        const unsigned index = slot(h, depth);
+        if(!(node->bitmap & (1u << index))) {
+            return nullptr;
+        }
+        node = node->children[position(node->bitmap, index)].get();
+    }
+
+    return nullptr;
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+typename PersistentLWWElementDict<K, V, T, Hash>::CurrentData
+PersistentLWWElementDict<K, V, T, Hash>::getCurrentData() const {
+    CurrentData current;
+
+    forEachEntry(this->root, [&current](const K & k, const EntryPtr & entry) {
+        if(entry->current) {
+            current.emplace(k, *entry->current);
+        }
+    });
+
+    return current;
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+bool PersistentLWWElementDict<K, V, T, Hash>::sharesStateWith(const PersistentLWWElementDict & dict) const {
+    return this->root == dict.root;
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+std::size_t PersistentLWWElementDict<K, V, T, Hash>::size() const {
+    return this->root ? this->root->count : 0;
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+template <typename F>
+typename PersistentLWWElementDict<K, V, T, Hash>::NodePtr PersistentLWWElementDict<K, V, T, Hash>::update(
+    const NodePtr & node,
+    const std::uint64_t & h,
+    const unsigned & depth,
+    const K & k,
+    F && modify
+) {
+    if(!node) {
+        EntryPtr entry = modify(nullptr);
+        if(!entry) {
+            return node;
+        }
+
+        auto leaf = std::make_shared<Node>();
+        leaf->count = 1;
+        leaf->hash = h;
+        leaf->entries.emplace_back(k, std::move(entry));
+        return leaf;
+    }
+
+    if(node->isLeaf()) {
+        if(node->hash == h) {
+            auto entryIter = std::find_if(node->entries.begin(), node->entries.end(), [&k](const auto & keyEntry) {
+                return !(keyEntry.first < k) && !(k < keyEntry.first);
+            });
+
+            EntryPtr entry = modify(entryIter != node->entries.end() ? entryIter->second : nullptr);
+            if(entryIter != node->entries.end() && entry == entryIter->second) {
+                return node;
+            }
+
+            auto leaf = std::make_shared<Node>(*node);
+            if(entryIter != node->entries.end()) {
+                leaf->entries[static_cast<std::size_t>(entryIter - node->entries.begin())].second = std::move(entry);
+            } else {
+                leaf->entries.emplace_back(k, std::move(entry));
+                ++leaf->count;
+            }
+            return leaf;
+        }
+
+        // Different hashes share the prefix so far, pushing the leaf one level down.
+        auto branch = std::make_shared<Node>();
+        branch->count = node->count;
+        branch->bitmap = 1u << slot(node->hash, depth);
+        branch->children.push_back(node);
+        return update(branch, h, depth, k, std::forward<F>(modify));
+    }
+
+    const unsigned index = slot(h, depth);
+    const std::uint32_t bit = 1u << index;
+    const std::size_t childPosition = position(node->bitmap, index);
+    const bool occupiedFlag = node->bitmap & bit;
+
+    const NodePtr child = occupiedFlag ? node->children[childPosition] : nullptr;
+    NodePtr updated = update(child, h, depth + 1, k, std::forward<F>(modify));
+    if(updated == child) {
+        return node;
+    }
+
+    auto branch = std::make_shared<Node>(*node);
+    branch->count = node->count - (child ? child->count : 0) + updated->count;
+    if(occupiedFlag) {
+        branch->children[childPosition] = std::move(updated);
+    } else {
+        branch->bitmap |= bit;
+        branch->children.insert(branch->children.begin() + static_cast<std::ptrdiff_t>(childPosition), std::move(updated));
+    }
+    return branch;
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+typename PersistentLWWElementDict<K, V, T, Hash>::NodePtr PersistentLWWElementDict<K, V, T, Hash>::mergeNodes(
+    const NodePtr & dest,
+    const NodePtr & src,
+    const unsigned & depth
+) {
+    if(!src || dest == src) {
+        return dest;
+    }
+    if(!dest) {
+        return src;
+    }
+
+    if(dest->isLeaf() || src->isLeaf()) {
+        // Inserting leaf's keys into the other subtree, entry merging is commutative.
+        const bool srcLeafFlag = src->isLeaf();
+        const Node & leaf = srcLeafFlag ? *src : *dest;
+        NodePtr merged = srcLeafFlag ? dest : src;
+
+        for(const auto & [k, entry] : leaf.entries) {
+            merged = update(merged, leaf.hash, depth, k, [&entry](const EntryPtr & existing) {
+                return existing ? mergeEntries(existing, entry) : entry;
+            });
+        }
+
+        // Merging a destination leaf into the source side yields source's nodes, keep destination if nothing changed.
+        if(!srcLeafFlag && merged == src) {
+            return src;
+        }
+        return merged;
+    }
+
+    auto branch = std::make_shared<Node>();
+    branch->bitmap = dest->bitmap | src->bitmap;
+    bool changeFlag = branch->bitmap != dest->bitmap;
+
+    for(unsigned index = 0; index < (1u << bitsPerLevel); ++index) {
+        const std::uint32_t bit = 1u << index;
+        if(!(branch->bitmap & bit)) {
+            continue;
+        }
+
+        const NodePtr destChild = (dest->bitmap & bit) ? dest->children[position(dest->bitmap, index)] : nullptr;
+        const NodePtr srcChild = (src->bitmap & bit) ? src->children[position(src->bitmap, index)] : nullptr;
+        NodePtr merged = mergeNodes(destChild, srcChild, depth + 1);
+
+        changeFlag |= merged != destChild;
+        branch->count += merged->count;
+        branch->children.push_back(std::move(merged));
+    }
+
+    return changeFlag ? NodePtr(std::move(branch)) : dest;
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+typename PersistentLWWElementDict<K, V, T, Hash>::EntryPtr PersistentLWWElementDict<K, V, T, Hash>::mergeEntries(
+    const EntryPtr & dest,
+    const EntryPtr & src
+) {
+    if(dest == src) {
+        return dest;
+    }
+
+    const bool addedFlag = !std::includes(dest->added.begin(), dest->added.end(), src->added.begin(), src->added.end());
+    const bool removedFlag = !std::includes(dest->removed.begin(), dest->removed.end(), src->removed.begin(), src->removed.end());
+    if(!addedFlag && !removedFlag) {
+        return dest;
+    }
+
+    auto entry = std::make_shared<Entry>();
+    std::set_union(dest->added.begin(), dest->added.end(), src->added.begin(), src->added.end(),
+                   std::back_inserter(entry->added));
+    std::set_union(dest->removed.begin(), dest->removed.end(), src->removed.begin(), src->removed.end(),
+                   std::back_inserter(entry->removed));
+    updateCurrent(*entry);
+
+    return entry;
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+typename PersistentLWWElementDict<K, V, T, Hash>::EntryPtr PersistentLWWElementDict<K, V, T, Hash>::insertElement(
+    const EntryPtr & entry,
+    const std::pair<V, T> & pair,
+    const bool & removedFlag
+) {
+    if(entry) {
+        const History & history = removedFlag ? entry->removed : entry->added;
+        if(std::binary_search(history.begin(), history.end(), pair)) {
+            return entry;
+        }
+    }
+
+    auto updated = entry ? std::make_shared<Entry>(*entry) : std::make_shared<Entry>();
+    History & history = removedFlag ? updated->removed : updated->added;
+    history.insert(std::upper_bound(history.begin(), history.end(), pair), pair);
+    updateCurrent(*updated);
+
+    return updated;
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+void PersistentLWWElementDict<K, V, T, Hash>::updateCurrent(Entry & entry) {
+    const std::pair<V, T> * latestAdd = nullptr;
+    for(const auto & pair : entry.added) {
+        if(!latestAdd || lwwSupersedes(pair.first, pair.second, latestAdd->first, latestAdd->second)) {
+            latestAdd = &pair;
+        }
+    }
+
+    const T * latestRemoval = nullptr;
+    for(const auto & pair : entry.removed) {
+        if(!latestRemoval || *latestRemoval < pair.second) {
+            latestRemoval = &pair.second;
+        }
+    }
+
+    // If element's timestamps for insertion and removal are the same, then removal has priority.
+    if(latestAdd && !(latestRemoval && !(*latestRemoval < latestAdd->second))) {
+        entry.current = *latestAdd;
+    } else {
+        entry.current.reset();
+    }
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+unsigned PersistentLWWElementDict<K, V, T, Hash>::slot(const std::uint64_t & h, const unsigned & depth) {
+    return static_cast<unsigned>(h >> (depth * bitsPerLevel)) & ((1u << bitsPerLevel) - 1);
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+std::size_t PersistentLWWElementDict<K, V, T, Hash>::position(const std::uint32_t & bitmap, const unsigned & index) {
+    return std::bitset<32>(bitmap & ((1u << index) - 1)).count();
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+std::uint64_t PersistentLWWElementDict<K, V, T, Hash>::mixedHash(const K & k) const {
+    std::uint64_t h = static_cast<std::uint64_t>(this->hash(k)) * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+
+
+template <typename K, typename V, typename T, typename Hash>
+template <typename F>
+void PersistentLWWElementDict<K, V, T, Hash>::forEachEntry(const NodePtr & node, F && visit) {
+    if(!node) {
+        return;
+    }
+
+    if(node->isLeaf()) {
+        for(const auto & [k, entry] : node->entries) {
+            visit(k, entry);
+        }
+        return;
+    }
+
+    for(const auto & child : node->children) {
+        forEachEntry(child, visit);
+    }
+}
+
+
+
+#endif // PERSISTENTLWWELEMENTDICT_H
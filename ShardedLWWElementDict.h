@@ -0,0 +1,511 @@
+/*!
+* @file ShardedLWWElementDict.h
+* @brief Contains CRDT LWW Element Dictionary partitioned into independently locked shards
+* @author Domagoj Markota <domagoj.markota@gmail.com>
+*/
+
+#ifndef SHARDEDLWWELEMENTDICT_H
+#define SHARDEDLWWELEMENTDICT_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "LWWElementDict.h"
+
+
+/*!
+* @class ShardedLWWElementDict
+* @brief CRDT Last-Write-Wins Element Dictionary split into hash partitioned shards
+* @details Every key is owned by exactly one shard, selected by hashing the key. Each shard is an
+* \a LWWElementDict with its own mutex, so writers to different shards do not contend.
+* Operations spanning all shards (merging, snapshots) are consistent per shard, not across shards.
+* @tparam K key, hashed with \a Hash
+* @tparam V value
+* @tparam T timestamp
+* @tparam Storage history storage policy of every shard
+* @tparam Hash key hash function
+*/
+template <typename K,
+          typename V,
+          typename T,
+          template <typename, typename, typename> class Storage = TreeStorage,
+          typename Hash = std::hash<K>>
+class ShardedLWWElementDict {
+public:
+    using Dict = LWWElementDict<K, V, T, Storage>; //!< Shard type
+
+
+private:
+    /*!
+    * @struct Shard
+    * @brief Shard padded to its own cache lines, so neighbouring shard mutexes do not false share
+    */
+    struct alignas(64) Shard {
+        Dict dict; //!< Shard dictionary
+    };
+
+    std::size_t shardCount; //!< Number of shards
+    std::unique_ptr<Shard[]> shards; //!< Shards
+    Hash hash; //!< Key hash function
+
+
+public:
+    /*!
+    * Constructor
+    * @param[in] shardCount Number of shards, at least 1
+    */
+    explicit ShardedLWWElementDict(const std::size_t & shardCount = 16);
+
+
+    /*!
+    * Copy constructor. Every shard is copied under its own lock along with its version counters and watermark.
+    * @param[in] dict Source dictionary
+    */
+    ShardedLWWElementDict(const ShardedLWWElementDict & dict);
+
+
+    /*!
+    * Default virtual destructor
+    */
+    virtual ~ShardedLWWElementDict() = default;
+
+
+    /*!
+    * Insert new element into owning shard's \a addedData map
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    virtual void addElement(const K & k, const V & v, const T & t);
+
+
+    /*!
+    * Insert new element into owning shard's \a addedData map, moving \p k and \p v into the containers
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    virtual void addElement(K && k, V && v, const T & t);
+
+
+    /*!
+    * Insert new element into owning shard's \a addedData map, with value constructed from \p args
+    * @param [in] k key
+    * @param [in] t timestamp
+    * @param [in] args Arguments of \a V 's constructor
+    */
+    template <typename... Args>
+    void emplaceElement(K k, const T & t, Args &&... args);
+
+
+    /*!
+    * Insert new element into owning shard's \a addedData map, stamped by the timestamp source
+    * @param [in] k key
+    * @param [in] v value
+    * @return timestamp of the element
+    */
+    T addElement(const K & k, const V & v);
+
+
+    /*!
+    * Insert new element into owning shard's \a removedData map
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    virtual void removeElement(const K & k, const V & v, const T & t);
+
+
+    /*!
+    * Insert new element into owning shard's \a removedData map, moving \p v into the history
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    virtual void removeElement(K && k, V && v, const T & t);
+
+
+    /*!
+    * Insert new element into owning shard's \a removedData map, stamped by the timestamp source
+    * @param [in] k key
+    * @param [in] v value
+    * @return timestamp of the element
+    */
+    T removeElement(const K & k, const V & v);
+
+
+    /*!
+    * Invoking addElement method
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    virtual void updateValue(const K & k, const V & v, const T & t);
+
+
+    /*!
+    * Invoking addElement method
+    * @param [in] k key
+    * @param [in] v value
+    * @param [in] t timestamp
+    */
+    virtual void updateValue(K && k, V && v, const T & t);
+
+
+    /*!
+    * Invoking addElement method, stamped by the timestamp source
+    * @param [in] k key
+    * @param [in] v value
+    * @return timestamp of the element
+    */
+    T updateValue(const K & k, const V & v);
+
+
+    /*!
+    * Setting the source of automatically stamped operations of every shard, see \a LWWElementDict::setTimestampSource .
+    * @param [in] source Callable returning timestamps, e.g. \a LWWTimestampSource of the replica's clock
+    */
+    void setTimestampSource(const std::function<T()> & source);
+
+
+    /*!
+    * Retrieving current value for specified map's key \p k from owning shard.
+    * @param [in] k key
+    * @return container with corresponding value if exists, empty otherwise
+    * @retval std::optional<V> value type within std::optional container
+    */
+    virtual const std::optional<const V> getValueByKey(const K & k);
+
+
+    /*!
+    * Retrieving current values for a batch of keys, grouped by owning shard. Values of every shard are read from one
+    * consistent state of that shard, see \a LWWElementDict::getValuesByKeys .
+    * @param [in] keys keys in any order, possibly repeated
+    * @return values in order of \p keys , empty where a key has no current value
+    */
+    std::vector<std::optional<V>> getValuesByKeys(const std::vector<K> & keys) const;
+
+
+    /*!
+    * Merging every shard of \p dict into this instance. Shards are merged pairwise if both instances are
+    * partitioned equally, otherwise elements are routed to their owning shards.
+    * @param [in] dict Source dictionary
+    */
+    virtual void mergeWith(const ShardedLWWElementDict & dict);
+
+
+    /*!
+    * Merging unsharded \p dict into this instance by routing elements to their owning shards.
+    * @param [in] dict Source dictionary
+    */
+    virtual void mergeWith(const Dict & dict);
+
+
+    /*!
+    * Compacting every shard's history with watermark \p stableTime .
+    * @param [in] stableTime Causally stable timestamp
+    */
+    virtual void compact(const T & stableTime);
+
+
+    /*!
+    * Collecting all shards into a single dictionary. Every shard is copied under its own lock. The dictionary keeps the
+    * latest watermark of the shards, while its version counts its own changes, as versions of shards are independent.
+    * @return unsharded dictionary holding union of all shards
+    */
+    std::unique_ptr<Dict> snapshot() const;
+
+
+    /*!
+    * Summing statistics of all shards, see \a LWWElementDict::stats .
+    * @return statistics
+    */
+    LWWStats stats() const;
+
+
+    /*!
+    * Shard owning key \p k .
+    * @param [in] k key
+    * @return shard index
+    */
+    std::size_t shardIndex(const K & k) const;
+
+
+    const std::size_t & getShardCount() const;
+    Dict & getShard(const std::size_t & index);
+    const Dict & getShard(const std::size_t & index) const;
+};
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+ShardedLWWElementDict<K, V, T, Storage, Hash>::ShardedLWWElementDict(
+    const std::size_t & shardCount
+):
+    shardCount(shardCount == 0 ? 1 : shardCount),
+    shards(new Shard[this->shardCount])
+{
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+ShardedLWWElementDict<K, V, T, Storage, Hash>::ShardedLWWElementDict(
+    const ShardedLWWElementDict & dict
+):
+    shardCount(dict.getShardCount()),
+    shards(new Shard[this->shardCount]),
+    hash(dict.hash)
+{
+    for(std::size_t index = 0; index < this->shardCount; ++index) {
+        this->shards[index].dict.copyFrom(dict.getShard(index));
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::addElement(const K & k, const V & v, const T & t) {
+    this->shards[this->shardIndex(k)].dict.addElement(k, v, t);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::addElement(K && k, V && v, const T & t) {
+    this->shards[this->shardIndex(k)].dict.addElement(std::move(k), std::move(v), t);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+template <typename... Args>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::emplaceElement(K k, const T & t, Args &&... args) {
+    this->addElement(std::move(k), V(std::forward<Args>(args)...), t);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+T ShardedLWWElementDict<K, V, T, Storage, Hash>::addElement(const K & k, const V & v) {
+    return this->shards[this->shardIndex(k)].dict.addElement(k, v);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::removeElement(const K & k, const V & v, const T & t) {
+    this->shards[this->shardIndex(k)].dict.removeElement(k, v, t);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::removeElement(K && k, V && v, const T & t) {
+    this->shards[this->shardIndex(k)].dict.removeElement(std::move(k), std::move(v), t);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+T ShardedLWWElementDict<K, V, T, Storage, Hash>::removeElement(const K & k, const V & v) {
+    return this->shards[this->shardIndex(k)].dict.removeElement(k, v);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::updateValue(const K & k, const V & v, const T & t) {
+    this->addElement(k, v, t);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::updateValue(K && k, V && v, const T & t) {
+    this->addElement(std::move(k), std::move(v), t);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+T ShardedLWWElementDict<K, V, T, Storage, Hash>::updateValue(const K & k, const V & v) {
+    return this->addElement(k, v);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::setTimestampSource(const std::function<T()> & source) {
+    for(std::size_t index = 0; index < this->shardCount; ++index) {
+        this->shards[index].dict.setTimestampSource(source);
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+const std::optional<const V> ShardedLWWElementDict<K, V, T, Storage, Hash>::getValueByKey(const K & k) {
+    return this->shards[this->shardIndex(k)].dict.getValueByKey(k);
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+std::vector<std::optional<V>> ShardedLWWElementDict<K, V, T, Storage, Hash>::getValuesByKeys(
+    const std::vector<K> & keys
+) const {
+    std::vector<std::vector<K>> shardKeys(this->shardCount);
+    std::vector<std::vector<std::size_t>> shardPositions(this->shardCount);
+    for(std::size_t position = 0; position < keys.size(); ++position) {
+        const std::size_t index = this->shardIndex(keys[position]);
+        shardKeys[index].push_back(keys[position]);
+        shardPositions[index].push_back(position);
+    }
+
+    std::vector<std::optional<V>> values(keys.size());
+    for(std::size_t index = 0; index < this->shardCount; ++index) {
+        if(shardKeys[index].empty()) {
+            continue;
+        }
+
+        auto shardValues = this->shards[index].dict.getValuesByKeys(shardKeys[index]);
+        for(std::size_t probe = 0; probe < shardValues.size(); ++probe) {
+            values[shardPositions[index][probe]] = std::move(shardValues[probe]);
+        }
+    }
+
+    return values;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::mergeWith(const ShardedLWWElementDict & dict) {
+    if(dict.getShardCount() != this->shardCount) {
+        for(std::size_t index = 0; index < dict.getShardCount(); ++index) {
+            this->mergeWith(dict.getShard(index));
+        }
+        return;
+    }
+
+    for(std::size_t index = 0; index < this->shardCount; ++index) {
+        this->shards[index].dict.mergeWith(dict.getShard(index));
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::mergeWith(const Dict & dict) {
+    // Partitioning source first, so every shard is locked once.
+    std::unique_ptr<Dict[]> parts(new Dict[this->shardCount]);
+    const auto source = dict.snapshot();
+
+    for(const auto & [k, history] : *source.addedData) {
+        Dict & part = parts[this->shardIndex(k)];
+        for(const auto & [v, t] : history) {
+            part.addElement(k, v, t);
+        }
+    }
+
+    for(const auto & [k, history] : *source.removedData) {
+        Dict & part = parts[this->shardIndex(k)];
+        for(const auto & [v, t] : history) {
+            part.removeElement(k, v, t);
+        }
+    }
+
+    for(std::size_t index = 0; index < this->shardCount; ++index) {
+        this->shards[index].dict.mergeWith(parts[index]);
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+void ShardedLWWElementDict<K, V, T, Storage, Hash>::compact(const T & stableTime) {
+    for(std::size_t index = 0; index < this->shardCount; ++index) {
+        this->shards[index].dict.compact(stableTime);
+    }
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+std::unique_ptr<typename ShardedLWWElementDict<K, V, T, Storage, Hash>::Dict>
+ShardedLWWElementDict<K, V, T, Storage, Hash>::snapshot() const {
+    auto dict = std::make_unique<Dict>();
+    std::optional<T> stableTime;
+
+    for(std::size_t index = 0; index < this->shardCount; ++index) {
+        const Dict shardCopy(this->shards[index].dict);
+        dict->mergeWith(shardCopy);
+
+        const auto & shardStableTime = shardCopy.getStableTime();
+        if(shardStableTime && (!stableTime || *stableTime < *shardStableTime)) {
+            stableTime = shardStableTime;
+        }
+    }
+
+    // Every shard's watermark has been seen by all replicas, so the latest one holds for all keys.
+    if(stableTime) {
+        dict->compact(*stableTime);
+    }
+
+    return dict;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+LWWStats ShardedLWWElementDict<K, V, T, Storage, Hash>::stats() const {
+    LWWStats stats;
+    for(std::size_t index = 0; index < this->shardCount; ++index) {
+        stats += this->shards[index].dict.stats();
+    }
+    return stats;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+std::size_t ShardedLWWElementDict<K, V, T, Storage, Hash>::shardIndex(const K & k) const {
+    // Multiplicative mixing, so identity hashes of sequential integer keys still spread over shards.
+    return static_cast<std::size_t>(
+        (static_cast<std::uint64_t>(this->hash(k)) * 0x9E3779B97F4A7C15ull >> 32) % this->shardCount
+    );
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+const std::size_t & ShardedLWWElementDict<K, V, T, Storage, Hash>::getShardCount() const {
+    return this->shardCount;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+typename ShardedLWWElementDict<K, V, T, Storage, Hash>::Dict &
+ShardedLWWElementDict<K, V, T, Storage, Hash>::getShard(const std::size_t & index) {
+    return this->shards[index].dict;
+}
+
+
+
+template <typename K, typename V, typename T, template <typename, typename, typename> class Storage, typename Hash>
+const typename ShardedLWWElementDict<K, V, T, Storage, Hash>::Dict &
+ShardedLWWElementDict<K, V, T, Storage, Hash>::getShard(const std::size_t & index) const {
+    return this->shards[index].dict;
+}
+
+
+
+#endif // SHARDEDLWWELEMENTDICT_H
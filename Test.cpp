@@ -1,11 +1,38 @@
 #define CATCH_CONFIG_MAIN
+// Statistics are tested enabled by default. Building with -DLWW_TEST_WITHOUT_STATS tests the library's default
+// configuration instead, in which recording compiles to nothing. Both builds are expected to pass.
+#ifndef LWW_TEST_WITHOUT_STATS
+#define LWW_ENABLE_STATS
+#endif
 
 #include "LWWElementDict.h"
+#include "ShardedLWWElementDict.h"
+#include "LWWSerialization.h"
+#include "LWWMappedSnapshot.h"
+#include "DurableLWWElementDict.h"
+#include "PersistentLWWElementDict.h"
+#include "LWWSharedValue.h"
+#include "LWWHybridLogicalClock.h"
+#include "LWWTimestampSource.h"
+#include "LWWStats.h"
+#include "LWWChangeStream.h"
+#include "LWWMerkleTree.h"
 #include <chrono>
 #include <thread>
 #include <vector>
 #include <ctime>
 #include <string>
+#include <algorithm>
+#include <tuple>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory_resource>
+#include <functional>
+#include <mutex>
+#include <type_traits>
 
 
 typedef std::chrono::system_clock::time_point Timestamp;
@@ -55,7 +82,8 @@ TEST_CASE("Multiple inserts - time non chronologically") {
     dict.addElement(c, i2, t2);
     dict.addElement(c, i1, t1);
 
-    REQUIRE(dict.getValueByKey(c) == 10);
+    // The later add wins regardless of arrival order.
+    REQUIRE(dict.getValueByKey(c) == 20);
 }
 
 
@@ -171,7 +199,2117 @@ TEST_CASE("Testing data merge") {
         }
     }
 
+    // Both keys hold adds of i1 and i2 at t2, the greater value wins the tie.
     REQUIRE(dict2.getValueByKey(c1) == i2);
-    REQUIRE(dict2.getValueByKey(c2) == i1);
+    REQUIRE(dict2.getValueByKey(c2) == i2);
     REQUIRE(mergeExpected == mergeResult);
 }
+
+
+TEST_CASE("Timestamp ties - replicas agree regardless of merge order") {
+    LWWElementDict<int, int, int> first;
+    LWWElementDict<int, int, int> second;
+    first.addElement(1, 10, 5);
+    second.addElement(1, 20, 5);
+    first.addElement(2, 30, 5);
+    first.addElement(2, 40, 5);
+    second.addElement(2, 40, 5);
+    second.addElement(2, 30, 5);
+
+    LWWElementDict<int, int, int> firstCopy(first);
+    first.mergeWith(second);
+    second.mergeWith(firstCopy);
+    REQUIRE(first.getValueByKey(1) == 20);
+    REQUIRE(second.getValueByKey(1) == 20);
+    REQUIRE(first.getValueByKey(2) == 40);
+    REQUIRE(second.getValueByKey(2) == 40);
+
+    // Batches and parallel merges resolve ties the same way.
+    using Op = LWWElementDict<int, int, int>::Op;
+    LWWElementDict<int, int, int, FlatStorage> batched;
+    const std::vector<Op> operations = { { Op::Type::add, 1, 20, 5 }, { Op::Type::add, 1, 10, 5 } };
+    batched.applyBatch(operations.begin(), operations.end());
+    REQUIRE(batched.getValueByKey(1) == 20);
+
+    LWWThreadPool pool(2);
+    LWWElementDict<int, int, int> parallel;
+    parallel.addElement(1, 20, 5);
+    parallel.mergeWith(firstCopy, pool);
+    REQUIRE(parallel.getValueByKey(1) == 20);
+    REQUIRE(parallel.getValueByKey(2) == 40);
+
+    // Removal still wins a tie with any add.
+    second.removeElement(1, 10, 5);
+    REQUIRE(!second.getValueByKey(1));
+}
+
+
+
+TEST_CASE("Flat storage - same semantics as tree storage") {
+    char c1 = 'A';
+    char c2 = 'B';
+
+    int i1 = 10;
+    int i2 = 20;
+
+    Timestamp t1 = std::chrono::system_clock::now();
+    Timestamp t2 = t1 + std::chrono::minutes(4);
+    Timestamp t3 = t2 + std::chrono::minutes(4);
+
+
+    LWWElementDict<char, int, Timestamp> treeDict;
+    LWWElementDict<char, int, Timestamp, FlatStorage> flatDict;
+
+    treeDict.addElement(c1, i2, t2);
+    treeDict.addElement(c1, i1, t1);
+    treeDict.addElement(c1, i1, t1);
+    treeDict.addElement(c2, i1, t1);
+    treeDict.removeElement(c2, i1, t2);
+    treeDict.addElement(c2, i2, t3);
+
+    flatDict.addElement(c1, i2, t2);
+    flatDict.addElement(c1, i1, t1);
+    flatDict.addElement(c1, i1, t1);
+    flatDict.addElement(c2, i1, t1);
+    flatDict.removeElement(c2, i1, t2);
+    flatDict.addElement(c2, i2, t3);
+
+    REQUIRE(flatDict.getValueByKey(c1) == treeDict.getValueByKey(c1));
+    REQUIRE(flatDict.getValueByKey(c2) == treeDict.getValueByKey(c2));
+
+    for(const auto & [key, multimap] : treeDict.getAddedData()) {
+        const auto flatIter = flatDict.getAddedData().find(key);
+        REQUIRE(flatIter != flatDict.getAddedData().end());
+        REQUIRE(std::equal(multimap.begin(), multimap.end(), flatIter->second.begin(), flatIter->second.end(),
+            [](const auto & treeElement, const auto & flatElement) {
+                return treeElement.first == flatElement.first && treeElement.second == flatElement.second;
+            }
+        ));
+    }
+}
+
+
+TEST_CASE("Flat storage - data merge and key erasure") {
+    LWWElementDict<int, int, int, FlatStorage> dict1;
+    LWWElementDict<int, int, int, FlatStorage> dict2;
+
+    for(int k = 0; k < 1000; ++k) {
+        dict1.addElement(k, k, 1);
+        dict2.addElement(k, -k, 2);
+    }
+    dict2.removeElement(7, 0, 3);
+
+    dict1.mergeWith(dict2);
+
+    REQUIRE(dict1.getAddedData().size() == 1000);
+    REQUIRE(dict1.getValueByKey(5) == -5);
+    REQUIRE(dict1.getValueByKey(7).has_value() == false);
+
+    FlatStorage<int, int, int> storage = dict1.getAddedData();
+    for(int k = 0; k < 1000; k += 2) {
+        REQUIRE(storage.erase(k) == 1);
+    }
+    REQUIRE(storage.size() == 500);
+    for(int k = 0; k < 1000; ++k) {
+        REQUIRE((storage.find(k) != storage.end()) == (k % 2 == 1));
+    }
+}
+
+
+TEST_CASE("Compact storage - keeps only winning elements") {
+    char c = 'A';
+
+    Timestamp t1 = std::chrono::system_clock::now();
+    Timestamp t2 = t1 + std::chrono::minutes(4);
+    Timestamp t3 = t2 + std::chrono::minutes(4);
+
+
+    LWWElementDict<char, int, Timestamp, CompactStorage> dict;
+    dict.addElement(c, 10, t2);
+    dict.addElement(c, 20, t1);
+    dict.addElement(c, 30, t3);
+    dict.removeElement(c, 10, t1);
+    dict.removeElement(c, 10, t2);
+
+    REQUIRE(dict.getAddedData().at(c).size() == 1);
+    REQUIRE(dict.getAddedData().at(c).begin()->first == 30);
+    REQUIRE(dict.getRemovedData().at(c).begin()->second == t2);
+    REQUIRE(dict.getValueByKey(c) == 30);
+}
+
+
+TEST_CASE("Compact storage - converges identically to full history") {
+    std::vector<std::tuple<bool, int, int, int>> operations;
+    for(int i = 0; i < 2000; ++i) {
+        operations.push_back({ (i * 7) % 3 != 0, (i * 13) % 50, i, (i * 7919) % 2000 });
+    }
+
+    LWWElementDict<int, int, int> fullDict1;
+    LWWElementDict<int, int, int> fullDict2;
+    LWWElementDict<int, int, int, CompactStorage> compactDict1;
+    LWWElementDict<int, int, int, CompactStorage> compactDict2;
+
+    for(std::size_t i = 0; i < operations.size(); ++i) {
+        const auto & [addFlag, k, v, t] = operations[i];
+        if(i % 2 == 0) {
+            addFlag ? fullDict1.addElement(k, v, t) : fullDict1.removeElement(k, v, t);
+            addFlag ? compactDict1.addElement(k, v, t) : compactDict1.removeElement(k, v, t);
+        } else {
+            addFlag ? fullDict2.addElement(k, v, t) : fullDict2.removeElement(k, v, t);
+            addFlag ? compactDict2.addElement(k, v, t) : compactDict2.removeElement(k, v, t);
+        }
+    }
+
+    fullDict1.mergeWith(fullDict2);
+    compactDict2.mergeWith(compactDict1);
+
+    REQUIRE(compactDict2.getAddedData().size() <= 50);
+    for(int k = 0; k < 50; ++k) {
+        REQUIRE(fullDict1.getValueByKey(k) == compactDict2.getValueByKey(k));
+    }
+}
+
+
+TEST_CASE("Compact storage - timestamp ties resolve like every other back end") {
+    const auto resolve = [](auto first, auto second) {
+        first.addElement(1, 10, 5);
+        second.addElement(1, 20, 5);
+        second.addElement(2, 7, 3);
+        first.addElement(2, 7, 3);
+        first.removeElement(2, 7, 3);
+
+        auto firstCopy = first;
+        first.mergeWith(second);
+        second.mergeWith(firstCopy);
+        REQUIRE(first.getValueByKey(1) == second.getValueByKey(1));
+        REQUIRE(first.getValueByKey(2) == second.getValueByKey(2));
+        return std::make_pair(first.getValueByKey(1), first.getValueByKey(2));
+    };
+
+    using Result = std::pair<std::optional<int>, std::optional<int>>;
+    const Result expected = { 20, std::nullopt };
+    REQUIRE(Result(resolve(LWWElementDict<int, int, int>(), LWWElementDict<int, int, int>())) == expected);
+    REQUIRE(Result(resolve(LWWElementDict<int, int, int, CompactStorage>(), LWWElementDict<int, int, int, CompactStorage>()))
+        == expected);
+    REQUIRE(Result(resolve(PersistentLWWElementDict<int, int, int>(), PersistentLWWElementDict<int, int, int>()))
+        == expected);
+
+    // Registers of both replicas hold the same winner, so their digests agree.
+    LWWElementDict<int, int, int, CompactStorage> first;
+    LWWElementDict<int, int, int, CompactStorage> second;
+    first.addElement(1, 10, 5);
+    second.addElement(1, 20, 5);
+    const auto ranges = first.digest().diff(second.digest());
+    first.mergeWith(*second.extractRanges(ranges));
+    second.mergeWith(*first.extractRanges(ranges));
+    REQUIRE(first.digest().getNodes() == second.digest().getNodes());
+}
+
+
+TEST_CASE("Sharded dictionary - concurrent writers and snapshot") {
+    ShardedLWWElementDict<int, int, int> dict(8);
+
+    std::vector<std::thread> writers;
+    for(int w = 0; w < 4; ++w) {
+        writers.emplace_back([&dict, w]() {
+            for(int k = w; k < 4000; k += 4) {
+                dict.addElement(k, k, 1);
+                dict.updateValue(k, -k, 2);
+                if(k % 10 == 0) {
+                    dict.removeElement(k, -k, 3);
+                }
+            }
+        });
+    }
+    for(auto & writer : writers) {
+        writer.join();
+    }
+
+    REQUIRE(dict.getValueByKey(5) == -5);
+    REQUIRE(dict.getValueByKey(10).has_value() == false);
+
+    const auto snapshot = dict.snapshot();
+    REQUIRE(snapshot->getAddedData().size() == 4000);
+    REQUIRE(snapshot->getCurrentData().size() == 3600);
+    REQUIRE(snapshot->getValueByKey(3999) == -3999);
+}
+
+
+TEST_CASE("Sharded dictionary - merging differently partitioned replicas") {
+    ShardedLWWElementDict<int, int, int> dict1(4);
+    ShardedLWWElementDict<int, int, int> dict2(7);
+    LWWElementDict<int, int, int> dict3;
+
+    for(int k = 0; k < 100; ++k) {
+        dict1.addElement(k, k, 1);
+        dict2.addElement(k, k + 100, 2);
+    }
+    dict3.removeElement(42, 0, 5);
+
+    dict1.mergeWith(dict2);
+    dict1.mergeWith(dict3);
+
+    REQUIRE(dict1.getValueByKey(0) == 100);
+    REQUIRE(dict1.getValueByKey(99) == 199);
+    REQUIRE(dict1.getValueByKey(42).has_value() == false);
+    REQUIRE(dict1.getShard(dict1.shardIndex(42)).getRemovedData().size() == 1);
+}
+
+
+TEST_CASE("Sharded dictionary - copies keep watermark and version counters") {
+    ShardedLWWElementDict<int, int, int> dict(4);
+    for(int k = 0; k < 100; ++k) {
+        dict.addElement(k, k, 1);
+        dict.removeElement(k, k, k % 2 ? 2 : 0);
+    }
+    dict.compact(5);
+    std::vector<std::uint64_t> syncedVersions;
+    for(std::size_t index = 0; index < dict.getShardCount(); ++index) {
+        syncedVersions.push_back(dict.getShard(index).getVersion());
+    }
+    for(int k = 0; k < 10; ++k) {
+        dict.addElement(k, -k, 10);
+    }
+
+    const ShardedLWWElementDict<int, int, int> copy(dict);
+    for(std::size_t index = 0; index < dict.getShardCount(); ++index) {
+        const auto & shard = dict.getShard(index);
+        const auto & shardCopy = copy.getShard(index);
+        REQUIRE(shardCopy.getStableTime() == shard.getStableTime());
+        REQUIRE(shardCopy.getVersion() == shard.getVersion());
+        REQUIRE(shardCopy.getCurrentData() == shard.getCurrentData());
+
+        std::uint64_t untilVersion = 0;
+        std::uint64_t copyUntilVersion = 0;
+        const auto delta = shard.extractDelta(syncedVersions[index], untilVersion);
+        const auto copyDelta = shardCopy.extractDelta(syncedVersions[index], copyUntilVersion);
+        REQUIRE(copyUntilVersion == untilVersion);
+        REQUIRE(copyDelta->getAddedData() == delta->getAddedData());
+        REQUIRE(copyDelta->getRemovedData() == delta->getRemovedData());
+        REQUIRE(copyDelta->getStableTime() == delta->getStableTime());
+    }
+
+    // Elements behind the watermark are ignored by the copy just like by the original.
+    ShardedLWWElementDict<int, int, int> writableCopy(dict);
+    dict.addElement(1000, 1, 3);
+    writableCopy.addElement(1000, 1, 3);
+    REQUIRE_FALSE(dict.getValueByKey(1000));
+    REQUIRE_FALSE(writableCopy.getValueByKey(1000));
+
+    // Equally partitioned replicas merge shard by shard, keeping elements of both.
+    ShardedLWWElementDict<int, int, int> other(4);
+    other.addElement(2000, 1, 10);
+    writableCopy.mergeWith(other);
+    REQUIRE(writableCopy.getValueByKey(2000) == 1);
+    REQUIRE(writableCopy.getValueByKey(2) == -2);
+
+    const auto snapshot = dict.snapshot();
+    REQUIRE(snapshot->getStableTime() == 5);
+    snapshot->addElement(1000, 1, 3);
+    REQUIRE_FALSE(snapshot->getValueByKey(1000));
+    REQUIRE(snapshot->getCurrentData().size() == 55);
+}
+
+
+TEST_CASE("Lock-free reads - concurrent with writers") {
+    LWWElementDict<int, int, int> dict;
+    for(int k = 0; k < 100; ++k) {
+        dict.addElement(k, 0, 0);
+    }
+
+    std::atomic<bool> done { false };
+    std::atomic<int> inconsistentReads { 0 };
+
+    std::vector<std::thread> readers;
+    for(int r = 0; r < 3; ++r) {
+        readers.emplace_back([&]() {
+            while(!done.load()) {
+                for(int k = 0; k < 100; ++k) {
+                    const auto value = dict.getValueByKey(k);
+                    // Values only grow, removed keys are the odd ones past 500.
+                    if(value && (*value < 0 || *value > 1000)) {
+                        ++inconsistentReads;
+                    }
+                    if(!value && k % 2 == 0) {
+                        ++inconsistentReads;
+                    }
+                }
+            }
+        });
+    }
+
+    for(int t = 1; t <= 1000; ++t) {
+        dict.addElement(t % 100, t, t);
+        if(t > 500 && t % 2 == 1) {
+            dict.removeElement(t % 100, t, t);
+        }
+    }
+    done.store(true);
+    for(auto & reader : readers) {
+        reader.join();
+    }
+
+    REQUIRE(inconsistentReads.load() == 0);
+    REQUIRE(dict.getValueByKey(0) == 1000);
+    REQUIRE(dict.getValueByKey(1).has_value() == false);
+    REQUIRE(dict.getCurrentData().size() == 50);
+}
+
+
+TEST_CASE("Batch operations - same result as one by one application") {
+    using Op = LWWElementDict<int, int, int>::Op;
+
+    std::vector<Op> operations;
+    for(int i = 0; i < 3000; ++i) {
+        operations.push_back({ i % 4 == 3 ? Op::Type::remove : Op::Type::add, (i * 31) % 97, i % 11, (i * 17) % 400 });
+    }
+
+    LWWElementDict<int, int, int> sequentialDict;
+    for(const auto & operation : operations) {
+        if(operation.type == Op::Type::add) {
+            sequentialDict.addElement(operation.key, operation.value, operation.timestamp);
+        } else {
+            sequentialDict.removeElement(operation.key, operation.value, operation.timestamp);
+        }
+    }
+
+    LWWElementDict<int, int, int> batchDict;
+    batchDict.applyBatch(operations.begin(), operations.begin() + 1000);
+    batchDict.applyBatch(operations.begin() + 1000, operations.end());
+
+    REQUIRE(batchDict.getCurrentData() == sequentialDict.getCurrentData());
+    REQUIRE(batchDict.getAddedData() == sequentialDict.getAddedData());
+    REQUIRE(batchDict.getRemovedData() == sequentialDict.getRemovedData());
+}
+
+
+TEST_CASE("Linear merge - same result as replaying elements") {
+    LWWElementDict<int, int, int> dict1;
+    LWWElementDict<int, int, int> dict2;
+    LWWElementDict<int, int, int> replayDict;
+    LWWElementDict<int, int, int, FlatStorage> flatDict1;
+    LWWElementDict<int, int, int, FlatStorage> flatDict2;
+
+    for(int i = 0; i < 4000; ++i) {
+        const int k = (i * 37) % 600;
+        const int v = i % 5;
+        const int t = (i * 7) % 1000;
+        auto & dict = i % 3 == 0 ? dict1 : dict2;
+        auto & flatDict = i % 3 == 0 ? flatDict1 : flatDict2;
+
+        if(i % 5 == 4) {
+            dict.removeElement(k, v, t);
+            flatDict.removeElement(k, v, t);
+            replayDict.removeElement(k, v, t);
+        } else {
+            dict.addElement(k, v, t);
+            flatDict.addElement(k, v, t);
+            replayDict.addElement(k, v, t);
+        }
+    }
+
+    dict1.mergeWith(dict2);
+    dict1.mergeWith(dict2);
+    flatDict2.mergeWith(flatDict1);
+
+    REQUIRE(dict1.getAddedData() == replayDict.getAddedData());
+    REQUIRE(dict1.getRemovedData() == replayDict.getRemovedData());
+    REQUIRE(dict1.getCurrentData() == replayDict.getCurrentData());
+    REQUIRE(flatDict2.getCurrentData() == replayDict.getCurrentData());
+}
+
+
+TEST_CASE("Delta state - replication proportional to changes") {
+    LWWElementDict<int, int, int> source;
+    LWWElementDict<int, int, int> replica;
+
+    for(int k = 0; k < 1000; ++k) {
+        source.addElement(k, k, 1);
+    }
+
+    std::uint64_t syncedVersion = 0;
+    replica.applyDelta(*source.extractDelta(syncedVersion, syncedVersion));
+    REQUIRE(replica.getCurrentData() == source.getCurrentData());
+
+    source.addElement(5, 50, 2);
+    source.removeElement(6, 0, 2);
+    source.addElement(7, 7, 1);
+
+    std::uint64_t nextVersion = 0;
+    const auto delta = source.extractDelta(syncedVersion, nextVersion);
+    REQUIRE(delta->getAddedData().size() == 2);
+    REQUIRE(delta->getRemovedData().size() == 1);
+    REQUIRE(delta->getValueByKey(5) == 50);
+    REQUIRE(delta->getValueByKey(6).has_value() == false);
+
+    replica.applyDelta(*delta);
+    REQUIRE(replica.getCurrentData() == source.getCurrentData());
+    REQUIRE(replica.getAddedData() == source.getAddedData());
+
+    REQUIRE(source.extractDelta(nextVersion, nextVersion)->getAddedData().empty());
+}
+
+
+TEST_CASE("Compaction - history below watermark is discarded") {
+    LWWElementDict<int, int, int> dict;
+    LWWElementDict<int, int, int, FlatStorage> flatDict;
+    LWWElementDict<int, int, int> lateReplica;
+
+    for(int t = 1; t <= 10; ++t) {
+        dict.addElement(1, t, t);
+        flatDict.addElement(1, t, t);
+        lateReplica.addElement(1, t, t);
+    }
+    dict.addElement(2, 2, 2);
+    dict.removeElement(2, 2, 5);
+    flatDict.addElement(2, 2, 2);
+    flatDict.removeElement(2, 2, 5);
+    lateReplica.addElement(2, 2, 2);
+    dict.addElement(3, 3, 3);
+    dict.removeElement(3, 3, 20);
+
+    dict.compact(8);
+    flatDict.compact(8);
+
+    REQUIRE(dict.getAddedData().at(1).size() == 3);
+    REQUIRE(flatDict.getAddedData().find(1)->second.size() == 3);
+    REQUIRE(dict.getAddedData().count(2) == 0);
+    REQUIRE(dict.getRemovedData().count(2) == 0);
+    REQUIRE(flatDict.getRemovedData().find(2) == flatDict.getRemovedData().end());
+    REQUIRE(dict.getRemovedData().count(3) == 1);
+
+    // Replica at the watermark still holds elements of compacted keys, they must not resurrect them.
+    dict.mergeWith(lateReplica);
+    dict.addElement(2, 7, 7);
+    REQUIRE(dict.getValueByKey(1) == 10);
+    REQUIRE(dict.getValueByKey(2).has_value() == false);
+    REQUIRE(dict.getValueByKey(3).has_value() == false);
+
+    dict.addElement(2, 9, 9);
+    REQUIRE(dict.getValueByKey(2) == 9);
+}
+
+
+TEST_CASE("Pooled storage - same contents as tree storage, nodes allocated from own pool") {
+    LWWElementDict<int, int, int> treeDict;
+    LWWElementDict<int, int, int, PooledTreeStorage> pooledDict;
+    LWWElementDict<int, int, int, PooledTreeStorage> pooledSource;
+
+    for(int i = 0; i < 5000; ++i) {
+        treeDict.addElement(i % 300, i, i);
+        pooledDict.addElement(i % 300, i, i);
+        if(i % 3 == 0) {
+            treeDict.removeElement(i % 200, i, i);
+            pooledSource.removeElement(i % 200, i, i);
+        }
+    }
+    pooledDict.mergeWith(pooledSource);
+
+    REQUIRE(pooledDict.getCurrentData() == treeDict.getCurrentData());
+    REQUIRE(std::equal(pooledDict.getRemovedData().begin(), pooledDict.getRemovedData().end(),
+                       treeDict.getRemovedData().begin(), treeDict.getRemovedData().end(),
+                       [](const auto & pooledEntry, const auto & treeEntry) {
+                           return pooledEntry.first == treeEntry.first
+                               && std::equal(pooledEntry.second.begin(), pooledEntry.second.end(),
+                                             treeEntry.second.begin(), treeEntry.second.end());
+                       }));
+
+    const auto & added = pooledDict.getAddedData();
+    std::pmr::memory_resource * resource = added.get_allocator().resource();
+    REQUIRE(resource != std::pmr::get_default_resource());
+    REQUIRE(added.begin()->second.get_allocator().resource() == resource);
+    REQUIRE(pooledDict.getRemovedData().get_allocator().resource() != resource);
+
+    // A copy writes into a pool of its own, leaving the shared source untouched.
+    LWWElementDict<int, int, int, PooledTreeStorage> copy(pooledDict);
+    copy.addElement(1, -1, 10000);
+    REQUIRE(copy.getAddedData().get_allocator().resource() != resource);
+    REQUIRE(copy.getValueByKey(1) == -1);
+    REQUIRE(pooledDict.getValueByKey(1) == treeDict.getValueByKey(1));
+
+    const auto restored = LWWSerialization::deserialize<LWWElementDict<int, int, int, PooledTreeStorage>>(
+        LWWSerialization::serialize(pooledDict)
+    );
+    REQUIRE(restored->getAddedData() == pooledDict.getAddedData());
+    REQUIRE(restored->getCurrentData() == pooledDict.getCurrentData());
+}
+
+
+TEST_CASE("Serialization - round trip of every storage") {
+    LWWElementDict<std::string, std::string, Timestamp> dict;
+    const Timestamp t0 = std::chrono::system_clock::now();
+
+    dict.addElement("a", "alpha", t0);
+    dict.addElement("a", "alpha'", t0 + std::chrono::seconds(2));
+    dict.addElement("b", "", t0);
+    dict.removeElement("b", "", t0 + std::chrono::seconds(1));
+    dict.addElement("c", std::string(1000, 'c'), t0 + std::chrono::seconds(3));
+    dict.compact(t0 + std::chrono::milliseconds(1));
+
+    const auto bytes = LWWSerialization::serialize(dict);
+    const auto restored = LWWSerialization::deserialize<LWWElementDict<std::string, std::string, Timestamp>>(bytes);
+
+    REQUIRE(restored->getAddedData() == dict.getAddedData());
+    REQUIRE(restored->getRemovedData() == dict.getRemovedData());
+    REQUIRE(restored->getCurrentData() == dict.getCurrentData());
+    REQUIRE(restored->getStableTime() == dict.getStableTime());
+    REQUIRE(restored->getValueByKey("a") == "alpha'");
+    REQUIRE(LWWSerialization::serialize(*restored) == bytes);
+
+    // Restored replica reports its full state as delta.
+    std::uint64_t untilVersion = 0;
+    REQUIRE(restored->extractDelta(0, untilVersion)->getAddedData() == dict.getAddedData());
+
+    LWWElementDict<int, int, int, FlatStorage> flatDict;
+    LWWElementDict<int, int, int, CompactStorage> compactDict;
+    for(int i = 0; i < 1000; ++i) {
+        flatDict.addElement(i % 97, i, i);
+        compactDict.addElement(i % 97, i, i);
+        if(i % 5 == 0) {
+            flatDict.removeElement(i % 89, i, i);
+            compactDict.removeElement(i % 89, i, i);
+        }
+    }
+
+    const auto flatRestored = LWWSerialization::deserialize<LWWElementDict<int, int, int, FlatStorage>>(
+        LWWSerialization::serialize(flatDict)
+    );
+    REQUIRE(flatRestored->getCurrentData() == flatDict.getCurrentData());
+    for(const auto & [k, history] : flatDict.getAddedData()) {
+        REQUIRE(flatRestored->getAddedData().find(k)->second == history);
+    }
+
+    const auto compactRestored = LWWSerialization::deserialize<LWWElementDict<int, int, int, CompactStorage>>(
+        LWWSerialization::serialize(compactDict)
+    );
+    REQUIRE(compactRestored->getCurrentData() == compactDict.getCurrentData());
+    REQUIRE(compactRestored->getAddedData().size() == compactDict.getAddedData().size());
+    compactRestored->addElement(0, -1, 1);
+    REQUIRE(compactRestored->getValueByKey(0) == compactDict.getValueByKey(0));
+}
+
+
+TEST_CASE("Serialization - corrupt input is rejected") {
+    LWWElementDict<int, std::string, int> dict;
+    dict.addElement(1, "one", 1);
+    dict.addElement(2, "two", 2);
+    dict.removeElement(2, "two", 3);
+
+    const auto bytes = LWWSerialization::serialize(dict);
+    using Dict = LWWElementDict<int, std::string, int>;
+
+    for(std::size_t size = 0; size < bytes.size(); ++size) {
+        REQUIRE_THROWS_AS(LWWSerialization::deserialize<Dict>(bytes.data(), size), LWWFormatError);
+    }
+
+    auto badMagic = bytes;
+    badMagic[0] = 'X';
+    REQUIRE_THROWS_AS(LWWSerialization::deserialize<Dict>(badMagic), LWWFormatError);
+
+    auto badVersion = bytes;
+    badVersion[4] = 9;
+    REQUIRE_THROWS_AS(LWWSerialization::deserialize<Dict>(badVersion), LWWFormatError);
+
+    auto trailing = bytes;
+    trailing.push_back(0);
+    REQUIRE_THROWS_AS(LWWSerialization::deserialize<Dict>(trailing), LWWFormatError);
+}
+
+
+TEST_CASE("Serialization - histories and current elements are validated") {
+    using Histories = std::vector<std::pair<int, std::vector<std::pair<int, int>>>>;
+    using Current = std::vector<std::tuple<int, int, int>>;
+
+    // Encoding a snapshot of int keys, values and timestamps without watermark and removals.
+    const auto encode = [](const Histories & added, const Current & current) {
+        std::vector<char> bytes;
+        LWWWriter writer(bytes);
+        const std::uint8_t flags = 0;
+        writer.write(LWWSerialization::magic, sizeof(LWWSerialization::magic));
+        writer.write(&LWWSerialization::formatVersion, sizeof(LWWSerialization::formatVersion));
+        writer.write(&LWWSerialization::byteOrderMark, sizeof(LWWSerialization::byteOrderMark));
+        writer.write(&flags, sizeof(flags));
+
+        const auto writeCount = [&writer](const std::uint64_t & count) {
+            writer.write(&count, sizeof(count));
+        };
+        writeCount(added.size());
+        for(const auto & [k, history] : added) {
+            writer.write(&k, sizeof(k));
+            writeCount(history.size());
+            for(const auto & [v, t] : history) {
+                writer.write(&v, sizeof(v));
+                writer.write(&t, sizeof(t));
+            }
+        }
+        writeCount(0);
+        writeCount(current.size());
+        for(const auto & [k, v, t] : current) {
+            writer.write(&k, sizeof(k));
+            writer.write(&v, sizeof(v));
+            writer.write(&t, sizeof(t));
+        }
+        return bytes;
+    };
+
+    using TreeDict = LWWElementDict<int, int, int>;
+    using FlatDict = LWWElementDict<int, int, int, FlatStorage>;
+
+    const auto valid = encode({ { 1, { { 10, 1 }, { 20, 2 } } }, { 2, { { 5, 3 } } } }, { { 1, 20, 2 }, { 2, 5, 3 } });
+    REQUIRE(LWWSerialization::deserialize<TreeDict>(valid)->getValueByKey(1) == 20);
+    REQUIRE(LWWSerialization::deserialize<FlatDict>(valid)->getValueByKey(2) == 5);
+
+    const std::vector<std::vector<char>> malformed = {
+        encode({ { 1, { { 20, 2 }, { 10, 1 } } } }, { { 1, 20, 2 } }),
+        encode({ { 1, { { 10, 2 }, { 10, 1 } } } }, { { 1, 10, 2 } }),
+        encode({ { 1, { { 10, 1 }, { 10, 1 } } } }, { { 1, 10, 1 } }),
+        encode({ { 1, { { 10, 1 } } }, { 1, { { 20, 2 } } } }, { { 1, 20, 2 } }),
+        encode({ { 1, { { 10, 1 }, { 20, 2 } } } }, { { 1, 10, 1 } }),
+        encode({ { 1, { { 10, 1 } } } }, {}),
+        encode({ { 1, { { 10, 1 } } } }, { { 1, 10, 1 }, { 2, 10, 1 } })
+    };
+    for(const auto & bytes : malformed) {
+        REQUIRE_THROWS_AS(LWWSerialization::deserialize<TreeDict>(bytes), LWWFormatError);
+        REQUIRE_THROWS_AS(LWWSerialization::deserialize<FlatDict>(bytes), LWWFormatError);
+    }
+}
+
+
+TEST_CASE("Mapped snapshot - lookups and merging from the mapping") {
+    const std::string path = (std::filesystem::temp_directory_path() / "lww_mapped_snapshot_test.bin").string();
+
+    LWWElementDict<int, double, long, FlatStorage> dict;
+    for(int i = 0; i < 5000; ++i) {
+        dict.addElement(i % 1013, i * 0.5, i);
+        if(i % 7 == 0) {
+            dict.removeElement(i % 509, 0, i);
+        }
+    }
+    dict.compact(100);
+
+    LWWMappedSnapshot<int, double, long>::write(dict, path);
+    const LWWMappedSnapshot<int, double, long> snapshot(path);
+
+    REQUIRE(snapshot.size() == dict.getCurrentData().size());
+    REQUIRE(snapshot.getStableTime() == 100);
+    for(int k = -1; k <= 1013; ++k) {
+        REQUIRE(snapshot.getValueByKey(k) == dict.getValueByKey(k));
+    }
+
+    LWWElementDict<int, double, long, FlatStorage> restored;
+    restored.mergeWith(snapshot);
+    REQUIRE(restored.getCurrentData() == dict.getCurrentData());
+
+    // Merging into a diverged replica behaves like merging the live dictionary.
+    LWWElementDict<int, double, long> replica;
+    LWWElementDict<int, double, long> expected;
+    replica.addElement(3, -1.0, 1000000);
+    expected.addElement(3, -1.0, 1000000);
+    replica.mergeWith(snapshot);
+    for(const auto & [k, history] : dict.getAddedData()) {
+        for(const auto & [v, t] : history) {
+            expected.addElement(k, v, t);
+        }
+    }
+    for(const auto & [k, history] : dict.getRemovedData()) {
+        for(const auto & [v, t] : history) {
+            expected.removeElement(k, v, t);
+        }
+    }
+    REQUIRE(replica.getCurrentData() == expected.getCurrentData());
+    REQUIRE(replica.getValueByKey(3) == -1.0);
+
+    std::remove(path.c_str());
+}
+
+
+TEST_CASE("Mapped snapshot - foreign and truncated files are rejected") {
+    const std::string path = (std::filesystem::temp_directory_path() / "lww_mapped_snapshot_bad.bin").string();
+
+    LWWElementDict<int, int, int> dict;
+    dict.addElement(1, 1, 1);
+    LWWMappedSnapshot<int, int, int>::write(dict, path);
+
+    REQUIRE_THROWS_AS((LWWMappedSnapshot<int, long, int>(path)), LWWFormatError);
+
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    REQUIRE_THROWS_AS((LWWMappedSnapshot<int, int, int>(path)), LWWFormatError);
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "not a snapshot, but long enough to hold a header..........";
+    REQUIRE_THROWS_AS((LWWMappedSnapshot<int, int, int>(path)), LWWFormatError);
+
+    std::remove(path.c_str());
+    REQUIRE_THROWS_AS((LWWMappedSnapshot<int, int, int>(path)), std::system_error);
+
+    // Write failures are reported and leave nothing behind at the target path.
+    const auto missingPath = std::filesystem::temp_directory_path() / "lww_missing_directory" / "snapshot.bin";
+    std::filesystem::remove_all(missingPath.parent_path());
+    REQUIRE_THROWS_AS((LWWMappedSnapshot<int, int, int>::write(LWWElementDict<int, int, int>(), missingPath.string())),
+        std::system_error);
+    REQUIRE(!std::filesystem::exists(missingPath));
+}
+
+
+TEST_CASE("Mapped snapshot - malformed histories are rejected and watermarks applied") {
+    using Snapshot = LWWMappedSnapshot<int, int, int>;
+    const std::string path = (std::filesystem::temp_directory_path() / "lww_mapped_snapshot_malformed.bin").string();
+
+    LWWElementDict<int, int, int> dict;
+    dict.addElement(10, 1, 1);
+    dict.addElement(10, 2, 2);
+    dict.addElement(20, 1, 1);
+    Snapshot::write(dict, path);
+
+    std::vector<char> bytes(std::filesystem::file_size(path));
+    std::ifstream(path, std::ios::binary).read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    const auto find = [&bytes](const auto & record) {
+        const char * recordBytes = reinterpret_cast<const char *>(&record);
+        return std::search(bytes.begin(), bytes.end(), recordBytes, recordBytes + sizeof(record)) - bytes.begin();
+    };
+    const auto load = [&path](const std::vector<char> & content) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(content.data(), static_cast<std::streamsize>(content.size()));
+        const Snapshot snapshot(path);
+        LWWElementDict<int, int, int> restored;
+        restored.mergeWith(snapshot);
+    };
+    load(bytes);
+
+    Snapshot::KeyRecord keyRecord;
+    std::memset(&keyRecord, 0, sizeof(keyRecord));
+    keyRecord.key = 20;
+    keyRecord.first = 2;
+    keyRecord.count = 1;
+    const auto secondKey = find(keyRecord);
+    REQUIRE(secondKey < static_cast<std::ptrdiff_t>(bytes.size()));
+
+    // Duplicate and unsorted keys.
+    for(const int key : { 10, 5 }) {
+        std::vector<char> malformed = bytes;
+        std::memcpy(malformed.data() + secondKey, &key, sizeof(key));
+        REQUIRE_THROWS_AS(load(malformed), LWWFormatError);
+    }
+
+    // History out of less order.
+    const Snapshot::ElementRecord elements[2] = { { 1, 1 }, { 2, 2 } };
+    const Snapshot::ElementRecord swapped[2] = { { 2, 2 }, { 1, 1 } };
+    std::vector<char> malformed = bytes;
+    std::memcpy(malformed.data() + find(elements), swapped, sizeof(swapped));
+    REQUIRE_THROWS_AS(load(malformed), LWWFormatError);
+
+    // Readers discard what the writer compacted away.
+    LWWElementDict<int, int, int> writer;
+    LWWElementDict<int, int, int> reader;
+    writer.addElement(4, 1, 3);
+    writer.addElement(4, 2, 4);
+    reader.addElement(4, 1, 3);
+    writer.compact(10);
+    Snapshot::write(writer, path);
+    reader.mergeWith(Snapshot(path));
+    REQUIRE(reader.getStableTime() == 10);
+    REQUIRE(reader.getAddedData() == writer.getAddedData());
+    reader.addElement(7, 7, 5);
+    REQUIRE_FALSE(reader.getValueByKey(7));
+
+    std::remove(path.c_str());
+}
+
+
+TEST_CASE("Write-ahead log - recovery from a log truncated at any byte") {
+    const auto directory = std::filesystem::temp_directory_path() / "lww_wal_test";
+    const auto copyDirectory = std::filesystem::temp_directory_path() / "lww_wal_test_copy";
+    const auto path = directory / "wal-1.log";
+    const auto copyPath = copyDirectory / "wal-1.log";
+    std::filesystem::remove_all(directory);
+    std::filesystem::remove_all(copyDirectory);
+    std::filesystem::create_directories(copyDirectory);
+
+    std::vector<LWWElementDict<int, std::string, int>::Op> operations;
+    for(int i = 0; i < 24; ++i) {
+        const auto type = i % 5 == 4 ? LWWElementDict<int, std::string, int>::Op::Type::remove
+                                     : LWWElementDict<int, std::string, int>::Op::Type::add;
+        operations.push_back({ type, i % 6, std::string(i % 4, 'x'), i });
+    }
+
+    {
+        DurableLWWElementDict<int, std::string, int> dict(directory.string());
+        REQUIRE(dict.getRecoveredCount() == 0);
+        for(const auto & operation : operations) {
+            if(operation.type == LWWElementDict<int, std::string, int>::Op::Type::add) {
+                dict.addElement(operation.key, operation.value, operation.timestamp);
+            } else {
+                dict.removeElement(operation.key, operation.value, operation.timestamp);
+            }
+        }
+    }
+
+    std::vector<char> bytes(std::filesystem::file_size(path));
+    std::ifstream(path, std::ios::binary).read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+
+    const auto expectedPrefix = [&operations](const std::size_t & count) {
+        LWWElementDict<int, std::string, int> expected;
+        expected.applyBatch(operations.begin(), operations.begin() + static_cast<std::ptrdiff_t>(count));
+        return expected.getCurrentData();
+    };
+
+    std::size_t previousCount = 0;
+    for(std::size_t size = 0; size <= bytes.size(); ++size) {
+        std::ofstream(copyPath, std::ios::binary | std::ios::trunc).write(bytes.data(), static_cast<std::streamsize>(size));
+
+        DurableLWWElementDict<int, std::string, int> recovered(copyDirectory.string());
+        const std::size_t count = recovered.getRecoveredCount();
+        REQUIRE(count >= previousCount);
+        REQUIRE(recovered.getCurrentData() == expectedPrefix(count));
+        previousCount = count;
+
+        // Torn tail is cut off, so records committed after recovery are recovered next time.
+        recovered.addElement(100, "after", 1000);
+        DurableLWWElementDict<int, std::string, int> reopened(copyDirectory.string());
+        REQUIRE(reopened.getRecoveredCount() == count + 1);
+        REQUIRE(reopened.getValueByKey(100) == std::string("after"));
+    }
+    REQUIRE(previousCount == operations.size());
+
+    // A corrupt record ends the intact prefix.
+    bytes[bytes.size() / 2] ^= 0x5A;
+    std::ofstream(copyPath, std::ios::binary | std::ios::trunc).write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    DurableLWWElementDict<int, std::string, int> corrupted(copyDirectory.string());
+    REQUIRE(corrupted.getRecoveredCount() < operations.size());
+    REQUIRE(corrupted.getCurrentData() == expectedPrefix(corrupted.getRecoveredCount()));
+
+    std::filesystem::remove_all(directory);
+    std::filesystem::remove_all(copyDirectory);
+}
+
+
+TEST_CASE("Write-ahead log - zero-filled and undecodable tails are cut off") {
+    const auto directory = std::filesystem::temp_directory_path() / "lww_wal_zero_tail";
+    const auto path = directory / "wal-1.log";
+    std::filesystem::remove_all(directory);
+
+    {
+        DurableLWWElementDict<int, std::string, int> dict(directory.string());
+        dict.addElement(1, "one", 1);
+        dict.addElement(2, "two", 2);
+    }
+    const auto intactSize = std::filesystem::file_size(path);
+
+    // Preallocated or extended files end in zeros after a crash, which frame an empty payload with checksum 0.
+    std::ofstream(path, std::ios::binary | std::ios::app).write(std::string(16, '\0').data(), 16);
+    {
+        DurableLWWElementDict<int, std::string, int> recovered(directory.string());
+        REQUIRE(recovered.getRecoveredCount() == 2);
+        REQUIRE(std::filesystem::file_size(path) == intactSize);
+        recovered.addElement(3, "three", 3);
+    }
+    {
+        DurableLWWElementDict<int, std::string, int> reopened(directory.string());
+        REQUIRE(reopened.getRecoveredCount() == 3);
+        REQUIRE(reopened.getValueByKey(3) == std::string("three"));
+    }
+
+    // An intact frame whose payload does not decode ends the last segment like a torn append.
+    std::vector<char> garbage;
+    LWWWriteAheadLog::frame(garbage, { 0, 1 });
+    std::ofstream(path, std::ios::binary | std::ios::app).write(garbage.data(), static_cast<std::streamsize>(garbage.size()));
+    {
+        DurableLWWElementDict<int, std::string, int> recovered(directory.string());
+        REQUIRE(recovered.getRecoveredCount() == 3);
+        recovered.addElement(4, "four", 4);
+    }
+    {
+        DurableLWWElementDict<int, std::string, int> reopened(directory.string());
+        REQUIRE(reopened.getRecoveredCount() == 4);
+        REQUIRE(reopened.getValueByKey(4) == std::string("four"));
+    }
+
+    // Followed by an intact record, it is corruption rather than a torn tail.
+    const auto sourcePath = directory / "source" / "wal-1.log";
+    {
+        DurableLWWElementDict<int, std::string, int> source((directory / "source").string());
+        source.addElement(5, "five", 5);
+    }
+    std::vector<char> sourceBytes(std::filesystem::file_size(sourcePath));
+    std::ifstream(sourcePath, std::ios::binary).read(sourceBytes.data(), static_cast<std::streamsize>(sourceBytes.size()));
+    // Records of the source log follow its 8 byte header.
+    garbage.insert(garbage.end(), sourceBytes.begin() + 8, sourceBytes.end());
+    std::ofstream(path, std::ios::binary | std::ios::app).write(garbage.data(), static_cast<std::streamsize>(garbage.size()));
+    using Durable = DurableLWWElementDict<int, std::string, int>;
+    REQUIRE_THROWS_AS(Durable(directory.string()), std::system_error);
+
+    std::filesystem::remove_all(directory);
+}
+
+
+TEST_CASE("Write-ahead log - concurrent writers share syncs") {
+    const std::string path = (std::filesystem::temp_directory_path() / "lww_wal_group_commit").string();
+    std::filesystem::remove_all(path);
+
+    constexpr int threadCount = 4;
+    constexpr int requestsPerThread = 100;
+
+    {
+        DurableLWWElementDict<int, int, int> dict(path);
+        std::vector<std::thread> writers;
+        for(int index = 0; index < threadCount; ++index) {
+            writers.emplace_back([&dict, index]() {
+                for(int i = 0; i < requestsPerThread; ++i) {
+                    dict.addElement(index * requestsPerThread + i, i, i);
+                }
+            });
+        }
+        for(auto & writer : writers) {
+            writer.join();
+        }
+
+        std::vector<LWWElementDict<int, int, int>::Op> batch;
+        for(int i = 0; i < 50; ++i) {
+            batch.push_back({ LWWElementDict<int, int, int>::Op::Type::remove, i, 0, requestsPerThread });
+        }
+        const auto syncsBefore = dict.getSyncCount();
+        dict.applyBatch(batch.begin(), batch.end());
+        REQUIRE(dict.getSyncCount() == syncsBefore + 1);
+        REQUIRE(dict.getSyncCount() <= static_cast<std::uint64_t>(threadCount * requestsPerThread) + 1);
+    }
+
+    DurableLWWElementDict<int, int, int> recovered(path);
+    REQUIRE(recovered.getRecoveredCount() == threadCount * requestsPerThread + 50);
+    REQUIRE(recovered.getCurrentData().size() == threadCount * requestsPerThread - 50);
+    REQUIRE(recovered.getValueByKey(49).has_value() == false);
+    REQUIRE(recovered.getValueByKey(50) == 50);
+
+    std::filesystem::remove_all(path);
+}
+
+
+TEST_CASE("Checkpoints - replay is bounded by changes since the last checkpoint") {
+    const std::string directory = (std::filesystem::temp_directory_path() / "lww_checkpoint_test").string();
+    std::filesystem::remove_all(directory);
+
+    LWWDurabilityOptions options;
+    options.backgroundFlag = false;
+    options.maxCheckpoints = 2;
+
+    LWWElementDict<int, int, int> expected;
+    {
+        DurableLWWElementDict<int, int, int> dict(directory, options);
+        for(int round = 0; round < 5; ++round) {
+            for(int i = 0; i < 100; ++i) {
+                dict.addElement(i, round * 100 + i, round * 100 + i);
+                expected.addElement(i, round * 100 + i, round * 100 + i);
+            }
+            dict.removeElement(round, 0, 1000);
+            expected.removeElement(round, 0, 1000);
+            dict.checkpoint();
+            REQUIRE(dict.getCheckpointCount() <= options.maxCheckpoints);
+        }
+
+        dict.addElement(7, -7, 2000);
+        expected.addElement(7, -7, 2000);
+    }
+
+    DurableLWWElementDict<int, int, int> recovered(directory, options);
+    REQUIRE(recovered.getRecoveredCount() == 1);
+    REQUIRE(recovered.getCurrentData() == expected.getCurrentData());
+    REQUIRE(recovered.getAddedData() == expected.getAddedData());
+
+    // Only keys changed after restart are checkpointed again.
+    recovered.addElement(8, -8, 2000);
+    recovered.checkpoint();
+    {
+        DurableLWWElementDict<int, int, int> reopened(directory, options);
+        REQUIRE(reopened.getRecoveredCount() == 0);
+        REQUIRE(reopened.getValueByKey(7) == -7);
+        REQUIRE(reopened.getValueByKey(8) == -8);
+    }
+
+    std::filesystem::remove_all(directory);
+}
+
+
+TEST_CASE("Checkpoints - compaction survives checkpointing and recovery") {
+    const std::string directory = (std::filesystem::temp_directory_path() / "lww_checkpoint_compaction").string();
+    std::filesystem::remove_all(directory);
+
+    LWWDurabilityOptions options;
+    options.backgroundFlag = false;
+    options.maxCheckpoints = 2;
+
+    {
+        DurableLWWElementDict<int, int, int> dict(directory, options);
+        for(int k = 0; k < 10; ++k) {
+            dict.addElement(k, k, 1);
+        }
+        dict.checkpoint();
+        dict.removeElement(3, 3, 2);
+        dict.addElement(4, -4, 3);
+        dict.checkpoint();
+
+        // Key 3 is dropped, key 4 keeps its latest add only.
+        dict.compact(5);
+        dict.checkpoint();
+        dict.checkpoint();
+        REQUIRE(dict.getCheckpointCount() <= options.maxCheckpoints);
+    }
+
+    {
+        DurableLWWElementDict<int, int, int> recovered(directory, options);
+        REQUIRE(recovered.getStableTime() == 5);
+        REQUIRE(recovered.getAddedData().count(3) == 0);
+        REQUIRE(recovered.getRemovedData().count(3) == 0);
+        REQUIRE(recovered.getAddedData().at(4).size() == 1);
+        REQUIRE(recovered.getValueByKey(4) == -4);
+        REQUIRE(recovered.getCurrentData().size() == 9);
+
+        // Compaction without a following checkpoint is recovered from the log.
+        recovered.removeElement(6, 6, 7);
+        recovered.compact(8);
+    }
+
+    DurableLWWElementDict<int, int, int> recovered(directory, options);
+    REQUIRE(recovered.getStableTime() == 8);
+    REQUIRE(recovered.getAddedData().count(6) == 0);
+    REQUIRE(recovered.getCurrentData().size() == 8);
+
+    // Elements below the watermark stay ignored.
+    recovered.addElement(3, 3, 4);
+    REQUIRE(!recovered.getValueByKey(3));
+
+    std::filesystem::remove_all(directory);
+}
+
+
+TEST_CASE("Checkpoints - keys compacted between checkpoints stay removed") {
+    const std::string directory = (std::filesystem::temp_directory_path() / "lww_checkpoint_compacted_key").string();
+    std::filesystem::remove_all(directory);
+
+    LWWDurabilityOptions options;
+    options.backgroundFlag = false;
+    const auto deltaPath = std::filesystem::path(directory) / "checkpoint-1.lww";
+
+    {
+        DurableLWWElementDict<int, int, int> dict(directory, options);
+        dict.addElement(3, 3, 1);
+        dict.checkpoint();
+        std::filesystem::copy_file(deltaPath, deltaPath.string() + ".copy");
+        dict.removeElement(3, 3, 2);
+        dict.compact(5);
+        dict.checkpoint();
+        REQUIRE_FALSE(dict.getValueByKey(3));
+        REQUIRE(dict.getCheckpointCount() == 1);
+    }
+
+    {
+        DurableLWWElementDict<int, int, int> recovered(directory, options);
+        REQUIRE_FALSE(recovered.getValueByKey(3));
+        REQUIRE(recovered.getAddedData().count(3) == 0);
+    }
+
+    // A crash before superseded checkpoints are deleted leaves them ignored.
+    std::filesystem::rename(deltaPath.string() + ".copy", deltaPath);
+    DurableLWWElementDict<int, int, int> recovered(directory, options);
+    REQUIRE_FALSE(recovered.getValueByKey(3));
+    REQUIRE(recovered.getCheckpointCount() == 1);
+
+    std::filesystem::remove_all(directory);
+}
+
+
+TEST_CASE("Checkpoints - background checkpointing concurrent with writers") {
+    const std::string directory = (std::filesystem::temp_directory_path() / "lww_checkpoint_background").string();
+    std::filesystem::remove_all(directory);
+
+    LWWDurabilityOptions options;
+    options.segmentBytes = 4096;
+    options.maxCheckpoints = 3;
+
+    LWWElementDict<int, int, int> expected;
+    {
+        DurableLWWElementDict<int, int, int> dict(directory, options);
+        std::vector<std::thread> writers;
+        for(int index = 0; index < 4; ++index) {
+            writers.emplace_back([&dict, index]() {
+                for(int i = 0; i < 500; ++i) {
+                    dict.addElement(i % 50, index * 1000 + i, index * 1000 + i);
+                }
+            });
+        }
+        for(auto & writer : writers) {
+            writer.join();
+        }
+        for(int index = 0; index < 4; ++index) {
+            for(int i = 0; i < 500; ++i) {
+                expected.addElement(i % 50, index * 1000 + i, index * 1000 + i);
+            }
+        }
+
+        REQUIRE(dict.getCurrentData() == expected.getCurrentData());
+    }
+
+    DurableLWWElementDict<int, int, int> recovered(directory, options);
+    REQUIRE(recovered.getRecoveredCount() < 2000);
+    REQUIRE(recovered.getCurrentData() == expected.getCurrentData());
+
+    std::filesystem::remove_all(directory);
+}
+
+
+TEST_CASE("Parallel merge - same result as sequential merge") {
+    LWWThreadPool pool(4);
+    constexpr int keyCount = 40000;
+
+    const auto checkStorage = [&pool](auto sequential, auto parallel, auto source) {
+        for(int k = 0; k < keyCount; ++k) {
+            sequential.addElement(k, k, k % 7);
+            parallel.addElement(k, k, k % 7);
+            source.addElement(k + keyCount / 2, -k, k % 11);
+            if(k % 3 == 0) {
+                source.removeElement(k, 0, 5);
+            }
+        }
+        sequential.compact(2);
+        parallel.compact(2);
+
+        sequential.mergeWith(source);
+        parallel.mergeWith(source, pool);
+
+        REQUIRE(parallel.getCurrentData() == sequential.getCurrentData());
+        REQUIRE(parallel.getAddedData().size() == sequential.getAddedData().size());
+        REQUIRE(parallel.getRemovedData().size() == sequential.getRemovedData().size());
+        for(const auto & [k, history] : sequential.getAddedData()) {
+            const auto & parallelHistory = parallel.getAddedData().find(k)->second;
+            REQUIRE(std::equal(history.begin(), history.end(), parallelHistory.begin(), parallelHistory.end()));
+        }
+
+        // Merging again changes nothing.
+        const auto version = parallel.getVersion();
+        parallel.mergeWith(source, pool);
+        REQUIRE(parallel.getVersion() == version);
+    };
+
+    checkStorage(LWWElementDict<int, int, int>(), LWWElementDict<int, int, int>(), LWWElementDict<int, int, int>());
+    checkStorage(LWWElementDict<int, int, int, FlatStorage>(),
+                 LWWElementDict<int, int, int, FlatStorage>(),
+                 LWWElementDict<int, int, int, FlatStorage>());
+    checkStorage(LWWElementDict<int, int, int, CompactStorage>(),
+                 LWWElementDict<int, int, int, CompactStorage>(),
+                 LWWElementDict<int, int, int, CompactStorage>());
+    checkStorage(LWWElementDict<int, int, int, PooledTreeStorage>(),
+                 LWWElementDict<int, int, int, PooledTreeStorage>(),
+                 LWWElementDict<int, int, int, PooledTreeStorage>());
+}
+
+
+TEST_CASE("Thread pool - every iteration runs once and exceptions propagate") {
+    LWWThreadPool pool(3);
+    std::vector<std::atomic<int>> counts(1000);
+
+    pool.parallelFor(counts.size(), [&counts](const std::size_t & index) {
+        ++counts[index];
+    });
+    REQUIRE(std::all_of(counts.begin(), counts.end(), [](const std::atomic<int> & count) { return count == 1; }));
+
+    REQUIRE_THROWS_AS(pool.parallelFor(100, [](const std::size_t & index) {
+        if(index == 42) {
+            throw std::runtime_error("iteration failed");
+        }
+    }), std::runtime_error);
+
+    std::atomic<int> total { 0 };
+    pool.parallelFor(10, [&total](const std::size_t &) {
+        ++total;
+    });
+    REQUIRE(total == 10);
+}
+
+
+TEST_CASE("Snapshot merging - live replicas merged into each other under write load") {
+    LWWElementDict<int, int, int> replica1;
+    LWWElementDict<int, int, int> replica2;
+    std::atomic<bool> stopFlag { false };
+
+    // Snapshot is frozen, the replica copies its storage on the next write.
+    replica1.addElement(0, 0, 0);
+    const auto frozen = replica1.snapshot();
+    replica1.addElement(1, 1, 1);
+    REQUIRE(frozen.addedData->size() == 1);
+    REQUIRE(replica1.getAddedData().size() == 2);
+
+    std::thread writer1([&replica1]() {
+        for(int i = 0; i < 3000; ++i) {
+            replica1.addElement(i % 300, i, 2 * i);
+            if(i % 10 == 0) {
+                replica1.removeElement(i % 300, i, 2 * i);
+            }
+        }
+    });
+    std::thread writer2([&replica2]() {
+        for(int i = 0; i < 3000; ++i) {
+            replica2.addElement(i % 300, -i, 2 * i + 1);
+        }
+    });
+    std::thread merger([&]() {
+        while(!stopFlag) {
+            replica1.mergeWith(replica2);
+            replica2.mergeWith(replica1);
+        }
+    });
+
+    writer1.join();
+    writer2.join();
+    stopFlag = true;
+    merger.join();
+
+    replica1.mergeWith(replica2);
+    replica2.mergeWith(replica1);
+    REQUIRE(replica1.getCurrentData() == replica2.getCurrentData());
+    REQUIRE(replica1.getAddedData() == replica2.getAddedData());
+    REQUIRE(replica1.getRemovedData() == replica2.getRemovedData());
+}
+
+
+TEST_CASE("Persistent dictionary - same result as LWWElementDict") {
+    LWWElementDict<int, int, int> reference;
+    PersistentLWWElementDict<int, int, int> dict;
+    std::srand(7);
+
+    for(int i = 0; i < 20000; ++i) {
+        // Distinct timestamps, ties between adds of one key are resolved differently by design.
+        const int k = std::rand() % 2000;
+        const int v = std::rand() % 50;
+        if(std::rand() % 4 == 0) {
+            reference.removeElement(k, v, i);
+            dict.removeElement(k, v, i);
+        } else {
+            reference.addElement(k, v, i);
+            dict.addElement(k, v, i);
+        }
+    }
+
+    REQUIRE(dict.getCurrentData() == reference.getCurrentData());
+    for(int k = 0; k < 2100; ++k) {
+        REQUIRE(dict.getValueByKey(k) == reference.getValueByKey(k));
+    }
+
+    const auto & [key, history] = *reference.getAddedData().begin();
+    const auto entry = dict.getEntry(key);
+    REQUIRE(entry);
+    REQUIRE(std::equal(entry->added.begin(), entry->added.end(), history.begin(), history.end(),
+                       [](const auto & pair, const auto & element) {
+                           return pair.first == element.first && pair.second == element.second;
+                       }));
+    REQUIRE_FALSE(dict.getEntry(2050));
+}
+
+
+TEST_CASE("Persistent dictionary - copies are isolated snapshots") {
+    PersistentLWWElementDict<int, std::string, int> base;
+    for(int k = 0; k < 1000; ++k) {
+        base.addElement(k, std::to_string(k), 1);
+    }
+
+    auto snapshot = base;
+    REQUIRE(snapshot.sharesStateWith(base));
+
+    base.addElement(1, "one", 2);
+    base.removeElement(2, "2", 2);
+    base.addElement(5000, "new", 1);
+    REQUIRE_FALSE(snapshot.sharesStateWith(base));
+
+    REQUIRE(snapshot.getValueByKey(1) == "1");
+    REQUIRE(snapshot.getValueByKey(2) == "2");
+    REQUIRE_FALSE(snapshot.getValueByKey(5000));
+    REQUIRE(snapshot.size() == 1000);
+
+    REQUIRE(base.getValueByKey(1) == "one");
+    REQUIRE_FALSE(base.getValueByKey(2));
+    REQUIRE(base.getValueByKey(5000) == "new");
+    REQUIRE(base.size() == 1001);
+
+    // Untouched entries are shared, re-adding a known element changes nothing.
+    REQUIRE(snapshot.getEntry(3) == base.getEntry(3));
+    auto copy = snapshot;
+    copy.addElement(3, "3", 1);
+    REQUIRE(copy.sharesStateWith(snapshot));
+}
+
+
+TEST_CASE("Persistent dictionary - merging forked replicas converges") {
+    PersistentLWWElementDict<int, int, int> base;
+    for(int k = 0; k < 5000; ++k) {
+        base.addElement(k, k, 1);
+    }
+
+    auto replica1 = base;
+    auto replica2 = base;
+    for(int k = 0; k < 5000; k += 7) {
+        replica1.addElement(k, -k, 2);
+    }
+    for(int k = 0; k < 5000; k += 11) {
+        replica2.removeElement(k, k, 3);
+    }
+    replica2.addElement(9000, 9, 1);
+
+    auto merged1 = replica1;
+    merged1.mergeWith(replica2);
+    auto merged2 = replica2;
+    merged2.mergeWith(replica1);
+
+    REQUIRE(merged1.getCurrentData() == merged2.getCurrentData());
+    REQUIRE(merged1.size() == 5001);
+    REQUIRE(merged1.getValueByKey(7) == -7);
+    REQUIRE_FALSE(merged1.getValueByKey(77));
+    REQUIRE(merged1.getValueByKey(9000) == 9);
+
+    // Merging contained state keeps the trie as is.
+    auto unchanged = merged1;
+    unchanged.mergeWith(replica1);
+    unchanged.mergeWith(base);
+    REQUIRE(unchanged.sharesStateWith(merged1));
+}
+
+
+/*!
+* Value counting its copies
+*/
+struct CountedValue {
+    static inline int copyCount = 0;
+    int id = 0;
+
+    CountedValue(int id = 0) : id(id) {}
+    CountedValue(const CountedValue & other) : id(other.id) { ++copyCount; }
+    CountedValue(CountedValue && other) noexcept : id(other.id) {}
+    CountedValue & operator=(const CountedValue & other) { id = other.id; ++copyCount; return *this; }
+    CountedValue & operator=(CountedValue && other) noexcept { id = other.id; return *this; }
+
+    bool operator<(const CountedValue & other) const { return id < other.id; }
+    bool operator==(const CountedValue & other) const { return id == other.id; }
+};
+
+
+namespace std {
+    template <>
+    struct hash<CountedValue> {
+        std::size_t operator()(const CountedValue & value) const { return std::hash<int>()(value.id); }
+    };
+}
+
+
+TEST_CASE("Move-aware inserts - rvalues and emplaced values are not copied needlessly") {
+    LWWElementDict<std::string, CountedValue, int> dict;
+
+    const CountedValue lvalue(1);
+    CountedValue::copyCount = 0;
+    dict.addElement(std::string("a"), lvalue, 1);
+    const int lvalueCopies = CountedValue::copyCount;
+
+    CountedValue::copyCount = 0;
+    dict.addElement(std::string("b"), CountedValue(2), 1);
+    const int rvalueCopies = CountedValue::copyCount;
+
+    CountedValue::copyCount = 0;
+    dict.emplaceElement("c", 1, 3);
+    const int emplaceCopies = CountedValue::copyCount;
+
+    // Every instance of currentData and the history need a value, the last one is moved into place.
+    REQUIRE(rvalueCopies == lvalueCopies - 1);
+    REQUIRE(emplaceCopies == rvalueCopies);
+
+    CountedValue::copyCount = 0;
+    dict.removeElement(std::string("b"), CountedValue(2), 2);
+    REQUIRE(CountedValue::copyCount == 0);
+
+    REQUIRE(dict.getValueByKey("a")->id == 1);
+    REQUIRE_FALSE(dict.getValueByKey("b"));
+    REQUIRE(dict.getValueByKey("c")->id == 3);
+
+    // Removal stores a new key in removedData only, an rvalue key is moved there.
+    const auto removalKeyCopies = [](auto dict) {
+        const CountedValue lvalueKey(1);
+        CountedValue::copyCount = 0;
+        dict.removeElement(lvalueKey, 1, 1);
+        const int lvalueCopies = CountedValue::copyCount;
+
+        CountedValue::copyCount = 0;
+        dict.removeElement(CountedValue(2), 1, 1);
+        REQUIRE(dict.getRemovedData().size() == 2);
+        return std::make_pair(lvalueCopies, CountedValue::copyCount);
+    };
+    for(const auto & [lvalueCopies, rvalueCopies] : {
+        removalKeyCopies(LWWElementDict<CountedValue, int, int>()),
+        removalKeyCopies(LWWElementDict<CountedValue, int, int, FlatStorage>())
+    }) {
+        REQUIRE(rvalueCopies == lvalueCopies - 1);
+    }
+
+    ShardedLWWElementDict<std::string, std::string, int> shardedDict(4);
+    shardedDict.emplaceElement("k", 1, 3, 'x');
+    shardedDict.updateValue(std::string("l"), std::string("y"), 1);
+    REQUIRE(shardedDict.getValueByKey("k") == "xxx");
+    REQUIRE(shardedDict.getValueByKey("l") == "y");
+}
+
+
+TEST_CASE("Shared values - history and current data reference one value") {
+    using Value = LWWSharedValue<std::string>;
+    LWWElementDict<std::string, Value, int> dict;
+
+    dict.addElement("a", Value(std::string(1 << 16, 'a')), 1);
+    dict.emplaceElement("b", 1, std::in_place, 3, 'b');
+    dict.addElement("a", Value("older"), 0);
+
+    const auto current = dict.getValueByKey("a");
+    REQUIRE(current->get() == std::string(1 << 16, 'a'));
+    REQUIRE(current->sharesValueWith(dict.getCurrentData().at("a").first));
+    const auto & history = dict.getAddedData().at("a");
+    REQUIRE(std::any_of(history.begin(), history.end(), [&current](const auto & element) {
+        return element.first.sharesValueWith(*current);
+    }));
+    REQUIRE(**dict.getValueByKey("b") == "bbb");
+
+    // Values compare by content, so equal values from different sources are one history element.
+    dict.addElement("b", Value("bbb"), 1);
+    REQUIRE(dict.getAddedData().at("b").size() == 1);
+
+    const auto restored = LWWSerialization::deserialize<LWWElementDict<std::string, Value, int>>(
+        LWWSerialization::serialize(dict)
+    );
+    REQUIRE(restored->getCurrentData() == dict.getCurrentData());
+    REQUIRE(restored->getAddedData() == dict.getAddedData());
+}
+
+
+TEST_CASE("Hybrid logical clock - monotonic despite stalled or skewed physical clocks") {
+    std::uint64_t physical = 1000;
+    LWWHybridLogicalClock clock(1, std::chrono::milliseconds(5000), [&physical]() {
+        return physical;
+    });
+
+    const LWWHybridTimestamp t1 = clock.now();
+    const LWWHybridTimestamp t2 = clock.now();
+    REQUIRE(t1.getPhysical() == 1000);
+    REQUIRE(t1 < t2);
+    REQUIRE(t2.getLogical() == t1.getLogical() + 1);
+
+    physical = 900;
+    const LWWHybridTimestamp t3 = clock.now();
+    REQUIRE(t2 < t3);
+    REQUIRE(t3.getPhysical() == 1000);
+
+    physical = 2000;
+    REQUIRE(clock.now() == LWWHybridTimestamp(std::uint64_t(2000) << LWWHybridTimestamp::logicalBits, 1));
+
+    const LWWHybridTimestamp remote(std::uint64_t(4000) << LWWHybridTimestamp::logicalBits, 2);
+    const LWWHybridTimestamp received = clock.update(remote);
+    REQUIRE(remote < received);
+    REQUIRE(received < clock.now());
+
+    const LWWHybridTimestamp tooFar(std::uint64_t(9000) << LWWHybridTimestamp::logicalBits, 2);
+    REQUIRE_THROWS_AS(clock.update(tooFar), LWWClockSkewError);
+    REQUIRE(clock.now().getPhysical() == 4000);
+}
+
+
+TEST_CASE("Hybrid logical clock - causally later writes win, ties are broken by replica") {
+    std::uint64_t physical1 = 10000;
+    std::uint64_t physical2 = 1000;
+    LWWHybridLogicalClock clock1(1, std::chrono::milliseconds(0), [&physical1]() { return physical1; });
+    LWWHybridLogicalClock clock2(2, std::chrono::milliseconds(0), [&physical2]() { return physical2; });
+
+    LWWElementDict<std::string, std::string, LWWHybridTimestamp> replica1;
+    LWWElementDict<std::string, std::string, LWWHybridTimestamp> replica2;
+
+    // Replica 2's physical clock lags, yet its write after seeing replica 1's write wins.
+    const LWWHybridTimestamp first = clock1.now();
+    replica1.addElement("k", "first", first);
+    replica2.mergeWith(replica1);
+    clock2.update(first);
+    replica2.addElement("k", "second", clock2.now());
+    replica1.mergeWith(replica2);
+    REQUIRE(replica1.getValueByKey("k") == "second");
+
+    // Concurrent add and removal with equal clock readings do not tie, the higher replica id wins.
+    physical1 = physical2 = 50000;
+    replica1.removeElement("k", "second", clock1.now());
+    replica2.addElement("k", "third", clock2.now());
+    replica1.mergeWith(replica2);
+    replica2.mergeWith(replica1);
+    REQUIRE(replica1.getValueByKey("k") == "third");
+    REQUIRE(replica2.getCurrentData() == replica1.getCurrentData());
+
+    const auto restored = LWWSerialization::deserialize<LWWElementDict<std::string, std::string, LWWHybridTimestamp>>(
+        LWWSerialization::serialize(replica1)
+    );
+    REQUIRE(restored->getCurrentData() == replica1.getCurrentData());
+}
+
+
+TEST_CASE("Timestamp source - strictly increasing across threads") {
+    using Clock = std::chrono::system_clock;
+
+    auto stampThread = []() {
+        std::vector<Clock::time_point> stamps;
+        for(int i = 0; i < 100000; ++i) {
+            stamps.push_back(LWWTimestampSource<Clock::time_point>().next());
+        }
+        return stamps;
+    };
+
+    std::vector<std::vector<Clock::time_point>> stamps(4);
+    std::vector<std::thread> threads;
+    for(auto & threadStamps : stamps) {
+        threads.emplace_back([&]() {
+            threadStamps = stampThread();
+        });
+    }
+    for(auto & thread : threads) {
+        thread.join();
+    }
+
+    std::vector<Clock::time_point> all;
+    for(const auto & threadStamps : stamps) {
+        REQUIRE(std::adjacent_find(threadStamps.begin(), threadStamps.end(), std::greater_equal<>()) == threadStamps.end());
+        all.insert(all.end(), threadStamps.begin(), threadStamps.end());
+    }
+    // No two threads of the process are stamped equally.
+    std::sort(all.begin(), all.end());
+    REQUIRE(std::adjacent_find(all.begin(), all.end()) == all.end());
+
+    // Stamped from the coarse clock, the source stays close to the clock.
+    const auto lag = Clock::now() - LWWTimestampSource<Clock::time_point>().next();
+    REQUIRE(std::chrono::abs(lag) < std::chrono::seconds(1));
+}
+
+
+TEST_CASE("Timestamp source - automatically stamped operations") {
+    LWWElementDict<std::string, int, Timestamp> dict;
+
+    const auto added = dict.addElement("a", 1);
+    const auto removed = dict.removeElement("a", 1);
+    REQUIRE(added < removed);
+    REQUIRE_FALSE(dict.getValueByKey("a"));
+    dict.updateValue("a", 2);
+    REQUIRE(dict.getValueByKey("a") == 2);
+
+    ShardedLWWElementDict<int, int, std::chrono::steady_clock::time_point> shardedDict(4);
+    for(int i = 0; i < 100; ++i) {
+        shardedDict.addElement(0, i);
+    }
+    REQUIRE(shardedDict.getValueByKey(0) == 99);
+
+    const std::string directory = (std::filesystem::temp_directory_path() / "lww_timestamp_source_test").string();
+    std::filesystem::remove_all(directory);
+    LWWDurabilityOptions options;
+    options.backgroundFlag = false;
+
+    LWWHybridLogicalClock clock(7);
+    LWWHybridTimestamp stamped;
+    {
+        DurableLWWElementDict<std::string, std::string, LWWHybridTimestamp> durableDict(directory, options);
+        REQUIRE_THROWS_AS(durableDict.addElement("k", "v"), std::logic_error);
+        durableDict.setTimestampSource(LWWTimestampSource<LWWHybridTimestamp>(clock));
+        stamped = durableDict.addElement("k", "v");
+        REQUIRE(stamped.replicaId == 7);
+    }
+
+    DurableLWWElementDict<std::string, std::string, LWWHybridTimestamp> recovered(directory, options);
+    REQUIRE(recovered.getRecoveredCount() == 1);
+    REQUIRE(recovered.getCurrentData().at("k").second == stamped);
+    std::filesystem::remove_all(directory);
+
+
+    // Every replica of the process stamps with its own clock.
+    LWWHybridLogicalClock otherClock(8);
+    LWWElementDict<std::string, std::string, LWWHybridTimestamp> replica;
+    ShardedLWWElementDict<std::string, std::string, LWWHybridTimestamp> otherReplica(4);
+    replica.setTimestampSource(LWWTimestampSource<LWWHybridTimestamp>(clock));
+    otherReplica.setTimestampSource(LWWTimestampSource<LWWHybridTimestamp>(otherClock));
+    REQUIRE(replica.addElement("k", "v").replicaId == 7);
+    REQUIRE(otherReplica.addElement("k", "v").replicaId == 8);
+    REQUIRE(LWWElementDict<std::string, std::string, LWWHybridTimestamp>(replica).addElement("k", "w").replicaId == 7);
+}
+
+
+
+TEST_CASE("Statistics - histogram buckets and percentiles") {
+    for(std::uint64_t value : { 0ull, 1ull, 7ull, 8ull, 9ull, 15ull, 16ull, 1000ull, 123456789ull, ~0ull }) {
+        const std::size_t bucket = LWWHistogram::bucketOf(value);
+        REQUIRE(bucket < LWWHistogram::bucketCount);
+        REQUIRE(value <= LWWHistogram::bucketUpperBound(bucket));
+        REQUIRE(LWWHistogram::bucketUpperBound(bucket) - value <= value / 8);
+        if(bucket > 0) {
+            REQUIRE(LWWHistogram::bucketUpperBound(bucket - 1) < value);
+        }
+    }
+
+    LWWHistogram histogram;
+    for(std::uint64_t value = 1; value <= 1000; ++value) {
+        histogram.record(value);
+    }
+
+    auto snapshot = histogram.snapshot();
+    REQUIRE(snapshot.count == 1000);
+    REQUIRE(snapshot.max == 1000);
+    REQUIRE(snapshot.mean() == Approx(500.5));
+    REQUIRE(snapshot.percentile(0) == 1);
+    REQUIRE(snapshot.percentile(1) == 1000);
+    REQUIRE(snapshot.percentile(0.5) >= 500);
+    REQUIRE(snapshot.percentile(0.5) <= 500 + 500 / 8);
+    REQUIRE(snapshot.percentile(0.99) >= 990);
+
+    snapshot += histogram.snapshot();
+    REQUIRE(snapshot.count == 2000);
+    REQUIRE(snapshot.sum == 2 * 500500);
+    REQUIRE(LWWHistogram::Snapshot().percentile(0.5) == 0);
+}
+
+
+
+#ifdef LWW_ENABLE_STATS
+TEST_CASE("Statistics - operation counters, history depth and lock contention") {
+    LWWElementDict<char, int, int> dict;
+    dict.addElement('a', 1, 1);
+    dict.addElement('a', 2, 2);
+    dict.addElement('a', 2, 2);
+    dict.updateValue('b', 1, 1);
+    dict.removeElement('b', 1, 3);
+    REQUIRE(dict.getValueByKey('a') == 2);
+    REQUIRE_FALSE(dict.getValueByKey('b'));
+
+    std::vector<LWWOperation<char, int, int>> batch = {
+        { LWWOperation<char, int, int>::Type::add, 'c', 1, 1 },
+        { LWWOperation<char, int, int>::Type::remove, 'a', 1, 1 }
+    };
+    dict.applyBatch(batch.begin(), batch.end());
+
+    LWWElementDict<char, int, int> other;
+    other.addElement('a', 1, 1);
+    other.addElement('d', 1, 1);
+    other.addElement('e', 1, 1);
+    dict.mergeWith(other);
+
+    const LWWStats stats = dict.stats();
+    REQUIRE(stats.addLatency.count == 4);
+    REQUIRE(stats.removeLatency.count == 1);
+    REQUIRE(stats.lookupCount == 2);
+    REQUIRE(stats.lookupLatency.count <= 1);
+    REQUIRE(stats.batchLatency.count == 1);
+    REQUIRE(stats.mergeLatency.count == 1);
+    REQUIRE(stats.duplicateCount == 1);
+    REQUIRE(stats.historyDepth.count == 7);
+    REQUIRE(stats.historyDepth.max == 2);
+    REQUIRE(stats.mergeSize.count == 1);
+    REQUIRE(stats.mergeSize.sum == 2);
+    REQUIRE(stats.lockCount == 7);
+    REQUIRE(stats.contendedLockCount <= stats.lockCount);
+
+    // Lock waits are only recorded for contended acquisitions, which concurrent writers may or may not cause.
+    LWWElementDict<int, int, int> contended;
+    std::vector<std::thread> writers;
+    for(int thread = 0; thread < 4; ++thread) {
+        writers.emplace_back([&contended, thread]() {
+            for(int i = 0; i < 1000; ++i) {
+                contended.addElement(i, thread, i);
+            }
+        });
+    }
+    for(auto & writer : writers) {
+        writer.join();
+    }
+
+    const LWWStats contendedStats = contended.stats();
+    REQUIRE(contendedStats.addLatency.count == 4000);
+    REQUIRE(contendedStats.lockCount == 4000);
+    REQUIRE(contendedStats.lockWait.count == contendedStats.contendedLockCount);
+
+    ShardedLWWElementDict<int, int, int> shardedDict(4);
+    for(int i = 0; i < 100; ++i) {
+        shardedDict.addElement(i, i, i);
+    }
+    for(int i = 0; i < 1000; ++i) {
+        shardedDict.getValueByKey(i);
+    }
+    const LWWStats shardedStats = shardedDict.stats();
+    REQUIRE(shardedStats.addLatency.count == 100);
+    REQUIRE(shardedStats.lookupCount == 1000);
+    REQUIRE(shardedStats.lookupLatency.count >= 1000 / LWWStatsRecorder::lookupSampleRate - 4);
+}
+#else
+TEST_CASE("Statistics - disabled instrumentation leaves statistics empty") {
+    LWWElementDict<char, int, int> dict;
+    dict.addElement('a', 1, 1);
+    dict.addElement('a', 1, 1);
+    dict.removeElement('a', 1, 2);
+    REQUIRE_FALSE(dict.getValueByKey('a'));
+
+    std::vector<LWWOperation<char, int, int>> batch = {
+        { LWWOperation<char, int, int>::Type::add, 'b', 1, 1 }
+    };
+    dict.applyBatch(batch.begin(), batch.end());
+    LWWElementDict<char, int, int> other;
+    other.addElement('c', 1, 1);
+    dict.mergeWith(other);
+    REQUIRE(dict.getValueByKey('c') == 1);
+
+    static_assert(std::is_same_v<LWWMutex, std::mutex>);
+    const LWWStats stats = dict.stats();
+    REQUIRE(stats.addLatency.count == 0);
+    REQUIRE(stats.removeLatency.count == 0);
+    REQUIRE(stats.lookupCount == 0);
+    REQUIRE(stats.batchLatency.count == 0);
+    REQUIRE(stats.mergeLatency.count == 0);
+    REQUIRE(stats.duplicateCount == 0);
+    REQUIRE(stats.historyDepth.count == 0);
+    REQUIRE(stats.lockCount == 0);
+
+    ShardedLWWElementDict<int, int, int> shardedDict(4);
+    shardedDict.addElement(0, 0, 0);
+    REQUIRE(shardedDict.getValueByKey(0) == 0);
+    REQUIRE(shardedDict.stats().addLatency.count == 0);
+    REQUIRE(shardedDict.stats().lookupCount == 0);
+}
+#endif // LWW_ENABLE_STATS
+
+
+
+TEST_CASE("Range queries - ordered range and prefix scans") {
+    LWWElementDict<std::string, int, int> dict;
+    for(const std::string k : { "apple", "apricot", "banana", "blueberry", "cherry", "ap", "b" }) {
+        dict.addElement(k, static_cast<int>(k.size()), 1);
+    }
+    dict.removeElement("banana", 6, 2);
+    dict.addElement(std::string("a\xff"), 1, 1);
+    dict.addElement(std::string("a\xff\xff"), 1, 1);
+    dict.addElement(std::string("b\x01"), 1, 1);
+
+    const auto keysOf = [](const auto & view) {
+        std::vector<std::string> keys;
+        for(const auto & [k, element] : view) {
+            keys.push_back(k);
+        }
+        return keys;
+    };
+
+    REQUIRE(keysOf(dict.scan()).size() == dict.getCurrentData().size());
+    REQUIRE(keysOf(dict.range("apricot", "c"))
+        == std::vector<std::string>{ "apricot", "a\xff", "a\xff\xff", "b", "b\x01", "blueberry" });
+    REQUIRE(dict.range("c", "a").empty());
+    REQUIRE(dict.range("zebra", "zoo").empty());
+    REQUIRE(keysOf(dict.prefix("ap")) == std::vector<std::string>{ "ap", "apple", "apricot" });
+    REQUIRE(keysOf(dict.prefix("b")) == std::vector<std::string>{ "b", "b\x01", "blueberry" });
+    REQUIRE(keysOf(dict.prefix("a\xff")) == std::vector<std::string>{ "a\xff", "a\xff\xff" });
+    REQUIRE(keysOf(dict.prefix("")).size() == dict.getCurrentData().size());
+    REQUIRE(dict.prefix("x").empty());
+    REQUIRE(dict.prefix("apple").begin()->second.first == 5);
+}
+
+
+
+TEST_CASE("Range queries - views are consistent while writers proceed") {
+    LWWElementDict<int, int, int> dict;
+    for(int k = 0; k < 100; ++k) {
+        dict.addElement(k, k, 1);
+    }
+
+    std::atomic<bool> doneFlag { false };
+    std::thread writer;
+    {
+        const auto view = dict.range(10, 20);
+        writer = std::thread([&dict, &doneFlag]() {
+            dict.addElement(15, -1, 2);
+            dict.removeElement(12, 12, 2);
+            doneFlag = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        // The viewed state stays unmodified, writers wait for the view to be released.
+        REQUIRE_FALSE(doneFlag);
+        int expected = 10;
+        for(const auto & [k, element] : view) {
+            REQUIRE(k == expected);
+            REQUIRE(element.first == expected);
+            ++expected;
+        }
+        REQUIRE(expected == 20);
+    }
+    writer.join();
+
+    REQUIRE(doneFlag);
+    std::vector<int> values;
+    for(const auto & [k, element] : dict.range(10, 20)) {
+        values.push_back(element.first);
+    }
+    REQUIRE(values == std::vector<int>{ 10, 11, 13, 14, -1, 16, 17, 18, 19 });
+}
+
+
+
+TEST_CASE("Multi-get - values in input order under one view") {
+    LWWElementDict<int, std::string, int> dict;
+    for(int k = 0; k < 1000; k += 2) {
+        dict.addElement(k, std::to_string(k), 1);
+    }
+    dict.removeElement(10, "10", 2);
+
+    const std::vector<int> keys = { 998, 3, 10, 0, 500, 998, -5, 12, 2000, 4 };
+    const auto values = dict.getValuesByKeys(keys);
+    REQUIRE(values.size() == keys.size());
+    for(std::size_t position = 0; position < keys.size(); ++position) {
+        const auto expected = dict.getValueByKey(keys[position]);
+        REQUIRE(values[position].has_value() == expected.has_value());
+        if(expected) {
+            REQUIRE(*values[position] == *expected);
+        }
+    }
+    REQUIRE(values[0] == "998");
+    REQUIRE_FALSE(values[2]);
+    REQUIRE(dict.getValuesByKeys(std::vector<int>()).empty());
+
+    const int array[] = { 4, 2 };
+    REQUIRE(dict.getValuesByKeys(std::begin(array), std::end(array)) == std::vector<std::optional<std::string>>{ "4", "2" });
+
+    ShardedLWWElementDict<int, std::string, int> shardedDict(8);
+    for(int k = 0; k < 1000; k += 3) {
+        shardedDict.addElement(k, std::to_string(k), 1);
+    }
+    std::vector<int> shardedKeys;
+    for(int k = 999; k >= 0; k -= 7) {
+        shardedKeys.push_back(k);
+    }
+    const auto shardedValues = shardedDict.getValuesByKeys(shardedKeys);
+    for(std::size_t position = 0; position < shardedKeys.size(); ++position) {
+        const int k = shardedKeys[position];
+        REQUIRE(shardedValues[position] == (k % 3 == 0 ? std::optional<std::string>(std::to_string(k)) : std::nullopt));
+    }
+}
+
+
+
+TEST_CASE("Change stream - one event per visible change") {
+    using Dict = LWWElementDict<char, int, int>;
+    using Type = Dict::Change::Type;
+    Dict dict;
+    dict.addElement('a', 1, 1);
+
+    const auto ring = dict.subscribe(64);
+    dict.addElement('a', 2, 2);
+    dict.addElement('a', 0, 1);
+    dict.addElement('b', 1, 1);
+    dict.removeElement('b', 1, 1);
+    dict.removeElement('c', 1, 1);
+
+    std::vector<Dict::Change> changes;
+    REQUIRE(ring->drain(changes) == 3);
+    REQUIRE(changes[0].type == Type::replaced);
+    REQUIRE(changes[0].key == 'a');
+    REQUIRE(changes[0].value == 2);
+    REQUIRE(changes[0].timestamp == 2);
+    REQUIRE(changes[1].type == Type::inserted);
+    REQUIRE(changes[1].key == 'b');
+    REQUIRE(changes[2].type == Type::removed);
+    REQUIRE_FALSE(changes[2].value);
+    REQUIRE(ring->drain(changes) == 0);
+
+    std::vector<Dict::Op> batch = {
+        { Dict::Op::Type::add, 'c', 3, 3 },
+        { Dict::Op::Type::remove, 'a', 2, 3 }
+    };
+    dict.applyBatch(batch.begin(), batch.end());
+
+    Dict other;
+    other.addElement('c', 4, 4);
+    other.addElement('d', 1, 1);
+    dict.mergeWith(other);
+
+    changes.clear();
+    ring->drain([&changes](Dict::Change && change) {
+        changes.push_back(std::move(change));
+    });
+    REQUIRE(changes.size() == 4);
+    REQUIRE(changes[0].type == Type::removed);
+    REQUIRE(changes[0].key == 'a');
+    REQUIRE(changes[1].type == Type::inserted);
+    REQUIRE(changes[1].key == 'c');
+    REQUIRE(changes[2].type == Type::replaced);
+    REQUIRE(changes[2].value == 4);
+    REQUIRE(changes[3].type == Type::inserted);
+    REQUIRE(changes[3].key == 'd');
+
+    // Released subscriptions are dropped, remaining ones keep receiving.
+    auto second = dict.subscribe();
+    second.reset();
+    for(int i = 0; i < 3; ++i) {
+        dict.addElement('e', i, 10 + i);
+    }
+    dict.removeElement('d', 1, 5);
+    REQUIRE(ring->size() == 4);
+}
+
+
+
+TEST_CASE("Change stream - overflow drops events and raises flag") {
+    LWWElementDict<int, int, int> dict;
+    const auto ring = dict.subscribe(3);
+    REQUIRE(ring->getCapacity() == 4);
+
+    for(int k = 0; k < 10; ++k) {
+        dict.addElement(k, k, 1);
+    }
+    REQUIRE(ring->size() == 4);
+    REQUIRE(ring->hasOverflowed());
+    REQUIRE(ring->getDroppedCount() == 6);
+
+    std::vector<LWWElementDict<int, int, int>::Change> changes;
+    REQUIRE(ring->drain(changes, 3) == 3);
+    REQUIRE(changes.back().key == 2);
+    REQUIRE(ring->resetOverflow());
+    REQUIRE_FALSE(ring->resetOverflow());
+
+    dict.addElement(10, 10, 1);
+    REQUIRE(ring->drain(changes) == 2);
+    REQUIRE(changes.back().key == 10);
+    REQUIRE_FALSE(ring->hasOverflowed());
+
+    REQUIRE_THROWS_AS(dict.subscribe(0), std::invalid_argument);
+}
+
+
+
+TEST_CASE("Change stream - consumer drains concurrently with writers") {
+    LWWElementDict<int, int, int> dict;
+    const auto ring = dict.subscribe(256);
+    constexpr int changeCount = 20000;
+
+    std::atomic<bool> doneFlag { false };
+    std::size_t received = 0;
+    int lastKey = -1;
+    bool orderedFlag = true;
+    std::thread consumer([&]() {
+        std::vector<LWWElementDict<int, int, int>::Change> changes;
+        while(true) {
+            const bool finalFlag = doneFlag;
+            changes.clear();
+            received += ring->drain(changes, 64);
+            for(const auto & change : changes) {
+                orderedFlag = orderedFlag && change.key > lastKey;
+                lastKey = change.key;
+            }
+            if(finalFlag && ring->size() == 0) {
+                break;
+            }
+        }
+    });
+
+    for(int k = 0; k < changeCount; ++k) {
+        dict.addElement(k, k, 1);
+    }
+    doneFlag = true;
+    consumer.join();
+
+    REQUIRE(orderedFlag);
+    REQUIRE(received + ring->getDroppedCount() == changeCount);
+    REQUIRE(ring->hasOverflowed() == (ring->getDroppedCount() > 0));
+}
+
+
+
+TEST_CASE("Merkle digest - independent of arrival order and maintained incrementally") {
+    LWWElementDict<int, int, int> first;
+    LWWElementDict<int, int, int> second;
+    REQUIRE(first.digest().getRootHash() == 0);
+
+    for(int k = 0; k < 1000; ++k) {
+        first.addElement(k, k, 1);
+        first.addElement(k, -k, 3);
+        second.addElement(999 - k, k - 999, 3);
+        second.addElement(999 - k, 999 - k, 1);
+    }
+    for(int k = 0; k < 1000; k += 7) {
+        first.removeElement(k, k, 2);
+    }
+    for(int k = 994; k >= 0; k -= 7) {
+        second.removeElement(k, k, 2);
+    }
+
+    const LWWMerkleTree firstTree = first.digest();
+    REQUIRE(firstTree.getDepth() == 10);
+    REQUIRE(firstTree.getNodes().size() == 2047);
+    REQUIRE(firstTree.getRootHash() == second.digest().getRootHash());
+    REQUIRE(firstTree.diff(second.digest()).empty());
+
+    // A later write changes the digest of its key's bucket only, and a copy rebuilding from scratch agrees.
+    first.addElement(500, 0, 4);
+    const LWWMerkleTree changedTree = first.digest();
+    const auto ranges = changedTree.diff(firstTree);
+    REQUIRE(ranges.size() == 1);
+    REQUIRE(ranges.front().first <= LWWMerkleTree::bucketOf(500));
+    REQUIRE(LWWMerkleTree::bucketOf(500) < ranges.front().last);
+    REQUIRE(ranges.front().last - ranges.front().first == 1u << (LWWMerkleTree::maxDepth - 10));
+
+    const LWWElementDict<int, int, int> copy(first);
+    REQUIRE(copy.digest().getNodes() == changedTree.getNodes());
+    REQUIRE(first.digest(LWWMerkleTree::maxDepth).getRootHash() == changedTree.getRootHash());
+}
+
+
+
+TEST_CASE("Merkle digest - anti-entropy exchanges differing ranges only") {
+    LWWElementDict<std::string, int, int> first;
+    LWWElementDict<std::string, int, int> second;
+    for(int k = 0; k < 5000; ++k) {
+        first.addElement(std::to_string(k), k, 1);
+        second.addElement(std::to_string(k), k, 1);
+    }
+    first.addElement("1234", -1, 2);
+    first.removeElement("42", 42, 2);
+    second.addElement("new", 7, 1);
+    second.removeElement("4999", 4999, 3);
+
+    const auto firstTree = first.digest(12);
+    const auto secondTree = second.digest(12);
+    const auto ranges = firstTree.diff(secondTree);
+    REQUIRE(!ranges.empty());
+    REQUIRE(ranges.size() <= 4);
+    REQUIRE(secondTree.diff(firstTree) == ranges);
+    for(std::size_t i = 1; i < ranges.size(); ++i) {
+        REQUIRE(ranges[i - 1].last < ranges[i].first);
+    }
+
+    const auto firstDelta = first.extractRanges(ranges);
+    const auto secondDelta = second.extractRanges(ranges);
+    REQUIRE(firstDelta->getCurrentData().size() < 20);
+    REQUIRE(secondDelta->getCurrentData().size() < 20);
+
+    first.mergeWith(*secondDelta);
+    second.mergeWith(*firstDelta);
+    REQUIRE(first.digest(12).getNodes() == second.digest(12).getNodes());
+    REQUIRE(first.getCurrentData() == second.getCurrentData());
+    REQUIRE(first.getValueByKey("1234") == -1);
+    REQUIRE(!second.getValueByKey("42"));
+    REQUIRE(first.getValueByKey("new") == 7);
+    REQUIRE(!first.getValueByKey("4999"));
+}
+
+
+
+TEST_CASE("Merkle digest - compaction and mismatched depths") {
+    LWWElementDict<int, int, int> dict;
+    for(int k = 0; k < 100; ++k) {
+        dict.addElement(k, k, 1);
+    }
+    dict.removeElement(5, 5, 2);
+    const auto fullTree = dict.digest();
+
+    // Compaction discards stable history, the digest is rebuilt from what remains.
+    dict.compact(10);
+    LWWElementDict<int, int, int> rebuilt;
+    for(int k = 0; k < 100; ++k) {
+        if(k != 5) {
+            rebuilt.addElement(k, k, 1);
+        }
+    }
+    REQUIRE(dict.digest().getNodes() == rebuilt.digest().getNodes());
+    REQUIRE(dict.digest().getRootHash() != fullTree.getRootHash());
+
+    REQUIRE_THROWS_AS(dict.digest().diff(dict.digest(8)), std::invalid_argument);
+    REQUIRE_THROWS_AS(dict.digest(LWWMerkleTree::maxDepth + 1), std::invalid_argument);
+}